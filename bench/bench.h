@@ -0,0 +1,50 @@
+#ifndef JSON_BENCH_H
+#define JSON_BENCH_H
+
+#include <stdint.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#include <time.h>
+#endif
+
+static inline uint64_t
+bench_now(void) {
+#ifdef _WIN32
+  LARGE_INTEGER counter, frequency;
+  QueryPerformanceCounter(&counter);
+  QueryPerformanceFrequency(&frequency);
+
+  return (uint64_t) ((double) counter.QuadPart * 1e9 / (double) frequency.QuadPart);
+#else
+  struct timespec now;
+  clock_gettime(CLOCK_MONOTONIC, &now);
+
+  return (uint64_t) now.tv_sec * 1000000000 + (uint64_t) now.tv_nsec;
+#endif
+}
+
+// The peak resident set size of the process so far, in kilobytes.
+static inline uint64_t
+bench_peak_rss(void) {
+#ifdef _WIN32
+  PROCESS_MEMORY_COUNTERS counters;
+  GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters));
+
+  return (uint64_t) counters.PeakWorkingSetSize / 1024;
+#else
+  struct rusage usage;
+  getrusage(RUSAGE_SELF, &usage);
+
+#ifdef __APPLE__
+  return (uint64_t) usage.ru_maxrss / 1024;
+#else
+  return (uint64_t) usage.ru_maxrss;
+#endif
+#endif
+}
+
+#endif // JSON_BENCH_H
@@ -0,0 +1,498 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utf.h>
+
+#include "../include/json.h"
+#include "bench.h"
+#include "corpus.h"
+
+// Decode and encode throughput over the generated corpus, or over the files
+// given as arguments. Each operation is repeated for at least MIN_TIME and
+// the fastest run is reported, along with the allocations made and the peak
+// heap growth during a single run. Passing --write <dir> writes the corpus
+// out as files instead.
+
+#define MIN_TIME 200000000
+#define MIN_RUNS 3
+
+#ifdef __GLIBC__
+#include <malloc.h>
+
+// Count allocations by interposing the allocator, which glibc allows from the
+// executable itself.
+
+extern void *
+__libc_malloc(size_t size);
+
+extern void *
+__libc_calloc(size_t count, size_t size);
+
+extern void *
+__libc_realloc(void *ptr, size_t size);
+
+extern void
+__libc_free(void *ptr);
+
+#define BENCH_ALLOCATIONS
+
+static size_t bench_allocations;
+static size_t bench_live;
+static size_t bench_peak;
+
+static inline void *
+bench_track(void *ptr) {
+  if (ptr) {
+    bench_allocations++;
+    bench_live += malloc_usable_size(ptr);
+
+    if (bench_live > bench_peak) bench_peak = bench_live;
+  }
+
+  return ptr;
+}
+
+void *
+malloc(size_t size) {
+  return bench_track(__libc_malloc(size));
+}
+
+void *
+calloc(size_t count, size_t size) {
+  return bench_track(__libc_calloc(count, size));
+}
+
+void *
+realloc(void *ptr, size_t size) {
+  size_t previous = ptr ? malloc_usable_size(ptr) : 0;
+
+  void *result = __libc_realloc(ptr, size);
+
+  if (result) bench_live -= previous;
+
+  return bench_track(result);
+}
+
+void
+free(void *ptr) {
+  if (ptr) bench_live -= malloc_usable_size(ptr);
+
+  __libc_free(ptr);
+}
+#endif
+
+typedef struct {
+  const json_t *value;
+  size_t index;
+} bench_frame_t;
+
+static size_t
+bench_count_nodes(const json_t *value) {
+  size_t count = 1, depth = 0, capacity = 64;
+
+  bench_frame_t *frames = malloc(capacity * sizeof(bench_frame_t));
+  assert(frames);
+
+  if (json_is_array(value) || json_is_object(value)) frames[depth++] = (bench_frame_t) {value, 0};
+
+  while (depth) {
+    bench_frame_t *frame = &frames[depth - 1];
+
+    const json_t *child;
+
+    if (json_is_array(frame->value)) {
+      if (frame->index == json_array_size(frame->value)) {
+        depth--;
+        continue;
+      }
+
+      child = json_array_peek(frame->value, frame->index++);
+    } else {
+      if (frame->index == json_object_size(frame->value)) {
+        depth--;
+        continue;
+      }
+
+      child = json_object_peek_value(frame->value, frame->index++);
+      count++; // The key
+    }
+
+    count++;
+
+    if (json_is_array(child) || json_is_object(child)) {
+      if (depth == capacity) {
+        capacity *= 2;
+        frames = realloc(frames, capacity * sizeof(bench_frame_t));
+        assert(frames);
+      }
+
+      frames[depth++] = (bench_frame_t) {child, 0};
+    }
+  }
+
+  free(frames);
+
+  return count;
+}
+
+// Rebuild a decoded tree with UTF-16 strings, which is what the UTF-16 encoder
+// expects. A UTF-8 string never takes up more code units as UTF-16.
+static json_t *
+bench_to_utf16le(const json_t *value) {
+  int e;
+
+  json_builder_t *builder;
+  e = json_create_builder(&builder);
+  assert(e == 0);
+
+  size_t depth = 0, capacity = 64;
+
+  bench_frame_t *frames = malloc(capacity * sizeof(bench_frame_t));
+  assert(frames);
+
+  utf16_t *scratch = NULL;
+
+  while (true) {
+    if (json_is_array(value) || json_is_object(value)) {
+      e = json_is_array(value) ? json_builder_begin_array(builder) : json_builder_begin_object(builder);
+      assert(e == 0);
+
+      if (depth == capacity) {
+        capacity *= 2;
+        frames = realloc(frames, capacity * sizeof(bench_frame_t));
+        assert(frames);
+      }
+
+      frames[depth++] = (bench_frame_t) {value, 0};
+    } else if (json_is_string(value)) {
+      size_t len = json_string_length(value);
+
+      scratch = realloc(scratch, (len + 1) * sizeof(utf16_t));
+      assert(scratch);
+
+      e = json_builder_string_utf16le(builder, scratch, utf8_convert_to_utf16le(json_string_value_utf8(value), len, scratch));
+      assert(e == 0);
+    } else if (json_is_number(value)) {
+      if (json_number_is_int64(value)) {
+        e = json_builder_number_int64(builder, json_number_int64_value(value));
+      } else if (json_number_is_uint64(value)) {
+        json_t *number;
+        e = json_create_number_uint64(json_number_uint64_value(value), &number);
+        assert(e == 0);
+
+        e = json_builder_value(builder, number);
+      } else {
+        e = json_builder_number(builder, json_number_value(value));
+      }
+
+      assert(e == 0);
+    } else if (json_is_boolean(value)) {
+      e = json_builder_boolean(builder, json_boolean_value(value));
+      assert(e == 0);
+    } else {
+      e = json_builder_null(builder);
+      assert(e == 0);
+    }
+
+    value = NULL;
+
+    while (depth && value == NULL) {
+      bench_frame_t *frame = &frames[depth - 1];
+
+      if (json_is_array(frame->value)) {
+        if (frame->index < json_array_size(frame->value)) {
+          value = json_array_peek(frame->value, frame->index++);
+          continue;
+        }
+
+        e = json_builder_end_array(builder);
+      } else {
+        if (frame->index < json_object_size(frame->value)) {
+          const json_t *key = json_object_peek_key(frame->value, frame->index);
+
+          size_t len = json_string_length(key);
+
+          scratch = realloc(scratch, (len + 1) * sizeof(utf16_t));
+          assert(scratch);
+
+          e = json_builder_key_utf16le(builder, scratch, utf8_convert_to_utf16le(json_string_value_utf8(key), len, scratch));
+          assert(e == 0);
+
+          value = json_object_peek_value(frame->value, frame->index++);
+          continue;
+        }
+
+        e = json_builder_end_object(builder);
+      }
+
+      assert(e == 0);
+
+      depth--;
+    }
+
+    if (value == NULL) break;
+  }
+
+  json_t *result;
+  e = json_builder_finish(builder, &result);
+  assert(e == 0);
+
+  json_destroy_builder(builder);
+
+  free(frames);
+  free(scratch);
+
+  return result;
+}
+
+typedef enum {
+  bench_decode_utf8,
+  bench_encode_utf8,
+  bench_encode_utf16le,
+  bench_decode_utf16le,
+} bench_op_t;
+
+static const char *bench_op_names[] = {
+  "decode_utf8",
+  "encode_utf8",
+  "encode_utf16le",
+  "decode_utf16le",
+};
+
+typedef struct {
+  const char *buffer;
+  size_t len;
+  const utf16_t *buffer_utf16le;
+  size_t len_utf16le;
+  const json_t *value;
+  const json_t *value_utf16le;
+} bench_input_t;
+
+static int
+bench_run(bench_op_t op, const bench_input_t *input) {
+  int err;
+
+  json_t *value;
+  utf8_t *utf8;
+  utf16_t *utf16le;
+
+  switch (op) {
+  case bench_decode_utf8:
+    err = json_decode_utf8((const utf8_t *) input->buffer, input->len, &value);
+    if (err == 0) json_deref(value);
+    return err;
+
+  case bench_encode_utf8:
+    err = json_encode_utf8(input->value, &utf8);
+    if (err == 0) free(utf8);
+    return err;
+
+  case bench_encode_utf16le:
+    err = json_encode_utf16le(input->value_utf16le, &utf16le);
+    if (err == 0) free(utf16le);
+    return err;
+
+  case bench_decode_utf16le:
+  default:
+    err = json_decode_utf16le(input->buffer_utf16le, input->len_utf16le, &value);
+    if (err == 0) json_deref(value);
+    return err;
+  }
+}
+
+static void
+bench_measure(const char *corpus, bench_op_t op, const bench_input_t *input, size_t bytes, size_t nodes) {
+  int e;
+
+#ifdef BENCH_ALLOCATIONS
+  size_t allocations = bench_allocations, live = bench_live;
+
+  bench_peak = bench_live;
+#endif
+
+  // Operations that aren't supported are reported as skipped rather than
+  // failing the run, so that they show up as soon as they are.
+  e = bench_run(op, input);
+
+  if (e != 0) {
+    printf("{\"bench\":\"codec\",\"corpus\":\"%s\",\"op\":\"%s\",\"skipped\":true,\"error\":%d}\n", corpus, bench_op_names[op], e);
+
+    fflush(stdout);
+
+    return;
+  }
+
+#ifdef BENCH_ALLOCATIONS
+  allocations = bench_allocations - allocations;
+
+  size_t peak = bench_peak - live;
+#endif
+
+  uint64_t best = UINT64_MAX, total = 0;
+
+  for (int runs = 0; runs < MIN_RUNS || total < MIN_TIME; runs++) {
+    uint64_t start = bench_now();
+
+    e = bench_run(op, input);
+    assert(e == 0);
+
+    uint64_t elapsed = bench_now() - start;
+
+    if (elapsed < best) best = elapsed;
+
+    total += elapsed;
+  }
+
+  if (best == 0) best = 1;
+
+  printf("{\"bench\":\"codec\",\"corpus\":\"%s\",\"op\":\"%s\",\"bytes\":%zu,\"nodes\":%zu,\"ns\":%llu,\"mb_per_s\":%.2f,\"ns_per_node\":%.3f,", corpus, bench_op_names[op], bytes, nodes, (unsigned long long) best, (double) bytes / 1e6 / ((double) best / 1e9), (double) best / (double) nodes);
+
+#ifdef BENCH_ALLOCATIONS
+  printf("\"allocations\":%zu,\"peak_heap_bytes\":%zu,", allocations, peak);
+#else
+  printf("\"allocations\":null,\"peak_heap_bytes\":null,");
+#endif
+
+  printf("\"peak_rss_kb\":%llu}\n", (unsigned long long) bench_peak_rss());
+
+  fflush(stdout);
+}
+
+static void
+bench_document(const char *corpus, const char *buffer, size_t len) {
+  int e;
+
+  json_t *value;
+  e = json_decode_utf8((const utf8_t *) buffer, len, &value);
+  assert(e == 0);
+
+  size_t nodes = bench_count_nodes(value);
+
+  utf8_t *utf8;
+  e = json_encode_utf8(value, &utf8);
+  assert(e == 0);
+
+  size_t len_utf8 = strlen((char *) utf8);
+
+  free(utf8);
+
+  json_t *value_utf16le = bench_to_utf16le(value);
+
+  utf16_t *utf16le;
+  e = json_encode_utf16le(value_utf16le, &utf16le);
+  assert(e == 0);
+
+  size_t len_utf16le = 0;
+  while (utf16le[len_utf16le]) len_utf16le++;
+
+  bench_input_t input = {
+    .buffer = buffer,
+    .len = len,
+    .buffer_utf16le = utf16le,
+    .len_utf16le = len_utf16le,
+    .value = value,
+    .value_utf16le = value_utf16le,
+  };
+
+  bench_measure(corpus, bench_decode_utf8, &input, len, nodes);
+  bench_measure(corpus, bench_encode_utf8, &input, len_utf8, nodes);
+  bench_measure(corpus, bench_encode_utf16le, &input, len_utf16le * sizeof(utf16_t), nodes);
+  bench_measure(corpus, bench_decode_utf16le, &input, len_utf16le * sizeof(utf16_t), nodes);
+
+  free(utf16le);
+
+  json_deref(value_utf16le);
+  json_deref(value);
+}
+
+static char *
+bench_read_file(const char *path, size_t *len) {
+  FILE *file = fopen(path, "rb");
+
+  if (file == NULL) return NULL;
+
+  char *buffer = NULL;
+  size_t capacity = 0;
+
+  *len = 0;
+
+  while (true) {
+    if (*len == capacity) {
+      capacity = capacity ? capacity * 2 : 65536;
+      buffer = realloc(buffer, capacity);
+      assert(buffer);
+    }
+
+    size_t n = fread(&buffer[*len], 1, capacity - *len, file);
+
+    if (n == 0) break;
+
+    *len += n;
+  }
+
+  fclose(file);
+
+  return buffer;
+}
+
+int
+main(int argc, char **argv) {
+  size_t corpus_len = sizeof(bench_corpus) / sizeof(bench_corpus[0]);
+
+  if (argc == 3 && strcmp(argv[1], "--write") == 0) {
+    for (size_t i = 0; i < corpus_len; i++) {
+      bench_buffer_t buffer = bench_corpus[i].generate();
+
+      char path[4096];
+      snprintf(path, sizeof(path), "%s/%s.json", argv[2], bench_corpus[i].name);
+
+      FILE *file = fopen(path, "wb");
+
+      if (file == NULL) {
+        fprintf(stderr, "Could not open %s\n", path);
+
+        return 1;
+      }
+
+      size_t written = fwrite(buffer.data, 1, buffer.len, file);
+
+      free(buffer.data);
+
+      if (fclose(file) != 0 || written != buffer.len) {
+        fprintf(stderr, "Could not write %s\n", path);
+
+        return 1;
+      }
+    }
+
+    return 0;
+  }
+
+  if (argc > 1) {
+    for (int i = 1; i < argc; i++) {
+      size_t len;
+      char *buffer = bench_read_file(argv[i], &len);
+
+      if (buffer == NULL) {
+        fprintf(stderr, "Could not read %s\n", argv[i]);
+
+        return 1;
+      }
+
+      bench_document(argv[i], buffer, len);
+
+      free(buffer);
+    }
+
+    return 0;
+  }
+
+  for (size_t i = 0; i < corpus_len; i++) {
+    bench_buffer_t buffer = bench_corpus[i].generate();
+
+    bench_document(bench_corpus[i].name, buffer.data, buffer.len);
+
+    free(buffer.data);
+  }
+}
@@ -0,0 +1,273 @@
+#ifndef JSON_BENCH_CORPUS_H
+#define JSON_BENCH_CORPUS_H
+
+#include <assert.h>
+#include <stdarg.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Synthetic stand-ins for the usual JSON benchmark files, generated from a
+// fixed seed so that every run and every commit measures the same bytes.
+// They mimic the shape of the originals rather than their contents:
+//
+// - twitter: objects of mixed scalars, short strings and non-ASCII text
+// - citm_catalog: wide objects keyed by ids and many small integer arrays
+// - canada: a few deep arrays of full precision coordinates
+// - ints, doubles: one large packed array each
+// - deep: arrays and objects nested many thousands of levels
+
+typedef struct {
+  char *data;
+  size_t len;
+  size_t capacity;
+} bench_buffer_t;
+
+typedef struct {
+  const char *name;
+  bench_buffer_t (*generate)(void);
+} bench_corpus_t;
+
+static uint64_t bench_seed;
+
+static inline uint64_t
+bench_random(void) {
+  bench_seed ^= bench_seed >> 12;
+  bench_seed ^= bench_seed << 25;
+  bench_seed ^= bench_seed >> 27;
+
+  return bench_seed * 0x2545f4914f6cdd1d;
+}
+
+static inline uint64_t
+bench_random_range(uint64_t min, uint64_t max) {
+  return min + bench_random() % (max - min + 1);
+}
+
+static inline double
+bench_random_double(double min, double max) {
+  return min + (double) (bench_random() >> 11) / (double) (UINT64_C(1) << 53) * (max - min);
+}
+
+static inline void
+bench_append(bench_buffer_t *buffer, const char *format, ...) {
+  va_list args;
+
+  while (true) {
+    va_start(args, format);
+    int len = vsnprintf(buffer->data + buffer->len, buffer->capacity - buffer->len, format, args);
+    va_end(args);
+
+    assert(len >= 0);
+
+    if (buffer->len + len < buffer->capacity) {
+      buffer->len += len;
+
+      return;
+    }
+
+    buffer->capacity = buffer->capacity ? buffer->capacity * 2 : 65536;
+    buffer->data = realloc(buffer->data, buffer->capacity);
+
+    assert(buffer->data);
+  }
+}
+
+static inline void
+bench_append_word(bench_buffer_t *buffer) {
+  static const char *words[] = {
+    "lorem", "ipsum", "dolor", "sit", "amet", "caf\xc3\xa9", "na\xc3\xafve", "\xe6\x9d\xb1\xe4\xba\xac", "\\\"quoted\\\"", "line\\nbreak", "tab\\tbed", "json", "stream", "#hashtag", "@mention", "https:\\/\\/example.com\\/path"
+  };
+
+  bench_append(buffer, "%s", words[bench_random() % (sizeof(words) / sizeof(words[0]))]);
+}
+
+static inline void
+bench_append_text(bench_buffer_t *buffer, size_t min, size_t max) {
+  bench_append(buffer, "\"");
+
+  for (size_t i = 0, n = bench_random_range(min, max); i < n; i++) {
+    if (i) bench_append(buffer, " ");
+
+    bench_append_word(buffer);
+  }
+
+  bench_append(buffer, "\"");
+}
+
+static inline bench_buffer_t
+bench_generate_twitter(void) {
+  bench_buffer_t buffer = {NULL, 0, 0};
+
+  bench_seed = 0x7477697474657201;
+
+  bench_append(&buffer, "{\"statuses\":[");
+
+  for (int i = 0; i < 400; i++) {
+    uint64_t id = bench_random_range(UINT64_C(500000000000000000), UINT64_C(600000000000000000));
+    uint64_t user = bench_random_range(1000, 3000000000);
+
+    if (i) bench_append(&buffer, ",");
+
+    bench_append(&buffer, "{\"metadata\":{\"result_type\":\"recent\",\"iso_language_code\":\"ja\"},\"created_at\":\"Sun Aug 31 00:29:%02d +0000 2014\",\"id\":%llu,\"id_str\":\"%llu\",\"text\":", i % 60, (unsigned long long) id, (unsigned long long) id);
+    bench_append_text(&buffer, 4, 24);
+    bench_append(&buffer, ",\"truncated\":false,\"in_reply_to_status_id\":null,\"user\":{\"id\":%llu,\"id_str\":\"%llu\",\"name\":", (unsigned long long) user, (unsigned long long) user);
+    bench_append_text(&buffer, 1, 3);
+    bench_append(&buffer, ",\"description\":");
+    bench_append_text(&buffer, 0, 20);
+    bench_append(&buffer, ",\"protected\":false,\"followers_count\":%llu,\"friends_count\":%llu,\"utc_offset\":null,\"verified\":%s,\"profile_background_color\":\"C0DEED\"},", (unsigned long long) bench_random_range(0, 100000), (unsigned long long) bench_random_range(0, 5000), bench_random() % 8 ? "false" : "true");
+    bench_append(&buffer, "\"geo\":null,\"coordinates\":null,\"retweet_count\":%llu,\"favorite_count\":%llu,\"entities\":{\"hashtags\":[", (unsigned long long) bench_random_range(0, 5000), (unsigned long long) bench_random_range(0, 500));
+
+    for (uint64_t j = 0, n = bench_random_range(0, 3); j < n; j++) {
+      bench_append(&buffer, "%s{\"text\":", j ? "," : "");
+      bench_append_text(&buffer, 1, 1);
+      bench_append(&buffer, ",\"indices\":[%llu,%llu]}", (unsigned long long) j * 10, (unsigned long long) j * 10 + 8);
+    }
+
+    bench_append(&buffer, "],\"symbols\":[],\"urls\":[]},\"favorited\":false,\"retweeted\":false,\"lang\":\"ja\"}");
+  }
+
+  bench_append(&buffer, "],\"search_metadata\":{\"completed_in\":0.087,\"max_id\":505874924095815681,\"query\":\"%%E4%%B8%%80\",\"count\":400,\"since_id\":0}}");
+
+  return buffer;
+}
+
+static inline bench_buffer_t
+bench_generate_citm_catalog(void) {
+  bench_buffer_t buffer = {NULL, 0, 0};
+
+  bench_seed = 0x6369746d63617401;
+
+  bench_append(&buffer, "{\"areaNames\":{");
+
+  for (int i = 0; i < 200; i++) {
+    bench_append(&buffer, "%s\"%d\":", i ? "," : "", 205705993 + i);
+    bench_append_text(&buffer, 1, 3);
+  }
+
+  bench_append(&buffer, "},\"events\":{");
+
+  for (int i = 0; i < 2000; i++) {
+    int id = 138586341 + i * 7;
+
+    bench_append(&buffer, "%s\"%d\":{\"description\":null,\"id\":%d,\"logo\":%s,\"name\":", i ? "," : "", id, id, i % 3 ? "null" : "\"\\/images\\/UE0AAAAACEKo6QAAAAZDSVRN\"");
+    bench_append_text(&buffer, 1, 4);
+    bench_append(&buffer, ",\"subTopicIds\":[337184269,337184283],\"subjectCode\":null,\"subtitle\":null,\"topicIds\":[324846099,107888604]}");
+  }
+
+  bench_append(&buffer, "},\"performances\":[");
+
+  for (int i = 0; i < 2500; i++) {
+    bench_append(&buffer, "%s{\"eventId\":%d,\"id\":%d,\"logo\":null,\"name\":null,\"prices\":[", i ? "," : "", 138586341 + (i % 2000) * 7, 339887544 + i);
+
+    for (uint64_t j = 0, n = bench_random_range(1, 4); j < n; j++) {
+      bench_append(&buffer, "%s{\"amount\":%llu,\"audienceSubCategoryId\":337100890,\"seatCategoryId\":%llu}", j ? "," : "", (unsigned long long) bench_random_range(10000, 200000), (unsigned long long) 338937295 + j);
+    }
+
+    bench_append(&buffer, "],\"seatCategories\":[");
+
+    for (uint64_t j = 0, n = bench_random_range(1, 4); j < n; j++) {
+      bench_append(&buffer, "%s{\"areas\":[{\"areaId\":%llu,\"blockIds\":[]},{\"areaId\":%llu,\"blockIds\":[]}],\"seatCategoryId\":%llu}", j ? "," : "", (unsigned long long) bench_random_range(205705993, 205706192), (unsigned long long) bench_random_range(205705993, 205706192), (unsigned long long) 338937295 + j);
+    }
+
+    bench_append(&buffer, "],\"seatMapImage\":null,\"start\":%llu,\"venueCode\":\"PLEYEL_PLEYEL\"}", (unsigned long long) UINT64_C(1372701600000) + i * UINT64_C(86400000));
+  }
+
+  bench_append(&buffer, "],\"venueNames\":{\"PLEYEL_PLEYEL\":\"Salle Pleyel\"}}");
+
+  return buffer;
+}
+
+static inline bench_buffer_t
+bench_generate_canada(void) {
+  bench_buffer_t buffer = {NULL, 0, 0};
+
+  bench_seed = 0x63616e6164610001;
+
+  bench_append(&buffer, "{\"type\":\"FeatureCollection\",\"features\":[{\"type\":\"Feature\",\"properties\":{\"name\":\"Canada\"},\"geometry\":{\"type\":\"Polygon\",\"coordinates\":[");
+
+  for (int i = 0; i < 480; i++) {
+    bench_append(&buffer, "%s[", i ? "," : "");
+
+    double lon = bench_random_double(-141, -52), lat = bench_random_double(42, 83);
+
+    for (int j = 0; j < 120; j++) {
+      lon += bench_random_double(-0.01, 0.01);
+      lat += bench_random_double(-0.01, 0.01);
+
+      bench_append(&buffer, "%s[%.15g,%.15g]", j ? "," : "", lon, lat);
+    }
+
+    bench_append(&buffer, "]");
+  }
+
+  bench_append(&buffer, "]}}]}");
+
+  return buffer;
+}
+
+static inline bench_buffer_t
+bench_generate_ints(void) {
+  bench_buffer_t buffer = {NULL, 0, 0};
+
+  bench_seed = 0x696e747300000001;
+
+  bench_append(&buffer, "[");
+
+  for (int i = 0; i < 500000; i++) {
+    bench_append(&buffer, "%s%lld", i ? "," : "", (long long) bench_random_range(0, 2000000000) - 1000000000);
+  }
+
+  bench_append(&buffer, "]");
+
+  return buffer;
+}
+
+static inline bench_buffer_t
+bench_generate_doubles(void) {
+  bench_buffer_t buffer = {NULL, 0, 0};
+
+  bench_seed = 0x646f75626c650001;
+
+  bench_append(&buffer, "[");
+
+  for (int i = 0; i < 250000; i++) {
+    bench_append(&buffer, "%s%.17g", i ? "," : "", bench_random_double(-1e6, 1e6));
+  }
+
+  bench_append(&buffer, "]");
+
+  return buffer;
+}
+
+static inline bench_buffer_t
+bench_generate_deep(void) {
+  bench_buffer_t buffer = {NULL, 0, 0};
+
+  const int depth = 50000;
+
+  for (int i = 0; i < depth; i++) {
+    bench_append(&buffer, i % 2 ? "{\"k\":" : "[");
+  }
+
+  bench_append(&buffer, "null");
+
+  for (int i = depth; i-- > 0;) {
+    bench_append(&buffer, i % 2 ? "}" : "]");
+  }
+
+  return buffer;
+}
+
+static const bench_corpus_t bench_corpus[] = {
+  {"twitter", bench_generate_twitter},
+  {"citm_catalog", bench_generate_citm_catalog},
+  {"canada", bench_generate_canada},
+  {"ints", bench_generate_ints},
+  {"doubles", bench_generate_doubles},
+  {"deep", bench_generate_deep},
+};
+
+#endif // JSON_BENCH_CORPUS_H
@@ -0,0 +1,83 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <utf.h>
+
+#include "../include/json.h"
+#include "bench.h"
+
+#define TREES 2000
+
+static int
+bench_compare(const void *a, const void *b) {
+  uint64_t x = *(const uint64_t *) a, y = *(const uint64_t *) b;
+
+  return x < y ? -1 : x > y ? 1
+                            : 0;
+}
+
+static json_t *
+bench_tree(void) {
+  int e;
+
+  json_t *tree;
+  e = json_create_array(0, &tree);
+  assert(e == 0);
+
+  for (int i = 0; i < 1000; i++) {
+    json_t *value;
+    e = json_decode_utf8((utf8_t *) "{\"id\":1,\"name\":\"item\",\"tags\":[\"a\",\"b\"],\"nested\":{\"x\":[null,true]}}", -1, &value);
+    assert(e == 0);
+
+    e = json_array_push(tree, value);
+    assert(e == 0);
+
+    json_deref(value);
+  }
+
+  return tree;
+}
+
+static void
+bench_reclaim(const char *mode) {
+  json_t **trees = malloc(TREES * sizeof(json_t *));
+  uint64_t *samples = malloc(TREES * sizeof(uint64_t));
+
+  for (int i = 0; i < TREES; i++) trees[i] = bench_tree();
+
+  for (int i = 0; i < TREES; i++) {
+    uint64_t start = bench_now();
+
+    json_deref(trees[i]);
+
+    samples[i] = bench_now() - start;
+  }
+
+  qsort(samples, TREES, sizeof(uint64_t), bench_compare);
+
+  printf("{\"bench\":\"reclaim\",\"mode\":\"%s\",\"p50_ns\":%llu,\"p99_ns\":%llu,\"max_ns\":%llu}\n", mode, (unsigned long long) samples[TREES / 2], (unsigned long long) samples[TREES * 99 / 100], (unsigned long long) samples[TREES - 1]);
+
+  free(trees);
+  free(samples);
+}
+
+int
+main() {
+  int e;
+
+  bench_reclaim("inline");
+
+  e = json_reclaim_start();
+  assert(e == 0);
+
+  bench_reclaim("thread");
+
+  json_reclaim_stop();
+
+  json_reclaim_enable();
+
+  bench_reclaim("poll");
+
+  json_reclaim_poll();
+  json_reclaim_stop();
+}
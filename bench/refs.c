@@ -0,0 +1,44 @@
+#include <assert.h>
+#include <stdio.h>
+#include <utf.h>
+
+#include "../include/json.h"
+#include "bench.h"
+
+#ifdef JSON_ATOMIC_REFS
+#define MODE "atomic"
+#else
+#define MODE "plain"
+#endif
+
+#define ITERATIONS 50000000
+
+static void
+bench_refs(const char *name, json_t *value) {
+  uint64_t start = bench_now();
+
+  for (int i = 0; i < ITERATIONS; i++) {
+    json_ref(value);
+    json_deref(value);
+  }
+
+  uint64_t elapsed = bench_now() - start;
+
+  printf("{\"bench\":\"refs\",\"mode\":\"%s\",\"case\":\"%s\",\"ns_per_op\":%.3f}\n", MODE, name, (double) elapsed / ITERATIONS);
+}
+
+int
+main() {
+  int e;
+
+  json_t *value;
+  e = json_create_string_utf8((utf8_t *) "hello", -1, &value);
+  assert(e == 0);
+
+  bench_refs("mortal", value);
+
+  e = json_set_immortal(value);
+  assert(e == 0);
+
+  bench_refs("immortal", value);
+}
@@ -7,6 +7,7 @@ extern "C" {
 
 #include <stdbool.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <utf.h>
 
 typedef enum {
@@ -19,6 +20,10 @@ typedef enum {
 } json_type_t;
 
 typedef struct json_s json_t;
+typedef struct json_builder_s json_builder_t;
+typedef struct json_pointer_s json_pointer_t;
+typedef struct json_query_s json_query_t;
+typedef struct json_lines_decoder_s json_lines_decoder_t;
 
 json_type_t
 json_typeof(const json_t *value);
@@ -59,12 +64,71 @@ json_equal(const json_t *a, const json_t *b);
 int
 json_compare(const json_t *a, const json_t *b);
 
+/**
+ * Reference counts are plain integers unless the library is built with
+ * `JSON_ATOMIC_REFS`, in which case values may be referenced and released
+ * from several threads at once.
+ */
 int
 json_ref(json_t *value);
 
 int
 json_deref(json_t *value);
 
+/**
+ * Mark a value and everything reachable from it as immortal. Reference counting
+ * then becomes a no-op for the entire tree, which is never freed. Intended for
+ * documents that live for the remainder of the process and are shared between
+ * threads; must be called before the tree is shared. Returns -1 if memory for
+ * the walk could not be allocated.
+ */
+int
+json_set_immortal(json_t *value);
+
+/**
+ * Start a background thread that frees arrays and objects on behalf of
+ * json_deref(). While it runs, dropping the last reference to a container
+ * pushes the whole tree onto a lock-free queue for the reclaimer instead of
+ * freeing it on the calling thread. Trees that share values with trees still
+ * in use elsewhere require JSON_ATOMIC_REFS.
+ */
+int
+json_reclaim_start(void);
+
+/**
+ * Defer freeing containers as with json_reclaim_start(), but without a
+ * thread. Queued trees are freed by calling json_reclaim_poll(), for example
+ * from an event loop.
+ */
+void
+json_reclaim_enable(void);
+
+/**
+ * Free everything queued so far on the calling thread, returning the number
+ * of trees freed. Only one thread may poll at a time.
+ */
+size_t
+json_reclaim_poll(void);
+
+/**
+ * Stop deferring, join the reclaimer thread if one is running, and free
+ * everything still queued. Must not race with json_deref() on other threads.
+ */
+void
+json_reclaim_stop(void);
+
+/**
+ * Create an immutable copy of a value, laid out depth first in a single
+ * allocation. Reference counting is a no-op for every node of the copy except
+ * the root, and releasing the root frees the entire copy, so nodes obtained
+ * from it must not outlive the root. Mutating a frozen value fails.
+ */
+int
+json_freeze(const json_t *value, json_t **result);
+
+bool
+json_is_frozen(const json_t *value);
+
 int
 json_create_null(json_t **result);
 
@@ -77,9 +141,32 @@ json_boolean_value(const json_t *boolean);
 int
 json_create_number(double value, json_t **result);
 
+int
+json_create_number_int64(int64_t value, json_t **result);
+
+int
+json_create_number_uint64(uint64_t value, json_t **result);
+
 double
 json_number_value(const json_t *number);
 
+/**
+ * Integral numbers are stored exactly when they fit in 64 bits, both when
+ * created through the integer constructors and when decoded from integral
+ * tokens. Values outside the target range saturate.
+ */
+int64_t
+json_number_int64_value(const json_t *number);
+
+uint64_t
+json_number_uint64_value(const json_t *number);
+
+bool
+json_number_is_int64(const json_t *number);
+
+bool
+json_number_is_uint64(const json_t *number);
+
 int
 json_create_string_utf8(const utf8_t *value, size_t len, json_t **result);
 
@@ -92,56 +179,120 @@ json_string_value_utf8(const json_t *string);
 const utf16_t *
 json_string_value_utf16le(const json_t *string);
 
+size_t
+json_string_length(const json_t *string);
+
 int
 json_create_array(size_t len, json_t **result);
 
+/**
+ * Arrays of only numbers, including those decoded from such input, are stored
+ * as packed doubles or int64 values. Storing a value of another kind in a
+ * packed array converts it to regular storage.
+ */
+int
+json_create_array_double(const double *values, size_t len, json_t **result);
+
+int
+json_create_array_int64(const int64_t *values, size_t len, json_t **result);
+
 size_t
 json_array_size(const json_t *array);
 
+/**
+ * Get the contiguous storage of a packed array, or NULL if the array isn't
+ * packed with elements of that kind.
+ */
+const double *
+json_array_double_values(const json_t *array);
+
+const int64_t *
+json_array_int64_values(const json_t *array);
+
 json_t *
 json_array_get(const json_t *array, size_t index);
 
+/**
+ * The peek accessors return borrowed values that are valid for as long as
+ * their parent is alive and unmodified. They take no reference and so never
+ * write to the tree, making them safe for concurrent read-only traversals.
+ * Borrowed values must not be released, nor anything reachable from them
+ * mutated.
+ */
+const json_t *
+json_array_peek(const json_t *array, size_t index);
+
+#define json_array_foreach(array, index, value) \
+  for ((index) = 0; (index) < json_array_size(array) && ((value) = json_array_peek((array), (index))); (index)++)
+
 int
 json_array_set(json_t *array, size_t index, json_t *value);
 
 int
 json_array_delete(json_t *array, size_t index);
 
+/**
+ * Arrays and objects grow geometrically as values are added. Reserving
+ * capacity up front avoids the intermediate reallocations.
+ */
+int
+json_array_reserve(json_t *array, size_t capacity);
+
+int
+json_array_insert(json_t *array, size_t index, json_t *value);
+
+int
+json_array_push(json_t *array, json_t *value);
+
+/**
+ * Create an empty object with room for `len` properties. Setting a new key
+ * appends it, and deleting a key keeps the remaining properties contiguous
+ * and in insertion order.
+ */
 int
 json_create_object(size_t len, json_t **result);
 
 size_t
 json_object_size(const json_t *object);
 
+int
+json_object_reserve(json_t *object, size_t capacity);
+
 json_t *
 json_object_get(const json_t *object, const json_t *key);
 
-static inline json_t *
-json_object_get_literal_utf8(const json_t *object, const utf8_t *literal, size_t len) {
-  int err;
+const json_t *
+json_object_peek(const json_t *object, const json_t *key);
 
-  json_t *key;
-  err = json_create_string_utf8(literal, len, &key);
-  if (err < 0) return NULL;
+const json_t *
+json_object_peek_utf8(const json_t *object, const utf8_t *key, size_t len);
 
-  json_t *value = json_object_get(object, key);
+const json_t *
+json_object_peek_utf16le(const json_t *object, const utf16_t *key, size_t len);
 
-  json_deref(key);
+const json_t *
+json_object_peek_key(const json_t *object, size_t index);
+
+const json_t *
+json_object_peek_value(const json_t *object, size_t index);
+
+#define json_object_foreach(object, index, key, value) \
+  for ((index) = 0; (index) < json_object_size(object) && ((key) = json_object_peek_key((object), (index))) && ((value) = json_object_peek_value((object), (index))); (index)++)
+
+static inline json_t *
+json_object_get_literal_utf8(const json_t *object, const utf8_t *literal, size_t len) {
+  json_t *value = (json_t *) json_object_peek_utf8(object, literal, len);
+
+  if (value) json_ref(value);
 
   return value;
 }
 
 static inline json_t *
 json_object_get_literal_utf16le(const json_t *object, const utf16_t *literal, size_t len) {
-  int err;
+  json_t *value = (json_t *) json_object_peek_utf16le(object, literal, len);
 
-  json_t *key;
-  err = json_create_string_utf16le(literal, len, &key);
-  if (err < 0) return NULL;
-
-  json_t *value = json_object_get(object, key);
-
-  json_deref(key);
+  if (value) json_ref(value);
 
   return value;
 }
@@ -212,18 +363,327 @@ json_object_delete_literal_utf16le(json_t *object, const utf16_t *literal, size_
   return err;
 }
 
+/**
+ * The builder constructs documents in a single pass without the reference
+ * count round trips of the setters. Values are appended to a shared scratch
+ * stack and each container is allocated at its exact size when it ends.
+ * Functions taking a `json_t *` move the caller's reference into the builder,
+ * which releases it on failure.
+ *
+ * Object properties are added by a key followed by a value. Keys are not
+ * checked for duplicates.
+ */
+int
+json_create_builder(json_builder_t **result);
+
+void
+json_destroy_builder(json_builder_t *builder);
+
+int
+json_builder_begin_array(json_builder_t *builder);
+
+int
+json_builder_end_array(json_builder_t *builder);
+
+int
+json_builder_begin_object(json_builder_t *builder);
+
+int
+json_builder_end_object(json_builder_t *builder);
+
+int
+json_builder_key(json_builder_t *builder, json_t *key);
+
+int
+json_builder_key_utf8(json_builder_t *builder, const utf8_t *key, size_t len);
+
+int
+json_builder_key_utf16le(json_builder_t *builder, const utf16_t *key, size_t len);
+
+int
+json_builder_value(json_builder_t *builder, json_t *value);
+
+int
+json_builder_null(json_builder_t *builder);
+
+int
+json_builder_boolean(json_builder_t *builder, bool value);
+
+int
+json_builder_number(json_builder_t *builder, double value);
+
+int
+json_builder_number_int64(json_builder_t *builder, int64_t value);
+
+int
+json_builder_string_utf8(json_builder_t *builder, const utf8_t *value, size_t len);
+
+int
+json_builder_string_utf16le(json_builder_t *builder, const utf16_t *value, size_t len);
+
+/**
+ * Take the completed top level value. The builder can then be reused.
+ */
+int
+json_builder_finish(json_builder_t *builder, json_t **result);
+
+/**
+ * Compute a 64-bit structural hash of a value without serializing it. Values
+ * that are equal according to json_equal() hash equally, and the hash of an
+ * object doesn't depend on the order of its properties. Hashes of arrays and
+ * objects are cached on frozen trees when they are frozen, and on images when
+ * they are encoded. Hashing never writes to a tree, so a tree may be hashed
+ * from several threads at once, and reading from a tree never invalidates its
+ * hashes. Values borrowed through the peek accessors, and anything reachable
+ * from them, must not be mutated.
+ */
+int
+json_hash(const json_t *value, uint64_t *result);
+
 int
 json_encode_utf8(const json_t *value, utf8_t **result);
 
+typedef enum {
+  json_newline_lf,
+  json_newline_crlf,
+} json_newline_t;
+
+typedef struct {
+  /**
+   * The number of spaces to indent each nesting level by. When non-zero,
+   * every array element and object property starts on a new line.
+   */
+  size_t indent;
+
+  /**
+   * Whether to put a space after colons, and after commas when not indenting.
+   */
+  bool spacing;
+
+  json_newline_t newline;
+
+  /**
+   * Whether to escape all non-ASCII characters as \uXXXX sequences.
+   */
+  bool ascii_only;
+
+  /**
+   * Whether to produce the canonical form of RFC 8785, with properties sorted
+   * by key, numbers in their shortest round trip form and no whitespace.
+   * Equal documents then encode to identical bytes. Overrides all other
+   * options, and fails for numbers that aren't finite.
+   */
+  bool canonical;
+} json_encode_options_t;
+
+int
+json_encode_utf8_with_options(const json_t *value, const json_encode_options_t *options, utf8_t **result);
+
 int
 json_encode_utf16le(const json_t *value, utf16_t **result);
 
 int
 json_decode_utf8(const utf8_t *buffer, size_t len, json_t **result);
 
+typedef struct {
+  /**
+   * The maximum nesting depth of arrays and objects, or 0 for no limit.
+   * Decoding never recurses, so the limit only bounds memory use.
+   */
+  size_t max_depth;
+
+  /**
+   * Pointers to the only values to decode, at most 64 of them. Containers
+   * along the way only hold the selected children, with elements of arrays
+   * kept in order, and everything else is validated but never built.
+   */
+  const json_pointer_t *const *projection;
+  size_t projection_len;
+} json_decode_options_t;
+
+int
+json_decode_utf8_with_options(const utf8_t *buffer, size_t len, const json_decode_options_t *options, json_t **result);
+
+/**
+ * Decode a file by mapping it into memory rather than reading it into a
+ * buffer first. The mapping is hinted for sequential access and released
+ * before returning, as the tree doesn't refer to it.
+ */
+int
+json_decode_file_utf8(const char *path, const json_decode_options_t *options, json_t **result);
+
 int
 json_decode_utf16le(const utf16_t *buffer, size_t len, json_t **result);
 
+/**
+ * Create a decoder for batches of newline delimited JSON, such as JSON Lines,
+ * which spreads each batch across up to the given number of threads. Blank
+ * lines are skipped.
+ */
+int
+json_create_lines_decoder(size_t threads, json_lines_decoder_t **result);
+
+void
+json_destroy_lines_decoder(json_lines_decoder_t *decoder);
+
+/**
+ * Called with every record of a batch in order, along with its index among
+ * the records. Returning non-zero stops decoding, which then returns the same
+ * value.
+ */
+typedef int (*json_lines_cb)(const json_t *value, size_t index, void *data);
+
+/**
+ * Decode a batch of lines. Records are allocated from arenas owned by the
+ * decoder and are frozen; they stay valid until the next batch or until the
+ * decoder is destroyed, and must be copied, for example with json_freeze(),
+ * to outlive that. Taking references to them doesn't keep them alive, but
+ * storing them or any part of them in another tree stores a copy. Fails at the
+ * first line that isn't a single JSON value, after handing over the records
+ * before it.
+ */
+int
+json_lines_decoder_decode_utf8(json_lines_decoder_t *decoder, const utf8_t *buffer, size_t len, json_lines_cb cb, void *data);
+
+/**
+ * Encode a value as CBOR of RFC 8949, with definite lengths throughout.
+ * Integers keep their kind and every number takes the shortest encoding that
+ * holds it exactly, down to half precision for floats. Only UTF-8 strings can
+ * be encoded.
+ */
+int
+json_encode_cbor(const json_t *value, uint8_t **result, size_t *len);
+
+/**
+ * Decode CBOR directly into a tree. Tags are ignored, undefined decodes as
+ * null, and byte strings, indefinite lengths, text strings that aren't valid
+ * UTF-8 and keys other than text strings fail.
+ */
+int
+json_decode_cbor(const uint8_t *buffer, size_t len, json_t **result);
+
+/**
+ * Compile a JSON Pointer as of RFC 6901 for repeated use. The empty pointer
+ * refers to the whole document.
+ */
+int
+json_create_pointer_utf8(const utf8_t *pointer, size_t len, json_pointer_t **result);
+
+void
+json_destroy_pointer(json_pointer_t *pointer);
+
+/**
+ * Borrow the value a pointer refers to, or NULL if there is none.
+ */
+const json_t *
+json_pointer_peek(const json_pointer_t *pointer, const json_t *value);
+
+json_t *
+json_pointer_get(const json_pointer_t *pointer, const json_t *value);
+
+/**
+ * Decode only the value a pointer refers to from a UTF-8 document, skipping
+ * over everything else without building it. The result is NULL if there is no
+ * such value. Input past the value isn't validated.
+ */
+int
+json_pointer_decode_utf8(const json_pointer_t *pointer, const utf8_t *buffer, size_t len, json_t **result);
+
+/**
+ * Persistent updates return a new container with a single element or property
+ * set, leaving the original untouched. Only the updated container is copied,
+ * while all of its children are shared with the original. An index equal to
+ * the length of the array appends to it. Frozen trees can't be updated.
+ */
+int
+json_array_with(const json_t *array, size_t index, json_t *value, json_t **result);
+
+int
+json_object_with(const json_t *object, json_t *key, json_t *value, json_t **result);
+
+/**
+ * Set the value a pointer refers to in a new tree, copying only the containers
+ * along the pointer and sharing everything else with the original. A missing
+ * final property is added, as is an array element at the end of its array.
+ * Frozen trees and images may be updated as well, in which case the children
+ * of the copied containers are copied out of the frozen allocation.
+ */
+int
+json_pointer_set_persistent(const json_pointer_t *pointer, const json_t *root, json_t *value, json_t **result);
+
+/**
+ * Compute a JSON Patch as of RFC 6902 that turns `a` into `b`. Subtrees that
+ * are shared between both or have differing cached hashes are told apart
+ * without being compared, and arrays are aligned by their longest common
+ * subsequence. Keys must be UTF-8.
+ */
+int
+json_diff(const json_t *a, const json_t *b, json_t **result);
+
+/**
+ * Apply a JSON Patch as of RFC 6902, moving the caller's reference to `value`
+ * into the patch. Containers that aren't referenced elsewhere are modified in
+ * place, while shared and immortal ones are copied on write along the patched
+ * paths. To keep the original intact, for instance to recover from a failing
+ * patch, hold an additional reference to it. Frozen trees and images are
+ * never modified: the containers along the patched paths are copied, as are
+ * the children of those containers that live in the frozen allocation, and the
+ * reference to the original is released once patching is done.
+ */
+int
+json_patch_apply(json_t *value, const json_t *patch, json_t **result);
+
+/**
+ * Encode a value as a binary image of its frozen form, with shared keys and
+ * packed numeric arrays. Images are read back with no parsing and behave as
+ * frozen trees; releasing the root releases the image. They must come from a
+ * trusted source, as only their header is validated, and are specific to the
+ * byte order and pointer size they were encoded on.
+ */
+int
+json_image_encode(const json_t *value, uint8_t **result, size_t *len);
+
+int
+json_image_decode(const uint8_t *buffer, size_t len, json_t **result);
+
+/**
+ * Map an image file into memory. Mapping it at the address it was linked for
+ * requires no work up front, with pages faulted in as they are accessed;
+ * elsewhere, its pointers are first relocated.
+ */
+int
+json_image_load(const char *path, json_t **result);
+
+/**
+ * Compile a query in a subset of JSONPath for repeated use. Supported are
+ * child names as `.name` or `['name']`, wildcards, recursive descent with
+ * `..`, non-negative indices and slices as `[start:end:step]`, and filters of
+ * the form `[?(@.path)]` and `[?(@.path <op> <literal>)]` where the operator
+ * is one of ==, !=, <, <=, > and >=.
+ */
+int
+json_create_query_utf8(const utf8_t *query, size_t len, json_query_t **result);
+
+void
+json_destroy_query(json_query_t *query);
+
+/**
+ * Called with every match in document order. The value is only borrowed for
+ * the duration of the call. Returning non-zero stops the evaluation, which
+ * then returns the same value.
+ */
+typedef int (*json_query_cb)(const json_t *value, void *data);
+
+int
+json_query_evaluate(const json_query_t *query, const json_t *value, json_query_cb cb, void *data);
+
+/**
+ * Evaluate a query directly on a UTF-8 document. Only matches, and values that
+ * filters apply to, are decoded; everything else is skipped over.
+ */
+int
+json_query_evaluate_utf8(const json_query_t *query, const utf8_t *buffer, size_t len, json_query_cb cb, void *data);
+
 #ifdef __cplusplus
 }
 #endif
@@ -1,11 +1,11 @@
 #include <assert.h>
 #include <ctype.h>
 #include <stddef.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <utf.h>
-#include <wchar.h>
 
 #include "../include/json.h"
 
@@ -17,7 +17,38 @@
 #endif
 #endif
 
-#define json_to(t, value) (assert(value->type == json_##t), (json_##t##_t *) value)
+#ifdef JSON_ATOMIC_REFS
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+#define json_to(t, value) (assert(json_typeof(value) == json_##t), (json_##t##_t *) value)
+
+// Integers that fit in a pointer with two bits to spare are stored directly in
+// the pointer, tagged with 0b01 in the low bits, and are never allocated. All
+// nodes are at least 4 byte aligned so the low bits of real pointers are clear.
+//
+// Borrowed elements of packed arrays are returned as pointers into the packed
+// storage, tagged with 0b10 for doubles and 0b11 for int64 values.
+#define json__tag_mask            ((uintptr_t) 3)
+#define json__tag_int             ((uintptr_t) 1)
+#define json__tag_borrowed_double ((uintptr_t) 2)
+#define json__tag_borrowed_int64  ((uintptr_t) 3)
+
+#define json__tagged_int_max (INTPTR_MAX / 4)
+#define json__tagged_int_min (INTPTR_MIN / 4)
 
 typedef struct json_null_s json_null_t;
 typedef struct json_boolean_s json_boolean_t;
@@ -29,44 +60,102 @@ typedef struct json_object_s json_object_t;
 typedef struct json_utf8_encoder_s json_utf8_encoder_t;
 typedef struct json_utf16_encoder_s json_utf16_encoder_t;
 typedef struct json_utf8_decoder_s json_utf8_decoder_t;
+typedef struct json_number_token_s json_number_token_t;
+typedef struct json_builder_frame_s json_builder_frame_t;
+typedef struct json_encoder_frame_s json_encoder_frame_t;
+typedef struct json_decoder_frame_s json_decoder_frame_t;
+typedef union json_decoder_slot_u json_decoder_slot_t;
+typedef struct json_pointer_segment_s json_pointer_segment_t;
+typedef struct json_query_step_s json_query_step_t;
+typedef struct json_query_frame_s json_query_frame_t;
+typedef struct json_cbor_encoder_s json_cbor_encoder_t;
+typedef struct json_arena_s json_arena_t;
+typedef struct json_arena_chunk_s json_arena_chunk_t;
+typedef struct json_lines_worker_s json_lines_worker_t;
+typedef struct json_cbor_decoder_s json_cbor_decoder_t;
+typedef struct json_cbor_frame_s json_cbor_frame_t;
 
 struct json_s {
-  json_type_t type;
+  uint8_t type;
 };
 
+// Null and booleans have no reference count, so they carry an unused word to
+// be as aligned as every other node, which pointer tagging relies on.
 struct json_null_s {
-  json_type_t type;
+  uint8_t type;
+  uint32_t align;
 };
 
 struct json_boolean_s {
-  json_type_t type;
+  uint8_t type;
   const bool value;
+  uint32_t align;
+};
+
+enum {
+  json_number_double,
+  json_number_int64,
+  json_number_uint64, // Only used for values above INT64_MAX
 };
 
 struct json_number_s {
-  json_type_t type;
+  uint8_t type;
+  uint8_t kind;
+  uint8_t flags;
   int refs;
-  double value;
+  union {
+    double f64;
+    int64_t i64;
+    uint64_t u64;
+  } value;
+};
+
+enum {
+  json__flag_external = 0x1, // Container storage is allocated separately from the node
+  json__flag_immortal = 0x2, // Reference counting is skipped and the node is never freed
+  json__flag_frozen = 0x4,   // The node is immutable and part of a single frozen allocation
+  json__flag_hashed = 0x8,   // The cached structural hash of a container is valid
+  json__flag_image = 0x10,   // The node is the root of an image, which is released along with it
+};
+
+enum {
+  json_string_utf8,
+  json_string_utf16le,
 };
 
 struct json_string_s {
-  json_type_t type;
+  uint8_t type;
+  uint8_t encoding;
+  uint8_t flags;
   int refs;
-  enum {
-    json_string_utf8,
-    json_string_utf16le,
-  } encoding;
-  union {
-    utf8_t *utf8;
-    utf16_t *utf16le;
-  } value;
+  uint32_t len;
+
+  // The string data is stored inline right after the header, NUL terminated.
+  // It is declared as UTF-16 to get the stricter alignment; UTF-8 strings
+  // reinterpret it bytewise.
+  utf16_t data[];
+};
+
+
+enum {
+  json_array_values,
+  json_array_doubles, // Packed storage for arrays of only doubles
+  json_array_int64s,  // Packed storage for arrays of only int64 values
 };
 
 struct json_array_s {
-  json_type_t type;
+  uint8_t type;
+  uint8_t kind;
+  uint8_t flags;
   int refs;
   size_t len;
-  json_t *values[];
+  size_t capacity;
+  uint64_t hash;
+  union {
+    json_t **values;
+    double *doubles;
+    int64_t *int64s;
+  } data;
 };
 
 struct json_property_s {
@@ -75,1445 +164,9175 @@ struct json_property_s {
 };
 
 struct json_object_s {
-  json_type_t type;
+  uint8_t type;
+  uint8_t flags;
   int refs;
   size_t len;
-  json_property_t properties[];
+  size_t capacity;
+  uint64_t hash;
+  json_property_t *properties;
+};
+
+#define json__alignof(type) offsetof(struct { char c; type value; }, value)
+
+#define json__static_assert(condition, name) typedef char json__static_assert_##name[(condition) ? 1 : -1]
+
+json__static_assert(json__alignof(json_null_t) >= 4, null_aligned);
+json__static_assert(json__alignof(json_boolean_t) >= 4, boolean_aligned);
+json__static_assert(json__alignof(json_number_t) >= 4, number_aligned);
+json__static_assert(json__alignof(json_string_t) >= 4, string_aligned);
+json__static_assert(json__alignof(json_array_t) >= 4, array_aligned);
+json__static_assert(json__alignof(json_object_t) >= 4, object_aligned);
+
+struct json_builder_frame_s {
+  json_type_t type;
+  size_t start;
+};
+
+struct json_builder_s {
+  // Pending values of all open containers, laid out back to back. Objects
+  // store their keys and values interleaved, matching json_property_t.
+  json_t **values;
+  size_t len;
+  size_t capacity;
+
+  json_builder_frame_t *frames;
+  size_t depth;
+  size_t frames_capacity;
+};
+
+// Encoding and decoding keep their own stack of open containers on the heap
+// rather than recursing, so that the depth of a document is bounded by
+// memory and not by the size of the call stack.
+
+struct json_encoder_frame_s {
+  const json_t *value;
+  size_t index;
+  size_t order; // Offset of the sorted properties of a canonical object
 };
 
 struct json_utf8_encoder_s {
   utf8_t *value;
   size_t len;
   size_t capacity;
+
+  json_encoder_frame_t *frames;
+  size_t depth;
+  size_t frames_capacity;
+
+  // Formatting, resolved from json_encode_options_t. Compact output leaves
+  // pretty unset and never looks at the rest.
+  bool pretty;
+  bool spacing;
+  bool ascii_only;
+  bool canonical;
+  size_t indent;
+  const char *newline;
+  size_t newline_len;
+
+  // Scratch space for the sorted properties of all open canonical objects,
+  // laid out back to back. The tree itself is never reordered.
+  const json_property_t **order;
+  size_t order_len;
+  size_t order_capacity;
 };
 
 struct json_utf16_encoder_s {
   utf16_t *value;
   size_t len;
   size_t capacity;
+
+  json_encoder_frame_t *frames;
+  size_t depth;
+  size_t frames_capacity;
+};
+
+struct json_cbor_encoder_s {
+  uint8_t *value;
+  size_t len;
+  size_t capacity;
+
+  json_encoder_frame_t *frames;
+  size_t depth;
+  size_t frames_capacity;
+};
+
+struct json_decoder_frame_s {
+  uint8_t type;
+  uint8_t kind; // Storage kind of an array, always json_array_values for objects
+  bool exact;   // Whether all integers seen so far convert exactly to double
+  size_t start;
+
+  // The projections that continue into the children of the container, or 0
+  // if all children are decoded, and the index of the next child.
+  uint64_t projection;
+  size_t index;
+};
+
+// Arrays that may still end up packed keep their elements as raw numbers
+// until the array is either closed or turns out to hold other values.
+union json_decoder_slot_u {
+  json_t *value;
+  double f64;
+  int64_t i64;
+};
+
+// Arenas hand out memory for decoded nodes by bumping an offset through a list
+// of chunks, which are kept for reuse when the arena is reset.
+struct json_arena_chunk_s {
+  json_arena_chunk_t *next;
+  size_t size;
+  size_t used;
+};
+
+struct json_arena_s {
+  json_arena_chunk_t *head;
+  json_arena_chunk_t *current;
 };
 
 struct json_utf8_decoder_s {
   const utf8_t *value;
   const utf8_t *start;
   const utf8_t *end;
+
+  // Pending values of all open containers, laid out back to back as in the
+  // builder.
+  json_decoder_slot_t *slots;
+  size_t len;
+  size_t capacity;
+
+  json_decoder_frame_t *frames;
+  size_t depth;
+  size_t frames_capacity;
+  size_t max_depth;
+
+  const json_pointer_t *const *projection;
+
+  // Where to allocate nodes, or NULL to allocate each on its own.
+  json_arena_t *arena;
 };
 
-json_type_t
-json_typeof(const json_t *value) {
-  return value->type;
-}
+struct json_pointer_segment_s {
+  const utf8_t *key;
+  size_t len;
 
-extern bool
-json_is_null(const json_t *value);
+  // The array index denoted by the segment, or SIZE_MAX if it doesn't denote
+  // one.
+  size_t index;
+};
 
-extern bool
-json_is_boolean(const json_t *value);
+struct json_pointer_s {
+  json_pointer_segment_t *segments;
+  size_t len;
+};
 
-extern bool
-json_is_number(const json_t *value);
+enum {
+  json__query_name,
+  json__query_wildcard,
+  json__query_index,
+  json__query_slice,
+  json__query_filter,
+};
 
-extern bool
-json_is_string(const json_t *value);
+enum {
+  json__query_exists,
+  json__query_eq,
+  json__query_ne,
+  json__query_lt,
+  json__query_le,
+  json__query_gt,
+  json__query_ge,
+};
 
-extern bool
-json_is_array(const json_t *value);
+struct json_query_step_s {
+  int kind;
 
-extern bool
-json_is_object(const json_t *value);
+  // Whether the step applies to all descendants rather than only to children.
+  bool descendant;
 
-static inline bool
-json__equal_boolean(const json_boolean_t *a, const json_boolean_t *b) {
-  return a->value == b->value;
-}
+  utf8_t *key;
+  size_t len;
 
-static inline bool
-json__equal_number(const json_number_t *a, const json_number_t *b) {
-  return a->value == b->value;
-}
+  size_t start;
+  size_t end;
+  size_t stride;
 
-static inline bool
-json__equal_string(const json_string_t *a, const json_string_t *b) {
-  if (a->encoding != b->encoding) return false;
+  json_pointer_t *path;
+  int op;
+  json_t *literal;
+};
 
-  switch (a->encoding) {
-  case json_string_utf8:
-  default:
-    return strcmp((char *) a->value.utf8, (char *) b->value.utf8) == 0;
+// Queries are evaluated as a state machine where state k means that step k is
+// to be applied next. A set of states is kept as a bitmask, which limits the
+// number of steps.
+#define json__query_max_steps 63
 
-  case json_string_utf16le:
-    return wcscmp((wchar_t *) a->value.utf16le, (wchar_t *) b->value.utf16le) == 0;
-  }
-}
+struct json_query_s {
+  json_query_step_t *steps;
+  size_t len;
+  size_t capacity;
 
-static inline bool
-json__equal_array(const json_array_t *a, const json_array_t *b) {
-  return true;
-}
+  // The states of filter steps, which need the value they apply to.
+  uint64_t filters;
+};
 
-static inline bool
-json__equal_object(const json_object_t *a, const json_object_t *b) {
-  return true;
-}
+struct json_query_frame_s {
+  const json_t *value;
+  json_type_t type;
+  uint64_t states;
+  size_t index;
+};
 
-bool
-json_equal(const json_t *a, const json_t *b) {
-  if (a->type != b->type) return false;
+// CBOR containers carry their length up front, but as nothing backs it until
+// the items have been read, storage is only reserved as they arrive and never
+// beyond that length.
+struct json_cbor_frame_s {
+  json_t *value;
+  size_t len;
+  bool key; // Whether the next item of an object is a key
+};
 
-  return false;
-  switch (a->type) {
-  case json_null:
-  default:
-    return true;
+struct json_cbor_decoder_s {
+  const uint8_t *value;
+  const uint8_t *end;
 
-  case json_boolean:
-    return json__equal_boolean(json_to(boolean, a), json_to(boolean, b));
+  // The top level value, which owns every container opened so far.
+  json_t *root;
 
-  case json_number:
-    return json__equal_number(json_to(number, a), json_to(number, b));
+  json_cbor_frame_t *frames;
+  size_t depth;
+  size_t frames_capacity;
+};
 
-  case json_string:
-    return json__equal_string(json_to(string, a), json_to(string, b));
+struct json_number_token_s {
+  int kind;
+  union {
+    double f64;
+    int64_t i64;
+    uint64_t u64;
+  } value;
+};
 
-  case json_array:
-    return json__equal_array(json_to(array, a), json_to(array, b));
+static inline size_t
+json__align(size_t size) {
+  return (size + 7) & ~(size_t) 7;
+}
 
-  case json_object:
-    return json__equal_object(json_to(object, a), json_to(object, b));
-  }
+static inline utf8_t *
+json__string_utf8(const json_string_t *string) {
+  return (utf8_t *) string->data;
 }
 
-static inline bool
-json__compare_boolean(const json_boolean_t *a, const json_boolean_t *b) {
-  return a->value < b->value ? -1 : a->value > b->value ? 1
-                                                        : 0;
+static inline utf16_t *
+json__string_utf16le(const json_string_t *string) {
+  return (utf16_t *) string->data;
 }
 
-static inline bool
-json__compare_number(const json_number_t *a, const json_number_t *b) {
-  return a->value < b->value ? -1 : a->value > b->value ? 1
-                                                        : 0;
+static inline size_t
+json__utf16_length(const utf16_t *value) {
+  size_t len = 0;
+  while (value[len]) len++;
+  return len;
 }
 
-static inline bool
-json__compare_string(const json_string_t *a, const json_string_t *b) {
-  if (a->encoding != b->encoding) {
-    return a->encoding < b->encoding ? -1 : a->encoding > b->encoding ? 1
-                                                                      : 0;
-  }
+#define json__arena_chunk_size 65536
 
-  switch (a->encoding) {
-  case json_string_utf8:
-  default:
-    return strcmp((char *) a->value.utf8, (char *) b->value.utf8);
+static inline void *
+json__arena_alloc(json_arena_t *arena, size_t size) {
+  size = json__align(size);
 
-  case json_string_utf16le:
-    return wcscmp((wchar_t *) a->value.utf16le, (wchar_t *) b->value.utf16le);
+  json_arena_chunk_t *chunk = arena->current;
+
+  while (chunk && chunk->size - chunk->used < size) {
+    chunk = chunk->next;
+
+    if (chunk) chunk->used = 0;
   }
-}
 
-static inline bool
-json__compare_array(const json_array_t *a, const json_array_t *b) {
-  return 0;
-}
+  if (chunk == NULL) {
+    size_t capacity = arena->current ? arena->current->size * 2 : json__arena_chunk_size;
 
-static inline bool
-json__property_matches(json_property_t *property, const json_t *key) {
-  return property->key->type != json_null && json__equal_string(json_to(string, property->key), json_to(string, key));
-}
+    if (capacity < size) capacity = size;
 
-static inline bool
-json__compare_object(const json_object_t *a, const json_object_t *b) {
-  return 0;
-}
+    if (capacity > SIZE_MAX - json__align(sizeof(json_arena_chunk_t))) return NULL;
 
-int
-json_compare(const json_t *a, const json_t *b) {
-  if (a->type != b->type) {
-    return a->type < b->type ? -1 : a->type > b->type ? 1
-                                                      : 0;
-  }
+    chunk = malloc(json__align(sizeof(json_arena_chunk_t)) + capacity);
 
-  switch (a->type) {
-  case json_null:
-  default:
-    return 0;
+    if (chunk == NULL) return NULL;
 
-  case json_boolean:
-    return json__compare_boolean(json_to(boolean, a), json_to(boolean, b));
+    chunk->size = capacity;
+    chunk->used = 0;
 
-  case json_number:
-    return json__compare_number(json_to(number, a), json_to(number, b));
+    // New chunks go right after the current one, ahead of any that are
+    // still unused.
+    if (arena->current) {
+      chunk->next = arena->current->next;
+      arena->current->next = chunk;
+    } else {
+      chunk->next = arena->head;
+      arena->head = chunk;
+    }
+  }
 
-  case json_string:
-    return json__compare_string(json_to(string, a), json_to(string, b));
+  arena->current = chunk;
 
-  case json_array:
-    return json__compare_array(json_to(array, a), json_to(array, b));
+  void *result = (char *) chunk + json__align(sizeof(json_arena_chunk_t)) + chunk->used;
 
-  case json_object:
-    return json__compare_object(json_to(object, a), json_to(object, b));
-  }
-}
+  chunk->used += size;
 
-static inline void
-json__free_array(json_array_t *array) {
-  for (size_t i = 0, n = array->len; i < n; i++) {
-    json_deref(array->values[i]);
-  }
+  return result;
 }
 
 static inline void
-json__free_object(json_object_t *object) {
-  for (size_t i = 0, n = object->len; i < n; i++) {
-    json_property_t *property = &object->properties[i];
+json__arena_reset(json_arena_t *arena) {
+  arena->current = arena->head;
 
-    json_deref(property->key);
-    json_deref(property->value);
-  }
+  if (arena->head) arena->head->used = 0;
 }
 
 static inline void
-json__free(json_t *value) {
-  switch (value->type) {
-  case json_null:
-  case json_boolean:
-  case json_number:
-  case json_string:
-  default:
-    break;
+json__arena_destroy(json_arena_t *arena) {
+  json_arena_chunk_t *chunk = arena->head;
 
-  case json_array:
-    json__free_array(json_to(array, value));
-    break;
+  while (chunk) {
+    json_arena_chunk_t *next = chunk->next;
 
-  case json_object:
-    json__free_object(json_to(object, value));
-    break;
+    free(chunk);
+
+    chunk = next;
   }
 
-  free(value);
+  arena->head = arena->current = NULL;
 }
 
-int
-json_ref(json_t *value) {
-  switch (value->type) {
-  case json_null:
-  case json_boolean:
-  default:
-    return 1; // Always has a singleton reference
-
-  case json_number:
-    return ++json_to(number, value)->refs;
+// Nodes in an arena are released along with it, so they are immortal, and
+// frozen so that they are never resized in place.
+static inline void *
+json__node_alloc(json_arena_t *arena, size_t size, uint8_t *flags) {
+  if (arena == NULL) {
+    *flags = 0;
 
-  case json_string:
-    return ++json_to(string, value)->refs;
+    return malloc(size);
+  }
 
-  case json_array:
-    return ++json_to(array, value)->refs;
+  *flags = json__flag_frozen | json__flag_immortal;
 
-  case json_object:
-    return ++json_to(object, value)->refs;
-  }
+  return json__arena_alloc(arena, size);
 }
 
-int
-json_deref(json_t *value) {
-  int *refsp = NULL;
+static inline json_string_t *
+json__string_alloc_in(json_arena_t *arena, int encoding, size_t len) {
+  if (len > UINT32_MAX - 1) return NULL;
 
-  switch (value->type) {
-  case json_null:
-  case json_boolean:
-  default:
-    return 1; // Always has a singleton reference
+  size_t unit = encoding == json_string_utf16le ? sizeof(utf16_t) : sizeof(utf8_t);
 
-  case json_number:
-    refsp = &json_to(number, value)->refs;
-    break;
+  uint8_t flags;
 
-  case json_string:
-    refsp = &json_to(string, value)->refs;
-    break;
+  json_string_t *str = json__node_alloc(arena, offsetof(json_string_t, data) + (len + 1) * unit, &flags);
 
-  case json_array:
-    refsp = &json_to(array, value)->refs;
-    break;
+  if (str == NULL) return NULL;
 
-  case json_object:
-    refsp = &json_to(object, value)->refs;
-    break;
-  }
+  str->type = json_string;
+  str->encoding = encoding;
+  str->flags = flags;
+  str->refs = 1;
+  str->len = (uint32_t) len;
 
-  int refs = *refsp;
-  if (refs >= 1) *refsp = --refs;
-  if (refs == 0) json__free(value);
+  if (encoding == json_string_utf16le) json__string_utf16le(str)[len] = 0;
+  else json__string_utf8(str)[len] = 0;
 
-  return refs;
+  return str;
 }
 
-static const json_null_t json__null = {
-  .type = json_null,
-};
+static inline json_string_t *
+json__string_alloc(int encoding, size_t len) {
+  return json__string_alloc_in(NULL, encoding, len);
+}
 
-int
-json_create_null(json_t **result) {
-  *result = (json_t *) &json__null;
+static inline bool
+json__is_tagged(const json_t *value) {
+  return ((uintptr_t) value & json__tag_mask) != 0;
+}
 
-  return 0;
+static inline json_t *
+json__tag_int64(int64_t value) {
+  return (json_t *) (((uintptr_t) (intptr_t) value << 2) | json__tag_int);
 }
 
-static const json_boolean_t json__true = {
-  .type = json_boolean,
-  .value = true,
-};
+static inline int64_t
+json__untag_int64(const json_t *value) {
+  return (intptr_t) ((uintptr_t) value & ~json__tag_mask) / 4;
+}
 
-static const json_boolean_t json__false = {
-  .type = json_boolean,
-  .value = false,
+json_type_t
+json_typeof(const json_t *value) {
+  if (json__is_tagged(value)) return json_number;
+
+  return (json_type_t) value->type;
+}
+
+extern bool
+json_is_null(const json_t *value);
+
+extern bool
+json_is_boolean(const json_t *value);
+
+extern bool
+json_is_number(const json_t *value);
+
+extern bool
+json_is_string(const json_t *value);
+
+extern bool
+json_is_array(const json_t *value);
+
+extern bool
+json_is_object(const json_t *value);
+
+static inline bool
+json__equal_boolean(const json_boolean_t *a, const json_boolean_t *b) {
+  return a->value == b->value;
+}
+
+static inline int
+json__number_kind(const json_t *number) {
+  switch ((uintptr_t) number & json__tag_mask) {
+  case json__tag_int:
+  case json__tag_borrowed_int64:
+    return json_number_int64;
+
+  case json__tag_borrowed_double:
+    return json_number_double;
+
+  default:
+    return ((const json_number_t *) number)->kind;
+  }
+}
+
+static inline const void *
+json__untag_pointer(const json_t *value) {
+  return (const void *) ((uintptr_t) value & ~json__tag_mask);
+}
+
+static inline bool
+json__is_borrowed(const json_t *value) {
+  uintptr_t tag = (uintptr_t) value & json__tag_mask;
+
+  return tag == json__tag_borrowed_double || tag == json__tag_borrowed_int64;
+}
+
+static inline double
+json__number_f64(const json_t *number) {
+  if (json__is_tagged(number)) return *(const double *) json__untag_pointer(number);
+
+  return ((const json_number_t *) number)->value.f64;
+}
+
+static inline int64_t
+json__number_i64(const json_t *number) {
+  switch ((uintptr_t) number & json__tag_mask) {
+  case json__tag_int:
+    return json__untag_int64(number);
+
+  case json__tag_borrowed_int64:
+    return *(const int64_t *) json__untag_pointer(number);
+
+  default:
+    return ((const json_number_t *) number)->value.i64;
+  }
+}
+
+static inline uint64_t
+json__number_u64(const json_t *number) {
+  return ((const json_number_t *) number)->value.u64;
+}
+
+static inline int
+json__compare_int64_double(int64_t a, double b) {
+  if (b != b) return 0;
+  if (b < -9223372036854775808.0) return 1;
+  if (b >= 9223372036854775808.0) return -1;
+
+  int64_t t = (int64_t) b;
+
+  if (a != t) return a < t ? -1 : 1;
+
+  double f = b - (double) t;
+
+  return f > 0 ? -1 : f < 0 ? 1
+                            : 0;
+}
+
+static inline int
+json__compare_uint64_double(uint64_t a, double b) {
+  if (b != b) return 0;
+  if (b < 0) return 1;
+  if (b >= 18446744073709551616.0) return -1;
+
+  uint64_t t = (uint64_t) b;
+
+  if (a != t) return a < t ? -1 : 1;
+
+  double f = b - (double) t;
+
+  return f > 0 ? -1 : f < 0 ? 1
+                            : 0;
+}
+
+static inline int
+json__compare_number(const json_t *a, const json_t *b) {
+  int x = json__number_kind(a), y = json__number_kind(b);
+
+  switch (x) {
+  case json_number_double:
+  default:
+    switch (y) {
+    case json_number_double:
+    default: {
+      double i = json__number_f64(a), j = json__number_f64(b);
+
+      return i < j ? -1 : i > j ? 1
+                                : 0;
+    }
+
+    case json_number_int64:
+      return -json__compare_int64_double(json__number_i64(b), json__number_f64(a));
+
+    case json_number_uint64:
+      return -json__compare_uint64_double(json__number_u64(b), json__number_f64(a));
+    }
+
+  case json_number_int64:
+    switch (y) {
+    case json_number_double:
+    default:
+      return json__compare_int64_double(json__number_i64(a), json__number_f64(b));
+
+    case json_number_int64: {
+      int64_t i = json__number_i64(a), j = json__number_i64(b);
+
+      return i < j ? -1 : i > j ? 1
+                                : 0;
+    }
+
+    case json_number_uint64:
+      return -1;
+    }
+
+  case json_number_uint64:
+    switch (y) {
+    case json_number_double:
+    default:
+      return json__compare_uint64_double(json__number_u64(a), json__number_f64(b));
+
+    case json_number_int64:
+      return 1;
+
+    case json_number_uint64: {
+      uint64_t i = json__number_u64(a), j = json__number_u64(b);
+
+      return i < j ? -1 : i > j ? 1
+                                : 0;
+    }
+    }
+  }
+}
+
+static inline bool
+json__equal_number(const json_t *a, const json_t *b) {
+  if (a == b) return true;
+
+  return json__compare_number(a, b) == 0;
+}
+
+static inline bool
+json__equal_string(const json_string_t *a, const json_string_t *b) {
+  if (a->encoding != b->encoding || a->len != b->len) return false;
+
+  switch (a->encoding) {
+  case json_string_utf8:
+  default:
+    return memcmp(a->data, b->data, a->len * sizeof(utf8_t)) == 0;
+
+  case json_string_utf16le:
+    return memcmp(a->data, b->data, a->len * sizeof(utf16_t)) == 0;
+  }
+}
+
+static inline uint64_t
+json__hash_scalar(const json_t *value);
+
+static inline size_t
+json__storage_grow(size_t capacity, size_t len);
+
+static inline int
+json__compare_boolean(const json_boolean_t *a, const json_boolean_t *b) {
+  return a->value < b->value ? -1 : a->value > b->value ? 1
+                                                        : 0;
+}
+
+static inline int
+json__compare_string(const json_string_t *a, const json_string_t *b) {
+  if (a->encoding != b->encoding) {
+    return a->encoding < b->encoding ? -1 : a->encoding > b->encoding ? 1
+                                                                      : 0;
+  }
+
+  size_t len = a->len < b->len ? a->len : b->len;
+
+  switch (a->encoding) {
+  case json_string_utf8:
+  default: {
+    int order = memcmp(a->data, b->data, len * sizeof(utf8_t));
+
+    if (order != 0) return order < 0 ? -1 : 1;
+    break;
+  }
+
+  case json_string_utf16le: {
+    const utf16_t *x = json__string_utf16le(a), *y = json__string_utf16le(b);
+
+    for (size_t i = 0; i < len; i++) {
+      if (x[i] != y[i]) return x[i] < y[i] ? -1 : 1;
+    }
+    break;
+  }
+  }
+
+  return a->len < b->len ? -1 : a->len > b->len ? 1
+                                                : 0;
+}
+
+static inline bool
+json__property_matches(json_property_t *property, const json_t *key) {
+  return json__equal_string(json_to(string, property->key), json_to(string, key));
+}
+
+static inline size_t
+json__container_len(const json_t *value) {
+  return json_typeof(value) == json_array ? json_to(array, value)->len : json_to(object, value)->len;
+}
+
+// Containers with valid cached hashes that differ can't be equal.
+static inline bool
+json__hashes_differ(const json_t *a, const json_t *b) {
+  if (json_typeof(a) == json_array) {
+    json_array_t *x = json_to(array, a), *y = json_to(array, b);
+
+    return (x->flags & y->flags & json__flag_hashed) && x->hash != y->hash;
+  }
+
+  json_object_t *x = json_to(object, a), *y = json_to(object, b);
+
+  return (x->flags & y->flags & json__flag_hashed) && x->hash != y->hash;
+}
+
+typedef struct {
+  const json_t *a;
+  const json_t *b;
+  size_t index;
+
+  // Index of the properties of b by key hash, built the first time the
+  // properties of the two objects turn out not to line up.
+  size_t *table;
+  size_t mask;
+} json_equal_frame_t;
+
+// Objects this small are searched linearly when their properties don't line
+// up, as that beats building an index.
+#define json__equal_index_min 8
+
+static inline void
+json__equal_index(json_equal_frame_t *frame) {
+  json_object_t *obj = json_to(object, frame->b);
+
+  size_t size = 16;
+
+  while (size < obj->len * 2) size *= 2;
+
+  size_t *table = calloc(size, sizeof(size_t));
+
+  if (table == NULL) return; // Fall back to a linear search
+
+  for (size_t i = 0, n = obj->len; i < n; i++) {
+    size_t j = json__hash_scalar(obj->properties[i].key) & (size - 1);
+
+    while (table[j]) j = (j + 1) & (size - 1);
+
+    table[j] = i + 1;
+  }
+
+  frame->table = table;
+  frame->mask = size - 1;
+}
+
+static inline const json_property_t *
+json__equal_find(json_equal_frame_t *frame, const json_property_t *property) {
+  json_object_t *obj = json_to(object, frame->b);
+
+  // Objects with the same keys usually have them in the same order.
+  const json_property_t *candidate = &obj->properties[frame->index];
+
+  if (json__property_matches((json_property_t *) candidate, property->key)) return candidate;
+
+  if (frame->table == NULL && obj->len > json__equal_index_min) json__equal_index(frame);
+
+  if (frame->table) {
+    for (size_t j = json__hash_scalar(property->key) & frame->mask; frame->table[j]; j = (j + 1) & frame->mask) {
+      candidate = &obj->properties[frame->table[j] - 1];
+
+      if (json__property_matches((json_property_t *) candidate, property->key)) return candidate;
+    }
+
+    return NULL;
+  }
+
+  for (size_t i = 0, n = obj->len; i < n; i++) {
+    candidate = &obj->properties[i];
+
+    if (json__property_matches((json_property_t *) candidate, property->key)) return candidate;
+  }
+
+  return NULL;
+}
+
+// Compare two values without descending into them. Returns 1 if they are
+// equal, 0 if they aren't, and -1 if they are containers of the same type
+// whose children still have to be compared.
+static inline int
+json__equal_shallow(const json_t *a, const json_t *b) {
+  if (a == b) return 1;
+
+  json_type_t type = json_typeof(a);
+
+  if (type != json_typeof(b)) return 0;
+
+  switch (type) {
+  case json_null:
+  default:
+    return 1;
+
+  case json_boolean:
+    return json__equal_boolean(json_to(boolean, a), json_to(boolean, b));
+
+  case json_number:
+    return json__equal_number(a, b);
+
+  case json_string:
+    return json__equal_string(json_to(string, a), json_to(string, b));
+
+  case json_array: {
+    json_array_t *x = json_to(array, a), *y = json_to(array, b);
+
+    if (x->len != y->len || json__hashes_differ(a, b)) return 0;
+
+    if (x->len == 0) return 1;
+
+    if (x->kind == json_array_int64s && y->kind == json_array_int64s) {
+      return memcmp(x->data.int64s, y->data.int64s, x->len * sizeof(int64_t)) == 0;
+    }
+
+    return -1;
+  }
+
+  case json_object: {
+    json_object_t *x = json_to(object, a), *y = json_to(object, b);
+
+    if (x->len != y->len || json__hashes_differ(a, b)) return 0;
+
+    if (x->len == 0) return 1;
+
+    return -1;
+  }
+  }
+}
+
+bool
+json_equal(const json_t *a, const json_t *b) {
+  json_equal_frame_t *frames = NULL;
+  size_t depth = 0, capacity = 0;
+
+  bool equal = true;
+
+  while (true) {
+    int result = json__equal_shallow(a, b);
+
+    if (result == 0) {
+      equal = false;
+      break;
+    }
+
+    if (result < 0) {
+      if (depth == capacity) {
+        size_t n = json__storage_grow(capacity, depth + 1);
+
+        json_equal_frame_t *next = n > SIZE_MAX / sizeof(json_equal_frame_t) ? NULL : realloc(frames, n * sizeof(json_equal_frame_t));
+
+        if (next == NULL) {
+          equal = false; // Out of memory
+          break;
+        }
+
+        frames = next;
+        capacity = n;
+      }
+
+      frames[depth++] = (json_equal_frame_t) {
+        .a = a,
+        .b = b,
+        .index = 0,
+        .table = NULL,
+      };
+    }
+
+    // Find the next pair of children to compare, closing all containers
+    // whose children have all been compared.
+    while (depth) {
+      json_equal_frame_t *frame = &frames[depth - 1];
+
+      if (frame->index < json__container_len(frame->a)) {
+        if (json_typeof(frame->a) == json_array) {
+          a = json_array_peek(frame->a, frame->index);
+          b = json_array_peek(frame->b, frame->index);
+        } else {
+          const json_property_t *property = &json_to(object, frame->a)->properties[frame->index];
+
+          const json_property_t *match = json__equal_find(frame, property);
+
+          if (match == NULL) {
+            equal = false;
+            goto done;
+          }
+
+          a = property->value;
+          b = match->value;
+        }
+
+        frame->index++;
+
+        break;
+      }
+
+      free(frame->table);
+
+      depth--;
+    }
+
+    if (depth == 0) break;
+  }
+
+done:
+  while (depth) free(frames[--depth].table);
+
+  free(frames);
+
+  return equal;
+}
+
+typedef struct {
+  const json_t *a;
+  const json_t *b;
+  size_t index;
+
+  // The properties of both objects sorted by key, a followed by b.
+  const json_property_t **order;
+} json_compare_frame_t;
+
+static int
+json__compare_property_order(const void *a, const void *b) {
+  const json_property_t *x = *(const json_property_t **) a, *y = *(const json_property_t **) b;
+
+  return json__compare_string(json_to(string, x->key), json_to(string, y->key));
+}
+
+// Objects are ordered as if their properties were sorted by key, so that the
+// order of properties doesn't matter just as for json_equal().
+static inline int
+json__compare_sort(json_compare_frame_t *frame) {
+  json_object_t *x = json_to(object, frame->a), *y = json_to(object, frame->b);
+
+  size_t len = x->len + y->len;
+
+  const json_property_t **order = len > SIZE_MAX / sizeof(json_property_t *) ? NULL : malloc(len * sizeof(json_property_t *));
+
+  if (order == NULL) return -1;
+
+  for (size_t i = 0; i < x->len; i++) order[i] = &x->properties[i];
+  for (size_t i = 0; i < y->len; i++) order[x->len + i] = &y->properties[i];
+
+  qsort(order, x->len, sizeof(json_property_t *), json__compare_property_order);
+  qsort(&order[x->len], y->len, sizeof(json_property_t *), json__compare_property_order);
+
+  frame->order = order;
+
+  return 0;
+}
+
+// Compare two values without descending into them, returning 2 if they are
+// containers of the same type whose children still have to be compared.
+static inline int
+json__compare_shallow(const json_t *a, const json_t *b) {
+  if (a == b) return 0;
+
+  json_type_t x = json_typeof(a), y = json_typeof(b);
+
+  if (x != y) {
+    return x < y ? -1 : x > y ? 1
+                              : 0;
+  }
+
+  switch (x) {
+  case json_null:
+  default:
+    return 0;
+
+  case json_boolean:
+    return json__compare_boolean(json_to(boolean, a), json_to(boolean, b));
+
+  case json_number:
+    return json__compare_number(a, b);
+
+  case json_string:
+    return json__compare_string(json_to(string, a), json_to(string, b));
+
+  case json_array:
+  case json_object: {
+    size_t i = json__container_len(a), j = json__container_len(b);
+
+    if (i == 0 || j == 0) {
+      return i < j ? -1 : i > j ? 1
+                                : 0;
+    }
+
+    return 2;
+  }
+  }
+}
+
+int
+json_compare(const json_t *a, const json_t *b) {
+  const json_t *root_a = a, *root_b = b;
+
+  json_compare_frame_t *frames = NULL;
+  size_t depth = 0, capacity = 0;
+
+  int order;
+
+  while (true) {
+    order = json__compare_shallow(a, b);
+
+    if (order == 2) {
+      if (depth == capacity) {
+        size_t n = json__storage_grow(capacity, depth + 1);
+
+        json_compare_frame_t *next = n > SIZE_MAX / sizeof(json_compare_frame_t) ? NULL : realloc(frames, n * sizeof(json_compare_frame_t));
+
+        if (next == NULL) goto oom;
+
+        frames = next;
+        capacity = n;
+      }
+
+      json_compare_frame_t *frame = &frames[depth++];
+
+      *frame = (json_compare_frame_t) {
+        .a = a,
+        .b = b,
+        .index = 0,
+        .order = NULL,
+      };
+
+      if (json_typeof(a) == json_object && json__compare_sort(frame) < 0) goto oom;
+
+      order = 0;
+    }
+
+    if (order != 0) break;
+
+    // Find the next pair of children to compare, closing all containers
+    // whose common children have all compared equal.
+    while (depth) {
+      json_compare_frame_t *frame = &frames[depth - 1];
+
+      size_t i = json__container_len(frame->a), j = json__container_len(frame->b);
+
+      if (frame->index < i && frame->index < j) {
+        if (json_typeof(frame->a) == json_array) {
+          a = json_array_peek(frame->a, frame->index);
+          b = json_array_peek(frame->b, frame->index);
+        } else {
+          const json_property_t *x = frame->order[frame->index], *y = frame->order[i + frame->index];
+
+          order = json__compare_string(json_to(string, x->key), json_to(string, y->key));
+
+          if (order != 0) goto done;
+
+          a = x->value;
+          b = y->value;
+        }
+
+        frame->index++;
+
+        break;
+      }
+
+      free(frame->order);
+
+      depth--;
+
+      order = i < j ? -1 : i > j ? 1
+                                 : 0;
+
+      if (order != 0) goto done;
+    }
+
+    if (depth == 0) break;
+  }
+
+done:
+  while (depth) free(frames[--depth].order);
+
+  free(frames);
+
+  return order;
+
+oom:
+  // Without memory to compare the children fall back to an order of the roots
+  // that is at least consistent with equality.
+  while (depth) free(frames[--depth].order);
+
+  free(frames);
+
+  return json_equal(root_a, root_b) ? 0 : root_a < root_b ? -1
+                                                          : 1;
+}
+
+#ifdef JSON_ATOMIC_REFS
+
+// Taking a reference only requires that the count itself is updated
+// atomically, while dropping one must also order all prior accesses to the
+// node before it is freed by whichever thread drops the last reference.
+
+#ifdef _MSC_VER
+
+static inline int
+json__refs_increment(int *refs) {
+  return _InterlockedIncrement((volatile long *) refs);
+}
+
+static inline int
+json__refs_decrement(int *refs) {
+  return _InterlockedDecrement((volatile long *) refs);
+}
+
+static inline int
+json__refs_load(int *refs) {
+  return *(volatile long *) refs;
+}
+
+#else
+
+static inline int
+json__refs_increment(int *refs) {
+  return __atomic_add_fetch(refs, 1, __ATOMIC_RELAXED);
+}
+
+static inline int
+json__refs_decrement(int *refs) {
+  return __atomic_sub_fetch(refs, 1, __ATOMIC_ACQ_REL);
+}
+
+static inline int
+json__refs_load(int *refs) {
+  return __atomic_load_n(refs, __ATOMIC_RELAXED);
+}
+
+#endif
+
+#else
+
+static inline int
+json__refs_increment(int *refs) {
+  return ++*refs;
+}
+
+static inline int
+json__refs_decrement(int *refs) {
+  return --*refs;
+}
+
+static inline int
+json__refs_load(int *refs) {
+  return *refs;
+}
+
+#endif
+
+// Get the reference count of a value, or NULL if the value isn't reference
+// counted.
+static inline int *
+json__refs(json_t *value) {
+  if (json__is_tagged(value)) return NULL;
+
+  switch (value->type) {
+  case json_null:
+  case json_boolean:
+  default:
+    return NULL; // Always has a singleton reference
+
+  case json_number: {
+    json_number_t *num = json_to(number, value);
+
+    return num->flags & json__flag_immortal ? NULL : &num->refs;
+  }
+
+  case json_string: {
+    json_string_t *str = json_to(string, value);
+
+    return str->flags & json__flag_immortal ? NULL : &str->refs;
+  }
+
+  case json_array: {
+    json_array_t *arr = json_to(array, value);
+
+    return arr->flags & json__flag_immortal ? NULL : &arr->refs;
+  }
+
+  case json_object: {
+    json_object_t *obj = json_to(object, value);
+
+    return obj->flags & json__flag_immortal ? NULL : &obj->refs;
+  }
+  }
+}
+
+// Containers that lose their last reference while a tree is being freed are
+// queued rather than freed recursively, so deeply nested trees can't exhaust
+// the stack. The capacity of a dead container is no longer needed and links
+// the queue.
+static inline void
+json__set_next(json_t *value, json_t *next) {
+  if (value->type == json_array) json_to(array, value)->capacity = (size_t) (uintptr_t) next;
+  else json_to(object, value)->capacity = (size_t) (uintptr_t) next;
+}
+
+static inline json_t *
+json__next(json_t *value) {
+  if (value->type == json_array) return (json_t *) (uintptr_t) json_to(array, value)->capacity;
+  else return (json_t *) (uintptr_t) json_to(object, value)->capacity;
+}
+
+static inline void
+json__free_later(json_t *value, json_t **queue) {
+  int *refs = json__refs(value);
+
+  if (refs == NULL || json__refs_decrement(refs) != 0) return;
+
+  if (value->type != json_array && value->type != json_object) {
+    free(value);
+    return;
+  }
+
+  json__set_next(value, *queue);
+
+  *queue = value;
+}
+
+static inline void
+json__free_array(json_array_t *array, json_t **queue) {
+  if (array->flags & json__flag_frozen) return; // Children live in the same allocation
+
+  if (array->kind == json_array_values) {
+    for (size_t i = 0, n = array->len; i < n; i++) {
+      json__free_later(array->data.values[i], queue);
+    }
+  }
+
+  if (array->flags & json__flag_external) free(array->data.values);
+}
+
+static inline void
+json__free_object(json_object_t *object, json_t **queue) {
+  if (object->flags & json__flag_frozen) return; // Children live in the same allocation
+
+  for (size_t i = 0, n = object->len; i < n; i++) {
+    json_property_t *property = &object->properties[i];
+
+    json__free_later(property->key, queue);
+    json__free_later(property->value, queue);
+  }
+
+  if (object->flags & json__flag_external) free(object->properties);
+}
+
+static inline uint8_t *
+json__flags(json_t *value);
+
+static inline int
+json__encoder_push(json_encoder_frame_t **frames, size_t *depth, size_t *capacity, const json_t *value);
+
+static void
+json__image_release(json_t *root);
+
+static inline void
+json__free(json_t *value) {
+  json_t *queue = NULL;
+
+  while (true) {
+    switch (value->type) {
+    case json_null:
+    case json_boolean:
+    case json_number:
+    case json_string:
+    default:
+      break;
+
+    case json_array:
+      json__free_array(json_to(array, value), &queue);
+      break;
+
+    case json_object:
+      json__free_object(json_to(object, value), &queue);
+      break;
+    }
+
+    uint8_t *flags = json__flags(value);
+
+    if (flags && (*flags & json__flag_image)) json__image_release(value);
+    else free(value);
+
+    if (queue == NULL) break;
+
+    value = queue;
+
+    queue = json__next(value);
+  }
+}
+
+#ifdef _WIN32
+
+typedef SRWLOCK json__mutex_t;
+typedef CONDITION_VARIABLE json__cond_t;
+typedef HANDLE json__thread_t;
+
+#define json__mutex_init SRWLOCK_INIT
+#define json__cond_init  CONDITION_VARIABLE_INIT
+
+#define json__mutex_lock(mutex)       AcquireSRWLockExclusive(mutex)
+#define json__mutex_unlock(mutex)     ReleaseSRWLockExclusive(mutex)
+#define json__cond_wait(cond, mutex)  SleepConditionVariableSRW(cond, mutex, INFINITE, 0)
+#define json__cond_signal(cond)       WakeConditionVariable(cond)
+
+#else
+
+typedef pthread_mutex_t json__mutex_t;
+typedef pthread_cond_t json__cond_t;
+typedef pthread_t json__thread_t;
+
+#define json__mutex_init PTHREAD_MUTEX_INITIALIZER
+#define json__cond_init  PTHREAD_COND_INITIALIZER
+
+#define json__mutex_lock(mutex)       pthread_mutex_lock(mutex)
+#define json__mutex_unlock(mutex)     pthread_mutex_unlock(mutex)
+#define json__cond_wait(cond, mutex)  pthread_cond_wait(cond, mutex)
+#define json__cond_signal(cond)       pthread_cond_signal(cond)
+
+#endif
+
+#ifdef _MSC_VER
+
+static inline json_t *
+json__atomic_load(json_t **ptr) {
+  return (json_t *) InterlockedCompareExchangePointer((PVOID volatile *) ptr, NULL, NULL);
+}
+
+static inline json_t *
+json__atomic_exchange(json_t **ptr, json_t *value) {
+  return (json_t *) InterlockedExchangePointer((PVOID volatile *) ptr, value);
+}
+
+static inline bool
+json__atomic_compare_exchange(json_t **ptr, json_t **expected, json_t *desired) {
+  json_t *actual = (json_t *) InterlockedCompareExchangePointer((PVOID volatile *) ptr, desired, *expected);
+
+  if (actual == *expected) return true;
+
+  *expected = actual;
+
+  return false;
+}
+
+static inline bool
+json__atomic_load_bool(bool *ptr) {
+  return *(volatile bool *) ptr;
+}
+
+static inline void
+json__atomic_store_bool(bool *ptr, bool value) {
+  *(volatile bool *) ptr = value;
+
+  MemoryBarrier();
+}
+
+#else
+
+static inline json_t *
+json__atomic_load(json_t **ptr) {
+  return __atomic_load_n(ptr, __ATOMIC_ACQUIRE);
+}
+
+static inline json_t *
+json__atomic_exchange(json_t **ptr, json_t *value) {
+  return __atomic_exchange_n(ptr, value, __ATOMIC_ACQ_REL);
+}
+
+static inline bool
+json__atomic_compare_exchange(json_t **ptr, json_t **expected, json_t *desired) {
+  return __atomic_compare_exchange_n(ptr, expected, desired, true, __ATOMIC_RELEASE, __ATOMIC_RELAXED);
+}
+
+static inline bool
+json__atomic_load_bool(bool *ptr) {
+  return __atomic_load_n(ptr, __ATOMIC_RELAXED);
+}
+
+static inline void
+json__atomic_store_bool(bool *ptr, bool value) {
+  __atomic_store_n(ptr, value, __ATOMIC_SEQ_CST);
+}
+
+#endif
+
+// Trees handed to the reclaimer are linked through their root the same way
+// json__free() queues dead containers. Any number of threads push onto the
+// queue without locking while a single consumer, either the reclaimer thread
+// or whoever polls, takes the entire queue at once. As nodes are never popped
+// individually the queue is immune to ABA.
+static struct {
+  json_t *queue;
+  bool deferred;
+
+  // Only used to park the reclaimer thread while the queue is empty.
+  json__mutex_t lock;
+  json__cond_t signal;
+  json__thread_t thread;
+  bool running;
+} json__reclaimer = {
+  .lock = json__mutex_init,
+  .signal = json__cond_init,
+};
+
+static inline size_t
+json__reclaim(json_t *queue) {
+  size_t n = 0;
+
+  while (queue) {
+    json_t *value = queue;
+
+    queue = json__next(value);
+
+    json__free(value);
+
+    n++;
+  }
+
+  return n;
+}
+
+#ifdef _WIN32
+static DWORD WINAPI
+json__reclaimer_run(LPVOID data) {
+#else
+static void *
+json__reclaimer_run(void *data) {
+#endif
+  (void) data;
+
+  json__mutex_lock(&json__reclaimer.lock);
+
+  while (true) {
+    while (json__atomic_load(&json__reclaimer.queue) == NULL && json__reclaimer.running) {
+      json__cond_wait(&json__reclaimer.signal, &json__reclaimer.lock);
+    }
+
+    json_t *queue = json__atomic_exchange(&json__reclaimer.queue, NULL);
+
+    if (queue == NULL) break; // Stopped and drained
+
+    json__mutex_unlock(&json__reclaimer.lock);
+
+    json__reclaim(queue);
+
+    json__mutex_lock(&json__reclaimer.lock);
+  }
+
+  json__mutex_unlock(&json__reclaimer.lock);
+
+  return 0;
+}
+
+int
+json_reclaim_start(void) {
+  int err = 0;
+
+  json__mutex_lock(&json__reclaimer.lock);
+
+  if (json__reclaimer.running) goto done;
+
+#ifdef _WIN32
+  json__reclaimer.thread = CreateThread(NULL, 0, json__reclaimer_run, NULL, 0, NULL);
+
+  if (json__reclaimer.thread == NULL) err = -1;
+#else
+  if (pthread_create(&json__reclaimer.thread, NULL, json__reclaimer_run, NULL) != 0) err = -1;
+#endif
+
+  if (err == 0) {
+    json__reclaimer.running = true;
+
+    json__atomic_store_bool(&json__reclaimer.deferred, true);
+  }
+
+done:
+  json__mutex_unlock(&json__reclaimer.lock);
+
+  return err;
+}
+
+void
+json_reclaim_enable(void) {
+  json__atomic_store_bool(&json__reclaimer.deferred, true);
+}
+
+void
+json_reclaim_stop(void) {
+  json__atomic_store_bool(&json__reclaimer.deferred, false);
+
+  json__mutex_lock(&json__reclaimer.lock);
+
+  bool running = json__reclaimer.running;
+
+  json__reclaimer.running = false;
+
+  json__cond_signal(&json__reclaimer.signal);
+
+  json__mutex_unlock(&json__reclaimer.lock);
+
+  if (running) {
+#ifdef _WIN32
+    WaitForSingleObject(json__reclaimer.thread, INFINITE);
+    CloseHandle(json__reclaimer.thread);
+#else
+    pthread_join(json__reclaimer.thread, NULL);
+#endif
+  }
+
+  json_reclaim_poll();
+}
+
+size_t
+json_reclaim_poll(void) {
+  return json__reclaim(json__atomic_exchange(&json__reclaimer.queue, NULL));
+}
+
+// Hand a dead container to the reclaimer, returning false if freeing isn't
+// deferred.
+static inline bool
+json__reclaim_later(json_t *value) {
+  if (!json__atomic_load_bool(&json__reclaimer.deferred)) return false;
+
+  json_t *head = json__atomic_load(&json__reclaimer.queue);
+
+  do {
+    json__set_next(value, head);
+  } while (!json__atomic_compare_exchange(&json__reclaimer.queue, &head, value));
+
+  // Only the push that makes the queue non-empty needs to wake the thread.
+  if (head == NULL) {
+    json__mutex_lock(&json__reclaimer.lock);
+    json__cond_signal(&json__reclaimer.signal);
+    json__mutex_unlock(&json__reclaimer.lock);
+  }
+
+  return true;
+}
+
+int
+json_ref(json_t *value) {
+  int *refs = json__refs(value);
+
+  if (refs == NULL) return 1;
+
+  return json__refs_increment(refs);
+}
+
+int
+json_deref(json_t *value) {
+  int *refs = json__refs(value);
+
+  if (refs == NULL) return 1;
+
+  // Dropping a reference that was never taken must not free the node again.
+  if (json__refs_load(refs) <= 0) return 0;
+
+  int result = json__refs_decrement(refs);
+
+  if (result == 0) {
+    if ((value->type == json_array || value->type == json_object) && json__reclaim_later(value)) {
+      return result;
+    }
+
+    json__free(value);
+  }
+
+  return result;
+}
+
+// Advance to the next child of a container, where each property of an object
+// counts as two children, its key and its value. Returns NULL once there are
+// none left, and for packed arrays, whose elements aren't nodes.
+static inline json_t *
+json__walk_next(const json_t *value, size_t *index) {
+  if (json_typeof(value) == json_array) {
+    json_array_t *arr = json_to(array, value);
+
+    if (arr->kind != json_array_values || *index == arr->len) return NULL;
+
+    return arr->data.values[(*index)++];
+  }
+
+  json_object_t *obj = json_to(object, value);
+
+  if (*index == obj->len * 2) return NULL;
+
+  json_property_t *property = &obj->properties[*index / 2];
+
+  return (*index)++ % 2 ? property->value : property->key;
+}
+
+static inline bool
+json__is_container(const json_t *value) {
+  json_type_t type = json_typeof(value);
+
+  return type == json_array || type == json_object;
+}
+
+int
+json_set_immortal(json_t *value) {
+  int err = 0;
+
+  json_encoder_frame_t *frames = NULL;
+  size_t depth = 0, capacity = 0;
+
+  while (true) {
+    uint8_t *flags = json__flags(value);
+
+    if (flags) *flags |= json__flag_immortal;
+
+    if (json__is_container(value)) {
+      err = json__encoder_push(&frames, &depth, &capacity, value);
+      if (err < 0) break;
+    }
+
+    value = NULL;
+
+    while (depth && (value = json__walk_next(frames[depth - 1].value, &frames[depth - 1].index)) == NULL) {
+      depth--;
+    }
+
+    if (value == NULL) break;
+  }
+
+  free(frames);
+
+  return err;
+}
+
+static const json_null_t json__null = {
+  .type = json_null,
+};
+
+int
+json_create_null(json_t **result) {
+  *result = (json_t *) &json__null;
+
+  return 0;
+}
+
+static const json_boolean_t json__true = {
+  .type = json_boolean,
+  .value = true,
+};
+
+static const json_boolean_t json__false = {
+  .type = json_boolean,
+  .value = false,
+};
+
+int
+json_create_boolean(bool value, json_t **result) {
+  *result = value ? (json_t *) &json__true : (json_t *) &json__false;
+
+  return 0;
+}
+
+bool
+json_boolean_value(const json_t *boolean) {
+  return json_to(boolean, boolean)->value;
+}
+
+static inline json_number_t *
+json__number_alloc_in(json_arena_t *arena, int kind) {
+  uint8_t flags;
+
+  json_number_t *num = json__node_alloc(arena, sizeof(json_number_t), &flags);
+
+  if (num == NULL) return NULL;
+
+  num->type = json_number;
+  num->kind = kind;
+  num->flags = flags;
+  num->refs = 1;
+
+  return num;
+}
+
+static inline json_number_t *
+json__number_alloc(int kind) {
+  return json__number_alloc_in(NULL, kind);
+}
+
+int
+json_create_number(double value, json_t **result) {
+  json_number_t *num = json__number_alloc(json_number_double);
+
+  if (num == NULL) return -1;
+
+  num->value.f64 = value;
+
+  *result = (json_t *) num;
+
+  return 0;
+}
+
+int
+json_create_number_int64(int64_t value, json_t **result) {
+  if (value >= json__tagged_int_min && value <= json__tagged_int_max) {
+    *result = json__tag_int64(value);
+
+    return 0;
+  }
+
+  json_number_t *num = json__number_alloc(json_number_int64);
+
+  if (num == NULL) return -1;
+
+  num->value.i64 = value;
+
+  *result = (json_t *) num;
+
+  return 0;
+}
+
+int
+json_create_number_uint64(uint64_t value, json_t **result) {
+  if (value <= INT64_MAX) return json_create_number_int64((int64_t) value, result);
+
+  json_number_t *num = json__number_alloc(json_number_uint64);
+
+  if (num == NULL) return -1;
+
+  num->value.u64 = value;
+
+  *result = (json_t *) num;
+
+  return 0;
+}
+
+double
+json_number_value(const json_t *number) {
+  assert(json_typeof(number) == json_number);
+
+  switch (json__number_kind(number)) {
+  case json_number_double:
+  default:
+    return json__number_f64(number);
+
+  case json_number_int64:
+    return (double) json__number_i64(number);
+
+  case json_number_uint64:
+    return (double) json__number_u64(number);
+  }
+}
+
+int64_t
+json_number_int64_value(const json_t *number) {
+  assert(json_typeof(number) == json_number);
+
+  switch (json__number_kind(number)) {
+  case json_number_double:
+  default: {
+    double value = json__number_f64(number);
+
+    if (value != value) return 0;
+    if (value < -9223372036854775808.0) return INT64_MIN;
+    if (value >= 9223372036854775808.0) return INT64_MAX;
+
+    return (int64_t) value;
+  }
+
+  case json_number_int64:
+    return json__number_i64(number);
+
+  case json_number_uint64:
+    return INT64_MAX;
+  }
+}
+
+uint64_t
+json_number_uint64_value(const json_t *number) {
+  assert(json_typeof(number) == json_number);
+
+  switch (json__number_kind(number)) {
+  case json_number_double:
+  default: {
+    double value = json__number_f64(number);
+
+    if (value != value || value < 0) return 0;
+    if (value >= 18446744073709551616.0) return UINT64_MAX;
+
+    return (uint64_t) value;
+  }
+
+  case json_number_int64: {
+    int64_t value = json__number_i64(number);
+
+    return value < 0 ? 0 : (uint64_t) value;
+  }
+
+  case json_number_uint64:
+    return json__number_u64(number);
+  }
+}
+
+bool
+json_number_is_int64(const json_t *number) {
+  assert(json_typeof(number) == json_number);
+
+  switch (json__number_kind(number)) {
+  case json_number_double:
+  default: {
+    double value = json__number_f64(number);
+
+    return value >= -9223372036854775808.0 && value < 9223372036854775808.0 && value == (double) (int64_t) value;
+  }
+
+  case json_number_int64:
+    return true;
+
+  case json_number_uint64:
+    return false;
+  }
+}
+
+bool
+json_number_is_uint64(const json_t *number) {
+  assert(json_typeof(number) == json_number);
+
+  switch (json__number_kind(number)) {
+  case json_number_double:
+  default: {
+    double value = json__number_f64(number);
+
+    return value >= 0 && value < 18446744073709551616.0 && value == (double) (uint64_t) value;
+  }
+
+  case json_number_int64:
+    return json__number_i64(number) >= 0;
+
+  case json_number_uint64:
+    return true;
+  }
+}
+
+int
+json_create_string_utf8(const utf8_t *value, size_t len, json_t **result) {
+  if (len == (size_t) -1) len = strlen((char *) value);
+
+  json_string_t *str = json__string_alloc(json_string_utf8, len);
+
+  if (str == NULL) return -1;
+
+  memcpy(str->data, value, len * sizeof(utf8_t));
+
+  *result = (json_t *) str;
+
+  return 0;
+}
+
+int
+json_create_string_utf16le(const utf16_t *value, size_t len, json_t **result) {
+  if (len == (size_t) -1) len = json__utf16_length(value);
+
+  json_string_t *str = json__string_alloc(json_string_utf16le, len);
+
+  if (str == NULL) return -1;
+
+  memcpy(str->data, value, len * sizeof(utf16_t));
+
+  *result = (json_t *) str;
+
+  return 0;
+}
+
+const utf8_t *
+json_string_value_utf8(const json_t *string) {
+  return json__string_utf8(json_to(string, string));
+}
+
+const utf16_t *
+json_string_value_utf16le(const json_t *string) {
+  return json__string_utf16le(json_to(string, string));
+}
+
+size_t
+json_string_length(const json_t *string) {
+  return json_to(string, string)->len;
+}
+
+// Interior nodes of a frozen tree, an image or an arena are immortal only for
+// as long as the allocation they live in, which their reference count doesn't
+// extend.
+static inline bool
+json__is_interior(json_t *value) {
+  uint8_t *flags = json__flags(value);
+
+  return flags != NULL && (*flags & (json__flag_frozen | json__flag_immortal)) == (json__flag_frozen | json__flag_immortal);
+}
+
+// Take a reference to a value that is about to be stored in a container.
+// Borrowed elements of packed arrays don't outlive their array, nor do
+// interior nodes outlive their allocation, and so both are copied instead.
+static inline int
+json__retain(json_t *value, json_t **result) {
+  if (json__is_borrowed(value)) {
+    if (json__number_kind(value) == json_number_double) {
+      return json_create_number(json__number_f64(value), result);
+    }
+
+    return json_create_number_int64(json__number_i64(value), result);
+  }
+
+  if (json__is_interior(value)) return json_freeze(value, result);
+
+  json_ref(value);
+
+  *result = value;
+
+  return 0;
+}
+
+static inline size_t
+json__array_element_size(int kind) {
+  switch (kind) {
+  case json_array_values:
+  default:
+    return sizeof(json_t *);
+
+  case json_array_doubles:
+    return sizeof(double);
+
+  case json_array_int64s:
+    return sizeof(int64_t);
+  }
+}
+
+static inline json_array_t *
+json__array_alloc_in(json_arena_t *arena, int kind, size_t len) {
+  uint8_t flags;
+
+  json_array_t *arr = json__node_alloc(arena, json__align(sizeof(json_array_t)) + len * json__array_element_size(kind), &flags);
+
+  if (arr == NULL) return NULL;
+
+  arr->type = json_array;
+  arr->kind = kind;
+  arr->flags = flags;
+  arr->refs = 1;
+  arr->len = len;
+  arr->capacity = len;
+  arr->data.values = (void *) ((char *) arr + json__align(sizeof(json_array_t)));
+
+  return arr;
+}
+
+static inline json_array_t *
+json__array_alloc(int kind, size_t len) {
+  return json__array_alloc_in(NULL, kind, len);
+}
+
+// Storage starts out inline in the node and moves to a separate allocation
+// the first time it has to grow.
+static inline void *
+json__storage_reserve(void *data, uint8_t *flags, size_t len, size_t capacity, size_t size) {
+  if (capacity > SIZE_MAX / size) return NULL;
+
+  void *result;
+
+  if (*flags & json__flag_external) {
+    result = realloc(data, capacity * size);
+  } else {
+    result = malloc(capacity * size);
+
+    if (result && len) memcpy(result, data, len * size);
+  }
+
+  if (result) *flags |= json__flag_external;
+
+  return result;
+}
+
+static inline size_t
+json__storage_grow(size_t capacity, size_t len) {
+  if (capacity < 4) capacity = 4;
+
+  while (capacity < len) {
+    if (capacity > SIZE_MAX / 2) return len;
+
+    capacity *= 2;
+  }
+
+  return capacity;
+}
+
+static inline int
+json__array_reserve(json_array_t *arr, size_t capacity) {
+  if (capacity <= arr->capacity) return 0;
+
+  void *data = json__storage_reserve(arr->data.values, &arr->flags, arr->len, capacity, json__array_element_size(arr->kind));
+
+  if (data == NULL) return -1;
+
+  arr->data.values = data;
+  arr->capacity = capacity;
+
+  return 0;
+}
+
+static inline int
+json__array_grow(json_array_t *arr, size_t len) {
+  if (len <= arr->capacity) return 0;
+
+  return json__array_reserve(arr, json__storage_grow(arr->capacity, len));
+}
+
+// Boxes the elements of a packed array into separate nodes so that it can hold
+// values of any type.
+static inline int
+json__array_unpack(json_array_t *arr) {
+  int err;
+
+  if (arr->kind == json_array_values) return 0;
+
+  json_t **values = malloc((arr->capacity ? arr->capacity : 1) * sizeof(json_t *));
+
+  if (values == NULL) return -1;
+
+  for (size_t i = 0, n = arr->len; i < n; i++) {
+    if (arr->kind == json_array_doubles) {
+      err = json_create_number(arr->data.doubles[i], &values[i]);
+    } else {
+      err = json_create_number_int64(arr->data.int64s[i], &values[i]);
+    }
+
+    if (err < 0) {
+      while (i > 0) json_deref(values[--i]);
+
+      free(values);
+
+      return -1;
+    }
+  }
+
+  if (arr->flags & json__flag_external) free(arr->data.values);
+
+  arr->kind = json_array_values;
+  arr->flags |= json__flag_external;
+  arr->data.values = values;
+
+  return 0;
+}
+
+int
+json_create_array(size_t len, json_t **result) {
+  json_array_t *arr = json__array_alloc(json_array_values, len);
+
+  if (arr == NULL) return -1;
+
+  for (size_t i = 0, n = arr->len; i < n; i++) {
+    arr->data.values[i] = (json_t *) &json__null;
+  }
+
+  *result = (json_t *) arr;
+
+  return 0;
+}
+
+int
+json_create_array_double(const double *values, size_t len, json_t **result) {
+  json_array_t *arr = json__array_alloc(json_array_doubles, len);
+
+  if (arr == NULL) return -1;
+
+  if (len) memcpy(arr->data.doubles, values, len * sizeof(double));
+
+  *result = (json_t *) arr;
+
+  return 0;
+}
+
+int
+json_create_array_int64(const int64_t *values, size_t len, json_t **result) {
+  json_array_t *arr = json__array_alloc(json_array_int64s, len);
+
+  if (arr == NULL) return -1;
+
+  if (len) memcpy(arr->data.int64s, values, len * sizeof(int64_t));
+
+  *result = (json_t *) arr;
+
+  return 0;
+}
+
+size_t
+json_array_size(const json_t *array) {
+  return json_to(array, array)->len;
+}
+
+const double *
+json_array_double_values(const json_t *array) {
+  json_array_t *arr = json_to(array, array);
+
+  if (arr->kind != json_array_doubles) return NULL;
+
+  return arr->data.doubles;
+}
+
+const int64_t *
+json_array_int64_values(const json_t *array) {
+  json_array_t *arr = json_to(array, array);
+
+  if (arr->kind != json_array_int64s) return NULL;
+
+  return arr->data.int64s;
+}
+
+json_t *
+json_array_get(const json_t *array, size_t index) {
+  int err;
+
+  json_array_t *arr = json_to(array, array);
+
+  if (index >= arr->len) return NULL;
+
+  json_t *value;
+
+  switch (arr->kind) {
+  case json_array_values:
+  default:
+    value = arr->data.values[index];
+
+    json_ref(value);
+    break;
+
+  case json_array_doubles:
+    err = json_create_number(arr->data.doubles[index], &value);
+    if (err < 0) return NULL;
+    break;
+
+  case json_array_int64s:
+    err = json_create_number_int64(arr->data.int64s[index], &value);
+    if (err < 0) return NULL;
+    break;
+  }
+
+  return value;
+}
+
+const json_t *
+json_array_peek(const json_t *array, size_t index) {
+  json_array_t *arr = json_to(array, array);
+
+  if (index >= arr->len) return NULL;
+
+  switch (arr->kind) {
+  case json_array_values:
+  default:
+    return arr->data.values[index];
+
+  case json_array_doubles:
+    return (const json_t *) ((uintptr_t) &arr->data.doubles[index] | json__tag_borrowed_double);
+
+  case json_array_int64s: {
+    int64_t value = arr->data.int64s[index];
+
+    if (value >= json__tagged_int_min && value <= json__tagged_int_max) {
+      return json__tag_int64(value);
+    }
+
+    return (const json_t *) ((uintptr_t) &arr->data.int64s[index] | json__tag_borrowed_int64);
+  }
+  }
+}
+
+int
+json_array_set(json_t *array, size_t index, json_t *value) {
+  int err;
+
+  json_array_t *arr = json_to(array, array);
+
+  if (arr->flags & json__flag_frozen) return -1;
+
+  if (index >= arr->len) return -1;
+
+  arr->flags &= ~json__flag_hashed;
+
+  if (arr->kind != json_array_values) {
+    int kind = json_typeof(value) == json_number ? json__number_kind(value) : -1;
+
+    if (arr->kind == json_array_doubles && kind == json_number_double) {
+      arr->data.doubles[index] = json__number_f64(value);
+
+      return 0;
+    }
+
+    if (arr->kind == json_array_int64s && kind == json_number_int64) {
+      arr->data.int64s[index] = json__number_i64(value);
+
+      return 0;
+    }
+
+    err = json__array_unpack(arr);
+    if (err < 0) return err;
+  }
+
+  err = json__retain(value, &value);
+  if (err < 0) return err;
+
+  json_deref(arr->data.values[index]);
+
+  arr->data.values[index] = value;
+
+  return 0;
+}
+
+int
+json_array_reserve(json_t *array, size_t capacity) {
+  json_array_t *arr = json_to(array, array);
+
+  if (arr->flags & json__flag_frozen) return -1;
+
+  return json__array_reserve(arr, capacity);
+}
+
+int
+json_array_insert(json_t *array, size_t index, json_t *value) {
+  int err;
+
+  json_array_t *arr = json_to(array, array);
+
+  if (arr->flags & json__flag_frozen) return -1;
+
+  if (index > arr->len) return -1;
+
+  arr->flags &= ~json__flag_hashed;
+
+  if (arr->kind != json_array_values) {
+    int kind = json_typeof(value) == json_number ? json__number_kind(value) : -1;
+
+    if (!(arr->kind == json_array_doubles && kind == json_number_double) && !(arr->kind == json_array_int64s && kind == json_number_int64)) {
+      err = json__array_unpack(arr);
+      if (err < 0) return err;
+    }
+  }
+
+  err = json__array_grow(arr, arr->len + 1);
+  if (err < 0) return err;
+
+  if (arr->kind == json_array_values) {
+    err = json__retain(value, &value);
+    if (err < 0) return err;
+  }
+
+  size_t size = json__array_element_size(arr->kind);
+
+  char *data = (char *) arr->data.values;
+
+  memmove(&data[(index + 1) * size], &data[index * size], (arr->len - index) * size);
+
+  arr->len++;
+
+  switch (arr->kind) {
+  case json_array_values:
+  default:
+    arr->data.values[index] = value;
+    break;
+
+  case json_array_doubles:
+    arr->data.doubles[index] = json__number_f64(value);
+    break;
+
+  case json_array_int64s:
+    arr->data.int64s[index] = json__number_i64(value);
+    break;
+  }
+
+  return 0;
+}
+
+int
+json_array_push(json_t *array, json_t *value) {
+  return json_array_insert(array, json_to(array, array)->len, value);
+}
+
+int
+json_array_delete(json_t *array, size_t index) {
+  int err;
+
+  json_array_t *arr = json_to(array, array);
+
+  if (arr->flags & json__flag_frozen) return -1;
+
+  if (index >= arr->len) return -1;
+
+  arr->flags &= ~json__flag_hashed;
+
+  err = json__array_unpack(arr);
+  if (err < 0) return err;
+
+  json_deref(arr->data.values[index]);
+
+  arr->data.values[index] = (json_t *) &json__null;
+
+  return 0;
+}
+
+static inline json_object_t *
+json__object_alloc_in(json_arena_t *arena, size_t capacity) {
+  uint8_t flags;
+
+  json_object_t *obj = json__node_alloc(arena, sizeof(json_object_t) + capacity * sizeof(json_property_t), &flags);
+
+  if (obj == NULL) return NULL;
+
+  obj->type = json_object;
+  obj->flags = flags;
+  obj->refs = 1;
+  obj->len = 0;
+  obj->capacity = capacity;
+  obj->properties = (json_property_t *) &obj[1];
+
+  return obj;
+}
+
+static inline json_object_t *
+json__object_alloc(size_t capacity) {
+  return json__object_alloc_in(NULL, capacity);
+}
+
+static inline int
+json__object_reserve(json_object_t *obj, size_t capacity) {
+  if (capacity <= obj->capacity) return 0;
+
+  json_property_t *properties = json__storage_reserve(obj->properties, &obj->flags, obj->len, capacity, sizeof(json_property_t));
+
+  if (properties == NULL) return -1;
+
+  obj->properties = properties;
+  obj->capacity = capacity;
+
+  return 0;
+}
+
+int
+json_create_object(size_t len, json_t **result) {
+  json_object_t *obj = json__object_alloc(len);
+
+  if (obj == NULL) return -1;
+
+  *result = (json_t *) obj;
+
+  return 0;
+}
+
+size_t
+json_object_size(const json_t *object) {
+  return json_to(object, object)->len;
+}
+
+int
+json_object_reserve(json_t *object, size_t capacity) {
+  json_object_t *obj = json_to(object, object);
+
+  if (obj->flags & json__flag_frozen) return -1;
+
+  return json__object_reserve(obj, capacity);
+}
+
+json_t *
+json_object_get(const json_t *object, const json_t *key) {
+  json_t *value = (json_t *) json_object_peek(object, key);
+
+  if (value) json_ref(value);
+
+  return value;
+}
+
+const json_t *
+json_object_peek(const json_t *object, const json_t *key) {
+  json_object_t *obj = json_to(object, object);
+
+  assert(json_typeof(key) == json_string);
+
+  for (size_t i = 0, n = obj->len; i < n; i++) {
+    json_property_t *property = &obj->properties[i];
+
+    if (json__property_matches(property, key)) return property->value;
+  }
+
+  return NULL;
+}
+
+const json_t *
+json_object_peek_utf8(const json_t *object, const utf8_t *key, size_t len) {
+  json_object_t *obj = json_to(object, object);
+
+  if (len == (size_t) -1) len = strlen((char *) key);
+
+  for (size_t i = 0, n = obj->len; i < n; i++) {
+    json_property_t *property = &obj->properties[i];
+
+    json_string_t *str = json_to(string, property->key);
+
+    if (str->encoding == json_string_utf8 && str->len == len && memcmp(str->data, key, len) == 0) {
+      return property->value;
+    }
+  }
+
+  return NULL;
+}
+
+const json_t *
+json_object_peek_utf16le(const json_t *object, const utf16_t *key, size_t len) {
+  json_object_t *obj = json_to(object, object);
+
+  if (len == (size_t) -1) len = json__utf16_length(key);
+
+  for (size_t i = 0, n = obj->len; i < n; i++) {
+    json_property_t *property = &obj->properties[i];
+
+    json_string_t *str = json_to(string, property->key);
+
+    if (str->encoding == json_string_utf16le && str->len == len && memcmp(str->data, key, len * sizeof(utf16_t)) == 0) {
+      return property->value;
+    }
+  }
+
+  return NULL;
+}
+
+const json_t *
+json_object_peek_key(const json_t *object, size_t index) {
+  json_object_t *obj = json_to(object, object);
+
+  if (index >= obj->len) return NULL;
+
+  return obj->properties[index].key;
+}
+
+const json_t *
+json_object_peek_value(const json_t *object, size_t index) {
+  json_object_t *obj = json_to(object, object);
+
+  if (index >= obj->len) return NULL;
+
+  return obj->properties[index].value;
+}
+
+int
+json_object_set(json_t *object, json_t *key, json_t *value) {
+  int err;
+
+  json_object_t *obj = json_to(object, object);
+
+  if (obj->flags & json__flag_frozen) return -1;
+
+  assert(json_typeof(key) == json_string);
+
+  obj->flags &= ~json__flag_hashed;
+
+  for (size_t i = 0, n = obj->len; i < n; i++) {
+    json_property_t *property = &obj->properties[i];
+
+    if (json__property_matches(property, key)) {
+      err = json__retain(value, &value);
+      if (err < 0) return err;
+
+      json_deref(property->value);
+
+      property->value = value;
+
+      return 0;
+    }
+  }
+
+  if (obj->len == obj->capacity) {
+    err = json__object_reserve(obj, json__storage_grow(obj->capacity, obj->len + 1));
+    if (err < 0) return err;
+  }
+
+  err = json__retain(value, &value);
+  if (err < 0) return err;
+
+  json_ref(key);
+
+  obj->properties[obj->len++] = (json_property_t) {
+    .key = key,
+    .value = value,
+  };
+
+  return 0;
+}
+
+int
+json_object_delete(json_t *object, const json_t *key) {
+  json_object_t *obj = json_to(object, object);
+
+  if (obj->flags & json__flag_frozen) return -1;
+
+  assert(json_typeof(key) == json_string);
+
+  for (size_t i = 0, n = obj->len; i < n; i++) {
+    json_property_t *property = &obj->properties[i];
+
+    if (json__property_matches(property, key)) {
+      obj->flags &= ~json__flag_hashed;
+
+      json_deref(property->key);
+      json_deref(property->value);
+
+      // Keep the remaining properties contiguous and in insertion order.
+      memmove(property, property + 1, (n - i - 1) * sizeof(json_property_t));
+
+      obj->len--;
+
+      return 0;
+    }
+  }
+
+  return -1;
+}
+
+static inline size_t
+json__string_size(const json_string_t *str) {
+  size_t unit = str->encoding == json_string_utf16le ? sizeof(utf16_t) : sizeof(utf8_t);
+
+  return offsetof(json_string_t, data) + (str->len + 1) * unit;
+}
+
+static size_t
+json__frozen_node_size(const json_t *value) {
+  if (json__is_tagged(value)) return 0;
+
+  switch (value->type) {
+  case json_null:
+  case json_boolean:
+  default:
+    return 0;
+
+  case json_number:
+    return json__align(sizeof(json_number_t));
+
+  case json_string:
+    return json__align(json__string_size(json_to(string, value)));
+
+  case json_array: {
+    json_array_t *arr = json_to(array, value);
+
+    return json__align(json__align(sizeof(json_array_t)) + arr->len * json__array_element_size(arr->kind));
+  }
+
+  case json_object:
+    return json__align(sizeof(json_object_t) + json_to(object, value)->len * sizeof(json_property_t));
+  }
+}
+
+static int
+json__frozen_size(const json_t *value, size_t *result) {
+  int err = 0;
+
+  json_encoder_frame_t *frames = NULL;
+  size_t depth = 0, capacity = 0;
+
+  size_t size = 0;
+
+  while (true) {
+    size += json__frozen_node_size(value);
+
+    if (json__is_container(value)) {
+      err = json__encoder_push(&frames, &depth, &capacity, value);
+      if (err < 0) break;
+    }
+
+    value = NULL;
+
+    while (depth && (value = json__walk_next(frames[depth - 1].value, &frames[depth - 1].index)) == NULL) {
+      depth--;
+    }
+
+    if (value == NULL) break;
+  }
+
+  free(frames);
+
+  *result = size;
+
+  return err;
+}
+
+// Copy a single node into the frozen allocation at the cursor, leaving the
+// children of arrays and objects to be filled in.
+static json_t *
+json__freeze_node(const json_t *value, char **cursor) {
+  if (json__is_tagged(value)) return (json_t *) value;
+
+  const uint8_t flags = json__flag_frozen | json__flag_immortal;
+
+  switch (value->type) {
+  case json_null:
+  case json_boolean:
+  default:
+    return (json_t *) value;
+
+  case json_number: {
+    json_number_t *num = (json_number_t *) *cursor;
+
+    memcpy(num, value, sizeof(json_number_t));
+
+    num->flags = flags;
+    num->refs = 1;
+
+    *cursor += json__align(sizeof(json_number_t));
+
+    return (json_t *) num;
+  }
+
+  case json_string: {
+    json_string_t *str = (json_string_t *) *cursor;
+
+    size_t size = json__string_size(json_to(string, value));
+
+    memcpy(str, value, size);
+
+    str->flags = flags;
+    str->refs = 1;
+
+    *cursor += json__align(size);
+
+    return (json_t *) str;
+  }
+
+  case json_array: {
+    json_array_t *source = json_to(array, value);
+
+    json_array_t *arr = (json_array_t *) *cursor;
+
+    size_t size = source->len * json__array_element_size(source->kind);
+
+    arr->type = json_array;
+    arr->kind = source->kind;
+    arr->flags = flags;
+    arr->refs = 1;
+    arr->len = arr->capacity = source->len;
+    arr->data.values = (void *) ((char *) arr + json__align(sizeof(json_array_t)));
+
+    *cursor += json__align(json__align(sizeof(json_array_t)) + size);
+
+    if (arr->kind != json_array_values && size) {
+      memcpy(arr->data.values, source->data.values, size);
+    }
+
+    return (json_t *) arr;
+  }
+
+  case json_object: {
+    json_object_t *source = json_to(object, value);
+
+    json_object_t *obj = (json_object_t *) *cursor;
+
+    obj->type = json_object;
+    obj->flags = flags;
+    obj->refs = 1;
+    obj->len = obj->capacity = source->len;
+    obj->properties = (json_property_t *) &obj[1];
+
+    *cursor += json__align(sizeof(json_object_t) + obj->len * sizeof(json_property_t));
+
+    return (json_t *) obj;
+  }
+  }
+}
+
+typedef struct {
+  const json_t *source;
+  json_t *copy;
+  size_t index;
+} json_freeze_frame_t;
+
+// Copy a value into the frozen allocation at the cursor, depth first with
+// parents before their children.
+static int
+json__freeze(const json_t *value, char **cursor, json_t **result) {
+  json_freeze_frame_t *frames = NULL;
+  size_t depth = 0, capacity = 0;
+
+  json_t *copy = json__freeze_node(value, cursor);
+
+  *result = copy;
+
+  while (true) {
+    if (json__is_container(value)) {
+      if (depth == capacity) {
+        size_t n = json__storage_grow(capacity, depth + 1);
+
+        json_freeze_frame_t *next = n > SIZE_MAX / sizeof(json_freeze_frame_t) ? NULL : realloc(frames, n * sizeof(json_freeze_frame_t));
+
+        if (next == NULL) {
+          free(frames);
+
+          return -1;
+        }
+
+        frames = next;
+        capacity = n;
+      }
+
+      frames[depth++] = (json_freeze_frame_t) {
+        .source = value,
+        .copy = copy,
+        .index = 0,
+      };
+    }
+
+    value = NULL;
+
+    while (depth) {
+      json_freeze_frame_t *frame = &frames[depth - 1];
+
+      size_t index = frame->index;
+
+      value = json__walk_next(frame->source, &frame->index);
+
+      if (value == NULL) {
+        depth--;
+
+        continue;
+      }
+
+      copy = json__freeze_node(value, cursor);
+
+      if (json_typeof(frame->copy) == json_array) {
+        json_to(array, frame->copy)->data.values[index] = copy;
+      } else if (index % 2) {
+        json_to(object, frame->copy)->properties[index / 2].value = copy;
+      } else {
+        json_to(object, frame->copy)->properties[index / 2].key = copy;
+      }
+
+      break;
+    }
+
+    if (value == NULL) break;
+  }
+
+  free(frames);
+
+  return 0;
+}
+
+static inline uint8_t *
+json__flags(json_t *value) {
+  if (json__is_tagged(value)) return NULL;
+
+  switch (value->type) {
+  case json_null:
+  case json_boolean:
+  default:
+    return NULL;
+
+  case json_number:
+    return &json_to(number, value)->flags;
+
+  case json_string:
+    return &json_to(string, value)->flags;
+
+  case json_array:
+    return &json_to(array, value)->flags;
+
+  case json_object:
+    return &json_to(object, value)->flags;
+  }
+}
+
+#define json__hash_seed  UINT64_C(0x9e3779b97f4a7c15)
+#define json__hash_prime UINT64_C(0x100000001b3)
+
+static inline uint64_t
+json__hash_mix(uint64_t h) {
+  h ^= h >> 33;
+  h *= UINT64_C(0xff51afd7ed558ccd);
+  h ^= h >> 33;
+  h *= UINT64_C(0xc4ceb9fe1a85ec53);
+  h ^= h >> 33;
+
+  return h;
+}
+
+static inline uint64_t
+json__hash_bytes(const void *data, size_t len, uint64_t seed) {
+  const uint8_t *bytes = data;
+
+  uint64_t h = seed ^ (len * json__hash_seed);
+
+  for (; len >= 8; bytes += 8, len -= 8) {
+    uint64_t k;
+    memcpy(&k, bytes, 8);
+
+    k *= UINT64_C(0x87c37b91114253d5);
+    k = (k << 31) | (k >> 33);
+
+    h = ((h ^ k) << 27 | (h ^ k) >> 37) * 5 + 0x52dce729;
+  }
+
+  uint64_t k = 0;
+
+  for (size_t i = 0; i < len; i++) k |= (uint64_t) bytes[i] << (i * 8);
+
+  return json__hash_mix(h ^ k);
+}
+
+// Numbers that compare equal must hash equally regardless of how they are
+// stored, so integral doubles hash as the integer they represent.
+static inline uint64_t
+json__hash_integer(bool negative, uint64_t value) {
+  return json__hash_mix(value ^ (negative ? UINT64_C(0x2545f4914f6cdd1d) : json_number));
+}
+
+static inline uint64_t
+json__hash_double(double value) {
+  if (value >= -9223372036854775808.0 && value < 9223372036854775808.0 && value == (double) (int64_t) value) {
+    return json__hash_integer(value < 0, value < 0 ? (uint64_t) (int64_t) value : (uint64_t) value);
+  }
+
+  if (value >= 9223372036854775808.0 && value < 18446744073709551616.0 && value == (double) (uint64_t) value) {
+    return json__hash_integer(false, (uint64_t) value);
+  }
+
+  uint64_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+
+  return json__hash_mix(bits ^ json__hash_seed);
+}
+
+static inline uint64_t
+json__hash_int64(int64_t value) {
+  return json__hash_integer(value < 0, (uint64_t) value);
+}
+
+static inline uint64_t
+json__hash_scalar(const json_t *value) {
+  switch (json_typeof(value)) {
+  case json_null:
+  default:
+    return json__hash_mix(json_null + 1);
+
+  case json_boolean:
+    return json__hash_mix(json_to(boolean, value)->value ? 3 : 2);
+
+  case json_number:
+    switch (json__number_kind(value)) {
+    case json_number_double:
+    default:
+      return json__hash_double(json__number_f64(value));
+
+    case json_number_int64:
+      return json__hash_int64(json__number_i64(value));
+
+    case json_number_uint64:
+      return json__hash_integer(false, json__number_u64(value));
+    }
+
+  case json_string: {
+    json_string_t *str = json_to(string, value);
+
+    size_t unit = str->encoding == json_string_utf16le ? sizeof(utf16_t) : sizeof(utf8_t);
+
+    return json__hash_bytes(str->data, str->len * unit, json_string + str->encoding);
+  }
+  }
+}
+
+// Arrays combine their elements in order, objects combine their properties
+// with a sum so that the result doesn't depend on property order.
+static inline uint64_t
+json__hash_element(uint64_t hash, uint64_t element) {
+  return (hash ^ element) * json__hash_prime;
+}
+
+static inline uint64_t
+json__hash_property(uint64_t hash, uint64_t key, uint64_t value) {
+  return hash + json__hash_mix(key ^ ((value << 17) | (value >> 47)));
+}
+
+typedef struct {
+  const json_t *value;
+  size_t index;
+  uint64_t hash;
+  uint64_t key;
+} json_hash_frame_t;
+
+// Hash a value that needs no traversal, returning false for containers that
+// have to be opened.
+static inline bool
+json__hash_value(const json_t *value, bool populate, uint64_t *result) {
+  switch (json_typeof(value)) {
+  case json_array: {
+    json_array_t *arr = json_to(array, value);
+
+    if (arr->flags & json__flag_hashed) {
+      *result = arr->hash;
+
+      return true;
+    }
+
+    if (arr->kind == json_array_values) return false;
+
+    uint64_t hash = json__hash_mix(json_array ^ arr->len);
+
+    for (size_t i = 0, n = arr->len; i < n; i++) {
+      uint64_t element = arr->kind == json_array_doubles ? json__hash_double(arr->data.doubles[i]) : json__hash_int64(arr->data.int64s[i]);
+
+      hash = json__hash_element(hash, element);
+    }
+
+    *result = json__hash_mix(hash);
+
+    if (populate) {
+      arr->hash = *result;
+      arr->flags |= json__flag_hashed;
+    }
+
+    return true;
+  }
+
+  case json_object: {
+    json_object_t *obj = json_to(object, value);
+
+    if ((obj->flags & json__flag_hashed) == 0) return false;
+
+    *result = obj->hash;
+
+    return true;
+  }
+
+  default:
+    *result = json__hash_scalar(value);
+
+    return true;
+  }
+}
+
+static inline void
+json__hash_combine(json_hash_frame_t *frame, uint64_t hash) {
+  if (json_typeof(frame->value) == json_array) {
+    frame->hash = json__hash_element(frame->hash, hash);
+  } else {
+    frame->hash = json__hash_property(frame->hash, frame->key, hash);
+  }
+}
+
+// Move on to the next child of a container, returning false once there are
+// none left.
+static inline bool
+json__hash_advance(json_hash_frame_t *frame, const json_t **child) {
+  if (json_typeof(frame->value) == json_array) {
+    json_array_t *arr = json_to(array, frame->value);
+
+    if (frame->index == arr->len) return false;
+
+    *child = arr->data.values[frame->index++];
+  } else {
+    json_object_t *obj = json_to(object, frame->value);
+
+    if (frame->index == obj->len) return false;
+
+    json_property_t *property = &obj->properties[frame->index++];
+
+    frame->key = json__hash_scalar(property->key);
+
+    *child = property->value;
+  }
+
+  return true;
+}
+
+static inline uint64_t
+json__hash_close(json_hash_frame_t *frame, bool populate) {
+  uint64_t hash = json__hash_mix(frame->hash);
+
+  if (populate) {
+    if (json_typeof(frame->value) == json_array) {
+      json_array_t *arr = json_to(array, frame->value);
+
+      arr->hash = hash;
+      arr->flags |= json__flag_hashed;
+    } else {
+      json_object_t *obj = json_to(object, frame->value);
+
+      obj->hash = hash;
+      obj->flags |= json__flag_hashed;
+    }
+  }
+
+  return hash;
+}
+
+// Hash a value, reusing the hashes cached on its containers. With `populate`,
+// every container is assumed to be owned by the caller, such as a tree that is
+// being frozen, and has its hash cached. Otherwise nothing is written, so that
+// trees shared between threads can be hashed concurrently.
+static int
+json__hash(const json_t *value, bool populate, uint64_t *result) {
+  json_hash_frame_t *frames = NULL;
+  size_t depth = 0, capacity = 0;
+
+  uint64_t hash;
+
+  while (true) {
+    if (!json__hash_value(value, populate, &hash)) {
+      if (depth == capacity) {
+        size_t n = json__storage_grow(capacity, depth + 1);
+
+        json_hash_frame_t *next = n > SIZE_MAX / sizeof(json_hash_frame_t) ? NULL : realloc(frames, n * sizeof(json_hash_frame_t));
+
+        if (next == NULL) {
+          free(frames);
+
+          return -1;
+        }
+
+        frames = next;
+        capacity = n;
+      }
+
+      bool array = json_typeof(value) == json_array;
+
+      frames[depth++] = (json_hash_frame_t) {
+        .value = value,
+        .index = 0,
+        .hash = json__hash_mix((array ? json_array : json_object) ^ (array ? json_to(array, value)->len : json_to(object, value)->len)),
+      };
+    } else if (depth == 0) {
+      break;
+    } else {
+      json__hash_combine(&frames[depth - 1], hash);
+    }
+
+    // Close all containers that are complete and descend into the next child.
+    while (!json__hash_advance(&frames[depth - 1], &value)) {
+      json_hash_frame_t *frame = &frames[--depth];
+
+      hash = json__hash_close(frame, populate);
+
+      if (depth == 0) goto done;
+
+      json__hash_combine(&frames[depth - 1], hash);
+    }
+  }
+
+done:
+  free(frames);
+
+  *result = hash;
+
+  return 0;
+}
+
+int
+json_hash(const json_t *value, uint64_t *result) {
+  return json__hash(value, false, result);
+}
+
+int
+json_freeze(const json_t *value, json_t **result) {
+  int err;
+
+  size_t size;
+  err = json__frozen_size(value, &size);
+  if (err < 0) return err;
+
+  if (size == 0) {
+    *result = (json_t *) value;
+
+    return 0;
+  }
+
+  char *block = malloc(size);
+
+  if (block == NULL) return -1;
+
+  char *cursor = block;
+
+  json_t *root;
+  err = json__freeze(value, &cursor, &root);
+
+  if (err < 0) {
+    free(block);
+
+    return err;
+  }
+
+  assert(cursor == block + size);
+  assert((char *) root == block);
+
+  // Only the root is reference counted and releasing it frees the entire
+  // allocation. Interior nodes are immortal for as long as the root is alive.
+  *json__flags(root) &= ~json__flag_immortal;
+
+  // Hash the frozen tree up front so that hashing it later never writes to
+  // it, which keeps it safe to share between threads.
+  uint64_t hash;
+
+  if (json__hash(root, true, &hash) < 0) {
+    json_deref(root);
+
+    return -1;
+  }
+
+  *result = root;
+
+  return 0;
+}
+
+bool
+json_is_frozen(const json_t *value) {
+  uint8_t *flags = json__flags((json_t *) value);
+
+  if (flags == NULL) return true;
+
+  return (*flags & json__flag_frozen) != 0;
+}
+
+int
+json_create_builder(json_builder_t **result) {
+  json_builder_t *builder = malloc(sizeof(json_builder_t));
+
+  if (builder == NULL) return -1;
+
+  builder->values = NULL;
+  builder->len = 0;
+  builder->capacity = 0;
+  builder->frames = NULL;
+  builder->depth = 0;
+  builder->frames_capacity = 0;
+
+  *result = builder;
+
+  return 0;
+}
+
+static inline void
+json__builder_reset(json_builder_t *builder) {
+  for (size_t i = 0, n = builder->len; i < n; i++) {
+    json_deref(builder->values[i]);
+  }
+
+  builder->len = 0;
+  builder->depth = 0;
+}
+
+void
+json_destroy_builder(json_builder_t *builder) {
+  json__builder_reset(builder);
+
+  free(builder->values);
+  free(builder->frames);
+  free(builder);
+}
+
+static inline bool
+json__builder_expects_key(json_builder_t *builder) {
+  if (builder->depth == 0) return false;
+
+  json_builder_frame_t *frame = &builder->frames[builder->depth - 1];
+
+  return frame->type == json_object && (builder->len - frame->start) % 2 == 0;
+}
+
+// Takes ownership of the value, which is released if it can't be added.
+static inline int
+json__builder_push(json_builder_t *builder, json_t *value) {
+  if (builder->len == builder->capacity) {
+    size_t capacity = json__storage_grow(builder->capacity, builder->len + 1);
+
+    json_t **values = capacity > SIZE_MAX / sizeof(json_t *) ? NULL : realloc(builder->values, capacity * sizeof(json_t *));
+
+    if (values == NULL) {
+      json_deref(value);
+
+      return -1;
+    }
+
+    builder->values = values;
+    builder->capacity = capacity;
+  }
+
+  builder->values[builder->len++] = value;
+
+  return 0;
+}
+
+// Like json__builder_push(), but also accepts borrowed numbers and interior
+// nodes, which are copied out first.
+static inline int
+json__builder_append(json_builder_t *builder, json_t *value) {
+  int err;
+
+  if (json__is_borrowed(value) || json__is_interior(value)) {
+    err = json__retain(value, &value);
+    if (err < 0) return err;
+  }
+
+  return json__builder_push(builder, value);
+}
+
+int
+json_builder_value(json_builder_t *builder, json_t *value) {
+  if (json__builder_expects_key(builder)) {
+    json_deref(value);
+
+    return -1;
+  }
+
+  return json__builder_append(builder, value);
+}
+
+// The singletons are never borrowed and so skip straight to storing them.
+static inline int
+json__builder_singleton(json_builder_t *builder, json_t *value) {
+  if (json__builder_expects_key(builder)) return -1;
+
+  return json__builder_push(builder, value);
+}
+
+int
+json_builder_null(json_builder_t *builder) {
+  return json__builder_singleton(builder, (json_t *) &json__null);
+}
+
+int
+json_builder_boolean(json_builder_t *builder, bool value) {
+  return json__builder_singleton(builder, value ? (json_t *) &json__true : (json_t *) &json__false);
+}
+
+int
+json_builder_number(json_builder_t *builder, double value) {
+  int err;
+
+  json_t *number;
+  err = json_create_number(value, &number);
+  if (err < 0) return err;
+
+  return json_builder_value(builder, number);
+}
+
+int
+json_builder_number_int64(json_builder_t *builder, int64_t value) {
+  int err;
+
+  json_t *number;
+  err = json_create_number_int64(value, &number);
+  if (err < 0) return err;
+
+  return json_builder_value(builder, number);
+}
+
+int
+json_builder_string_utf8(json_builder_t *builder, const utf8_t *value, size_t len) {
+  int err;
+
+  json_t *string;
+  err = json_create_string_utf8(value, len, &string);
+  if (err < 0) return err;
+
+  return json_builder_value(builder, string);
+}
+
+int
+json_builder_string_utf16le(json_builder_t *builder, const utf16_t *value, size_t len) {
+  int err;
+
+  json_t *string;
+  err = json_create_string_utf16le(value, len, &string);
+  if (err < 0) return err;
+
+  return json_builder_value(builder, string);
+}
+
+int
+json_builder_key(json_builder_t *builder, json_t *key) {
+  if (json_typeof(key) != json_string || !json__builder_expects_key(builder)) {
+    json_deref(key);
+
+    return -1;
+  }
+
+  return json__builder_append(builder, key);
+}
+
+int
+json_builder_key_utf8(json_builder_t *builder, const utf8_t *key, size_t len) {
+  int err;
+
+  json_t *string;
+  err = json_create_string_utf8(key, len, &string);
+  if (err < 0) return err;
+
+  return json_builder_key(builder, string);
+}
+
+int
+json_builder_key_utf16le(json_builder_t *builder, const utf16_t *key, size_t len) {
+  int err;
+
+  json_t *string;
+  err = json_create_string_utf16le(key, len, &string);
+  if (err < 0) return err;
+
+  return json_builder_key(builder, string);
+}
+
+static inline int
+json__builder_begin(json_builder_t *builder, json_type_t type) {
+  if (json__builder_expects_key(builder)) return -1;
+
+  if (builder->depth == builder->frames_capacity) {
+    size_t capacity = json__storage_grow(builder->frames_capacity, builder->depth + 1);
+
+    json_builder_frame_t *frames = capacity > SIZE_MAX / sizeof(json_builder_frame_t) ? NULL : realloc(builder->frames, capacity * sizeof(json_builder_frame_t));
+
+    if (frames == NULL) return -1;
+
+    builder->frames = frames;
+    builder->frames_capacity = capacity;
+  }
+
+  builder->frames[builder->depth++] = (json_builder_frame_t) {
+    .type = type,
+    .start = builder->len,
+  };
+
+  return 0;
+}
+
+int
+json_builder_begin_array(json_builder_t *builder) {
+  return json__builder_begin(builder, json_array);
+}
+
+int
+json_builder_begin_object(json_builder_t *builder) {
+  return json__builder_begin(builder, json_object);
+}
+
+int
+json_builder_end_array(json_builder_t *builder) {
+  if (builder->depth == 0) return -1;
+
+  json_builder_frame_t *frame = &builder->frames[builder->depth - 1];
+
+  if (frame->type != json_array) return -1;
+
+  size_t len = builder->len - frame->start;
+
+  json_array_t *arr = json__array_alloc(json_array_values, len);
+
+  if (arr == NULL) return -1;
+
+  if (len) memcpy(arr->data.values, &builder->values[frame->start], len * sizeof(json_t *));
+
+  builder->len = frame->start;
+  builder->depth--;
+
+  return json__builder_append(builder, (json_t *) arr);
+}
+
+int
+json_builder_end_object(json_builder_t *builder) {
+  if (builder->depth == 0) return -1;
+
+  json_builder_frame_t *frame = &builder->frames[builder->depth - 1];
+
+  if (frame->type != json_object || (builder->len - frame->start) % 2 != 0) return -1;
+
+  size_t len = (builder->len - frame->start) / 2;
+
+  json_object_t *obj = json__object_alloc(len);
+
+  if (obj == NULL) return -1;
+
+  if (len) memcpy(obj->properties, &builder->values[frame->start], len * sizeof(json_property_t));
+
+  obj->len = len;
+
+  builder->len = frame->start;
+  builder->depth--;
+
+  return json__builder_append(builder, (json_t *) obj);
+}
+
+int
+json_builder_finish(json_builder_t *builder, json_t **result) {
+  if (builder->depth != 0 || builder->len != 1) return -1;
+
+  *result = builder->values[0];
+
+  builder->len = 0;
+
+  return 0;
+}
+
+static inline int
+json__utf8_encoder_ensure_capacity(json_utf8_encoder_t *enc, size_t len) {
+  if (enc->len + len <= enc->capacity) return 0;
+
+  while (enc->len + len > enc->capacity) {
+    if (enc->capacity) enc->capacity *= 2;
+    else enc->capacity = 16;
+  }
+
+  utf8_t *value = realloc(enc->value, (enc->capacity + 1) * sizeof(utf8_t));
+
+  if (value == NULL) return -1;
+
+  enc->value = value;
+
+  return 0;
+}
+
+static inline int
+json__utf8_encoder_append(json_utf8_encoder_t *enc, utf8_t *value, size_t len) {
+  int err;
+
+  if (len == (size_t) -1) len = strlen((char *) value);
+
+  err = json__utf8_encoder_ensure_capacity(enc, len);
+  if (err < 0) return err;
+
+  memcpy(&enc->value[enc->len], value, len * sizeof(utf8_t));
+
+  enc->value[enc->len += len] = '\0';
+
+  return 0;
+}
+
+static inline int
+json__utf16_encoder_ensure_capacity(json_utf16_encoder_t *enc, size_t len) {
+  if (enc->len + len <= enc->capacity) return 0;
+
+  while (enc->len + len > enc->capacity) {
+    if (enc->capacity) enc->capacity *= 2;
+    else enc->capacity = 16;
+  }
+
+  utf16_t *value = realloc(enc->value, (enc->capacity + 1) * sizeof(utf16_t));
+
+  if (value == NULL) return -1;
+
+  enc->value = value;
+
+  return 0;
+}
+
+static inline int
+json__utf16_encoder_append(json_utf16_encoder_t *enc, utf16_t *value, size_t len) {
+  int err;
+
+  err = json__utf16_encoder_ensure_capacity(enc, len);
+  if (err < 0) return err;
+
+  memcpy(&enc->value[enc->len], value, len * sizeof(utf16_t));
+
+  enc->value[enc->len += len] = 0;
+
+  return 0;
+}
+
+static inline int
+json__encoder_push(json_encoder_frame_t **frames, size_t *depth, size_t *capacity, const json_t *value) {
+  if (*depth == *capacity) {
+    size_t n = json__storage_grow(*capacity, *depth + 1);
+
+    json_encoder_frame_t *result = n > SIZE_MAX / sizeof(json_encoder_frame_t) ? NULL : realloc(*frames, n * sizeof(json_encoder_frame_t));
+
+    if (result == NULL) return -1;
+
+    *frames = result;
+    *capacity = n;
+  }
+
+  (*frames)[(*depth)++] = (json_encoder_frame_t) {
+    .value = value,
+    .index = 0,
+    .order = 0,
+  };
+
+  return 0;
+}
+
+static inline int
+json__encode_utf8_null(json_utf8_encoder_t *enc) {
+  return json__utf8_encoder_append(enc, (utf8_t *) "null", 4);
+}
+
+static inline int
+json__encode_utf8_boolean(const json_boolean_t *boolean, json_utf8_encoder_t *enc) {
+  return json__utf8_encoder_append(enc, boolean->value ? (utf8_t *) "true" : (utf8_t *) "false", boolean->value ? 4 : 5);
+}
+
+static inline size_t
+json__format_uint64(uint64_t value, char *result) {
+  char digits[20];
+  size_t len = 0;
+
+  do {
+    digits[len++] = '0' + (char) (value % 10);
+    value /= 10;
+  } while (value);
+
+  for (size_t i = 0; i < len; i++) {
+    result[i] = digits[len - i - 1];
+  }
+
+  return len;
+}
+
+static inline size_t
+json__format_int64(int64_t value, char *result) {
+  if (value >= 0) return json__format_uint64((uint64_t) value, result);
+
+  result[0] = '-';
+
+  return json__format_uint64(-(uint64_t) value, &result[1]) + 1;
+}
+
+static inline size_t
+json__format_double(double value, char *result) {
+  return snprintf(result, 32, "%.17g", value);
+}
+
+// Formats a number into a buffer of at least 32 characters, returning the
+// length excluding the NUL terminator.
+static inline size_t
+json__format_number(const json_t *number, char *result) {
+  size_t len;
+
+  switch (json__number_kind(number)) {
+  case json_number_double:
+  default:
+    return json__format_double(json__number_f64(number), result);
+
+  case json_number_int64:
+    len = json__format_int64(json__number_i64(number), result);
+    break;
+
+  case json_number_uint64:
+    len = json__format_uint64(json__number_u64(number), result);
+    break;
+  }
+
+  result[len] = '\0';
+
+  return len;
+}
+
+// Formats a double the way ECMAScript does, using the fewest digits that
+// round trip, as required by RFC 8785. Returns 0 for NaN and infinities,
+// which have no JSON representation.
+static inline size_t
+json__format_double_canonical(double value, char *result) {
+  if (value != value || value - value != 0) return 0;
+
+  if (value == 0) {
+    result[0] = '0';
+    result[1] = '\0';
+
+    return 1;
+  }
+
+  char buffer[32];
+
+  int precision = 1;
+
+  for (; precision < 17; precision++) {
+    snprintf(buffer, sizeof(buffer), "%.*e", precision - 1, value);
+
+    if (strtod(buffer, NULL) == value) break;
+  }
+
+  snprintf(buffer, sizeof(buffer), "%.*e", precision - 1, value);
+
+  // Split "-d.ddde+x" into the significant digits and the decimal exponent.
+  const char *p = buffer;
+
+  size_t len = 0;
+
+  if (*p == '-') {
+    result[len++] = '-';
+    p++;
+  }
+
+  char digits[17];
+  int k = 0;
+
+  while (*p != 'e') {
+    if (*p != '.') digits[k++] = *p;
+    p++;
+  }
+
+  int n = atoi(p + 1) + 1;
+
+  if (k <= n && n <= 21) {
+    memcpy(&result[len], digits, k);
+    len += k;
+
+    for (int i = k; i < n; i++) result[len++] = '0';
+  } else if (0 < n && n <= 21) {
+    memcpy(&result[len], digits, n);
+    len += n;
+
+    result[len++] = '.';
+
+    memcpy(&result[len], &digits[n], k - n);
+    len += k - n;
+  } else if (-6 < n && n <= 0) {
+    result[len++] = '0';
+    result[len++] = '.';
+
+    for (int i = n; i < 0; i++) result[len++] = '0';
+
+    memcpy(&result[len], digits, k);
+    len += k;
+  } else {
+    result[len++] = digits[0];
+
+    if (k > 1) {
+      result[len++] = '.';
+
+      memcpy(&result[len], &digits[1], k - 1);
+      len += k - 1;
+    }
+
+    len += snprintf(&result[len], 8, "e%c%d", n - 1 < 0 ? '-' : '+', n - 1 < 0 ? 1 - n : n - 1);
+  }
+
+  result[len] = '\0';
+
+  return len;
+}
+
+// Canonical numbers are IEEE 754 doubles, so integers beyond 2^53 are
+// formatted through their nearest double.
+static inline size_t
+json__format_int64_canonical(int64_t value, char *result) {
+  if (value >= -(INT64_C(1) << 53) && value <= (INT64_C(1) << 53)) {
+    size_t len = json__format_int64(value, result);
+
+    result[len] = '\0';
+
+    return len;
+  }
+
+  return json__format_double_canonical((double) value, result);
+}
+
+static inline size_t
+json__format_number_canonical(const json_t *number, char *result) {
+  switch (json__number_kind(number)) {
+  case json_number_double:
+  default:
+    return json__format_double_canonical(json__number_f64(number), result);
+
+  case json_number_int64:
+    return json__format_int64_canonical(json__number_i64(number), result);
+
+  case json_number_uint64:
+    return json__format_double_canonical((double) json__number_u64(number), result);
+  }
+}
+
+static inline int
+json__encode_utf8_number(const json_t *number, json_utf8_encoder_t *enc) {
+  char value[32];
+
+  size_t len;
+
+  if (enc->canonical) {
+    len = json__format_number_canonical(number, value);
+
+    if (len == 0) return -1;
+  } else {
+    len = json__format_number(number, value);
+  }
+
+  return json__utf8_encoder_append(enc, (utf8_t *) value, len);
+}
+
+static const char json__hex[] = "0123456789abcdef";
+
+static inline int
+json__encode_utf8_escape(uint32_t code, json_utf8_encoder_t *enc) {
+  int err;
+
+  err = json__utf8_encoder_ensure_capacity(enc, 12);
+  if (err < 0) return err;
+
+  if (code >= 0x10000) {
+    code -= 0x10000;
+
+    err = json__encode_utf8_escape(0xd800 + (code >> 10), enc);
+    if (err < 0) return err;
+
+    return json__encode_utf8_escape(0xdc00 + (code & 0x3ff), enc);
+  }
+
+  utf8_t *data = &enc->value[enc->len];
+
+  data[0] = '\\';
+  data[1] = 'u';
+  data[2] = json__hex[(code >> 12) & 0xf];
+  data[3] = json__hex[(code >> 8) & 0xf];
+  data[4] = json__hex[(code >> 4) & 0xf];
+  data[5] = json__hex[code & 0xf];
+
+  enc->value[enc->len += 6] = '\0';
+
+  return 0;
+}
+
+// Decode the code point of the multibyte sequence starting at data[*i],
+// advancing past it. Malformed sequences yield U+FFFD.
+static inline uint32_t
+json__utf8_next(const utf8_t *data, size_t len, size_t *i) {
+  utf8_t c = data[(*i)++];
+
+  size_t n;
+  uint32_t code;
+
+  if ((c & 0xe0) == 0xc0) n = 1, code = c & 0x1f;
+  else if ((c & 0xf0) == 0xe0) n = 2, code = c & 0x0f;
+  else if ((c & 0xf8) == 0xf0) n = 3, code = c & 0x07;
+  else return 0xfffd;
+
+  if (len - *i < n) {
+    *i = len;
+
+    return 0xfffd;
+  }
+
+  for (size_t j = 0; j < n; j++) {
+    c = data[(*i)++];
+
+    if ((c & 0xc0) != 0x80) return 0xfffd;
+
+    code = (code << 6) | (c & 0x3f);
+  }
+
+  return code;
+}
+
+static inline int
+json__encode_utf8_string(const json_string_t *string, json_utf8_encoder_t *enc) {
+  int err;
+
+  assert(string->encoding == json_string_utf8);
+
+  size_t len = string->len;
+
+  err = json__utf8_encoder_ensure_capacity(enc, len + 2);
+  if (err < 0) return err;
+
+  enc->value[enc->len++] = '"';
+
+  const utf8_t *data = json__string_utf8(string);
+
+  size_t i = 0;
+
+  while (i < len) {
+    // Copy runs of characters that need no escaping in one go.
+    size_t start = i;
+
+    while (i < len) {
+      utf8_t c = data[i];
+
+      if (c < 0x20 || c == '"' || c == '\\' || (c >= 0x80 && enc->ascii_only)) break;
+
+      i++;
+    }
+
+    if (i > start) {
+      err = json__utf8_encoder_append(enc, (utf8_t *) &data[start], i - start);
+      if (err < 0) return err;
+    }
+
+    if (i == len) break;
+
+    utf8_t c = data[i];
+
+    if (c >= 0x80) {
+      err = json__encode_utf8_escape(json__utf8_next(data, len, &i), enc);
+      if (err < 0) return err;
+
+      continue;
+    }
+
+    i++;
+
+    utf8_t escaped[2] = {'\\', 0};
+
+    switch (c) {
+    case '"':
+    case '\\':
+      escaped[1] = c;
+      break;
+    case '\b':
+      escaped[1] = 'b';
+      break;
+    case '\f':
+      escaped[1] = 'f';
+      break;
+    case '\n':
+      escaped[1] = 'n';
+      break;
+    case '\r':
+      escaped[1] = 'r';
+      break;
+    case '\t':
+      escaped[1] = 't';
+      break;
+    }
+
+    if (escaped[1]) err = json__utf8_encoder_append(enc, escaped, 2);
+    else err = json__encode_utf8_escape(c, enc);
+
+    if (err < 0) return err;
+  }
+
+  return json__utf8_encoder_append(enc, (utf8_t *) "\"", 1);
+}
+
+static const char json__spaces[] = "                                                                ";
+
+// Start a new line indented to the given depth, writing the indentation from
+// a precomputed run of spaces rather than one character at a time.
+static inline int
+json__encode_utf8_newline(json_utf8_encoder_t *enc, size_t depth) {
+  int err;
+
+  size_t spaces = depth * enc->indent;
+
+  err = json__utf8_encoder_ensure_capacity(enc, enc->newline_len + spaces);
+  if (err < 0) return err;
+
+  memcpy(&enc->value[enc->len], enc->newline, enc->newline_len);
+
+  enc->len += enc->newline_len;
+
+  while (spaces) {
+    size_t n = spaces < sizeof(json__spaces) - 1 ? spaces : sizeof(json__spaces) - 1;
+
+    memcpy(&enc->value[enc->len], json__spaces, n);
+
+    enc->len += n;
+    spaces -= n;
+  }
+
+  enc->value[enc->len] = '\0';
+
+  return 0;
+}
+
+// Write the separator and whitespace that precede the element at the given
+// index of a container nested at the given depth.
+static inline int
+json__encode_utf8_separator(json_utf8_encoder_t *enc, size_t index, size_t depth) {
+  int err;
+
+  if (index) {
+    err = json__utf8_encoder_append(enc, (utf8_t *) ",", 1);
+    if (err < 0) return err;
+  }
+
+  if (!enc->pretty) return 0;
+
+  if (enc->indent) return json__encode_utf8_newline(enc, depth);
+
+  if (index && enc->spacing) return json__utf8_encoder_append(enc, (utf8_t *) " ", 1);
+
+  return 0;
+}
+
+static inline int
+json__encode_utf8_close(json_utf8_encoder_t *enc, size_t len, size_t depth, utf8_t bracket) {
+  int err;
+
+  if (len && enc->indent) {
+    err = json__encode_utf8_newline(enc, depth);
+    if (err < 0) return err;
+  }
+
+  return json__utf8_encoder_append(enc, &bracket, 1);
+}
+
+static inline int
+json__encode_utf8_doubles(const double *values, size_t len, json_utf8_encoder_t *enc) {
+  int err;
+
+  for (size_t i = 0; i < len; i++) {
+    err = json__utf8_encoder_ensure_capacity(enc, 33);
+    if (err < 0) return err;
+
+    if (i) enc->value[enc->len++] = ',';
+
+    enc->len += json__format_double(values[i], (char *) &enc->value[enc->len]);
+  }
+
+  return 0;
+}
+
+static inline int
+json__encode_utf8_int64s(const int64_t *values, size_t len, json_utf8_encoder_t *enc) {
+  int err;
+
+  for (size_t i = 0; i < len; i++) {
+    err = json__utf8_encoder_ensure_capacity(enc, 21);
+    if (err < 0) return err;
+
+    if (i) enc->value[enc->len++] = ',';
+
+    enc->len += json__format_int64(values[i], (char *) &enc->value[enc->len]);
+  }
+
+  enc->value[enc->len] = '\0';
+
+  return 0;
+}
+
+static inline int
+json__encode_utf8_packed_array(const json_array_t *array, json_utf8_encoder_t *enc) {
+  int err;
+
+  err = json__utf8_encoder_append(enc, (utf8_t *) "[", 1);
+  if (err < 0) return err;
+
+  if (!enc->pretty && !enc->canonical) {
+    if (array->kind == json_array_doubles) {
+      err = json__encode_utf8_doubles(array->data.doubles, array->len, enc);
+    } else {
+      err = json__encode_utf8_int64s(array->data.int64s, array->len, enc);
+    }
+
+    if (err < 0) return err;
+
+    return json__utf8_encoder_append(enc, (utf8_t *) "]", 1);
+  }
+
+  for (size_t i = 0, n = array->len; i < n; i++) {
+    err = json__encode_utf8_separator(enc, i, enc->depth + 1);
+    if (err < 0) return err;
+
+    char value[33];
+
+    size_t len;
+
+    if (array->kind == json_array_doubles) {
+      if (enc->canonical) {
+        len = json__format_double_canonical(array->data.doubles[i], value);
+
+        if (len == 0) return -1;
+      } else {
+        len = json__format_double(array->data.doubles[i], value);
+      }
+    } else {
+      if (enc->canonical) len = json__format_int64_canonical(array->data.int64s[i], value);
+      else len = json__format_int64(array->data.int64s[i], value);
+    }
+
+    err = json__utf8_encoder_append(enc, (utf8_t *) value, len);
+    if (err < 0) return err;
+  }
+
+  return json__encode_utf8_close(enc, array->len, enc->depth, ']');
+}
+
+// The first UTF-16 code unit of a code point, which decides the order of
+// code points that differ.
+static inline uint32_t
+json__utf16_lead(uint32_t code) {
+  return code >= 0x10000 ? 0xd800 + ((code - 0x10000) >> 10) : code;
+}
+
+// Order property keys by their UTF-16 code units, as RFC 8785 requires, even
+// though they are stored as UTF-8.
+static int
+json__compare_property_keys(const void *a, const void *b) {
+  const json_string_t *x = json_to(string, (*(const json_property_t **) a)->key);
+  const json_string_t *y = json_to(string, (*(const json_property_t **) b)->key);
+
+  const utf8_t *p = json__string_utf8(x), *q = json__string_utf8(y);
+
+  size_t len = x->len < y->len ? x->len : y->len;
+
+  size_t i = 0;
+
+  while (i < len && p[i] == q[i]) i++;
+
+  if (i == len) return x->len < y->len ? -1 : x->len > y->len ? 1
+                                                              : 0;
+
+  // Back up to the start of the code point the strings differ in.
+  while (i > 0 && (p[i] & 0xc0) == 0x80) i--;
+
+  size_t j = i;
+
+  uint32_t c = p[i] < 0x80 ? p[i++] : json__utf8_next(p, x->len, &i);
+  uint32_t d = q[j] < 0x80 ? q[j++] : json__utf8_next(q, y->len, &j);
+
+  uint32_t s = json__utf16_lead(c), t = json__utf16_lead(d);
+
+  if (s != t) return s < t ? -1 : 1;
+
+  return c < d ? -1 : c > d ? 1
+                            : 0;
+}
+
+static inline int
+json__encode_utf8_sort(json_utf8_encoder_t *enc, const json_object_t *obj, json_encoder_frame_t *frame) {
+  size_t len = obj->len;
+
+  if (enc->order_len + len > enc->order_capacity) {
+    size_t capacity = json__storage_grow(enc->order_capacity, enc->order_len + len);
+
+    const json_property_t **order = capacity > SIZE_MAX / sizeof(json_property_t *) ? NULL : realloc(enc->order, capacity * sizeof(json_property_t *));
+
+    if (order == NULL) return -1;
+
+    enc->order = order;
+    enc->order_capacity = capacity;
+  }
+
+  frame->order = enc->order_len;
+
+  const json_property_t **order = &enc->order[enc->order_len];
+
+  for (size_t i = 0; i < len; i++) order[i] = &obj->properties[i];
+
+  qsort(order, len, sizeof(json_property_t *), json__compare_property_keys);
+
+  enc->order_len += len;
+
+  return 0;
+}
+
+static inline int
+json__encode_utf8(const json_t *value, json_utf8_encoder_t *enc) {
+  int err;
+
+  json_encoder_frame_t *frame;
+
+value:
+  switch (json_typeof(value)) {
+  case json_null:
+  default:
+    err = json__encode_utf8_null(enc);
+    break;
+
+  case json_boolean:
+    err = json__encode_utf8_boolean(json_to(boolean, value), enc);
+    break;
+
+  case json_number:
+    err = json__encode_utf8_number(value, enc);
+    break;
+
+  case json_string:
+    err = json__encode_utf8_string(json_to(string, value), enc);
+    break;
+
+  case json_array:
+    if (json_to(array, value)->kind != json_array_values) {
+      err = json__encode_utf8_packed_array(json_to(array, value), enc);
+      break;
+    }
+
+    err = json__utf8_encoder_append(enc, (utf8_t *) "[", 1);
+    if (err < 0) return err;
+
+    err = json__encoder_push(&enc->frames, &enc->depth, &enc->frames_capacity, value);
+    break;
+
+  case json_object:
+    err = json__utf8_encoder_append(enc, (utf8_t *) "{", 1);
+    if (err < 0) return err;
+
+    err = json__encoder_push(&enc->frames, &enc->depth, &enc->frames_capacity, value);
+    if (err < 0) return err;
+
+    if (enc->canonical) {
+      err = json__encode_utf8_sort(enc, json_to(object, value), &enc->frames[enc->depth - 1]);
+    }
+    break;
+  }
+
+  if (err < 0) return err;
+
+  while (enc->depth) {
+    frame = &enc->frames[enc->depth - 1];
+
+    if (json_typeof(frame->value) == json_array) {
+      const json_array_t *arr = json_to(array, frame->value);
+
+      if (frame->index == arr->len) {
+        enc->depth--;
+
+        err = json__encode_utf8_close(enc, arr->len, enc->depth, ']');
+        if (err < 0) return err;
+
+        continue;
+      }
+
+      err = json__encode_utf8_separator(enc, frame->index, enc->depth);
+      if (err < 0) return err;
+
+      value = arr->data.values[frame->index++];
+
+      goto value;
+    } else {
+      const json_object_t *obj = json_to(object, frame->value);
+
+      if (frame->index == obj->len) {
+        if (enc->canonical) enc->order_len = frame->order;
+
+        enc->depth--;
+
+        err = json__encode_utf8_close(enc, obj->len, enc->depth, '}');
+        if (err < 0) return err;
+
+        continue;
+      }
+
+      err = json__encode_utf8_separator(enc, frame->index, enc->depth);
+      if (err < 0) return err;
+
+      const json_property_t *property;
+
+      if (enc->canonical) property = enc->order[frame->order + frame->index++];
+      else property = &obj->properties[frame->index++];
+
+      err = json__encode_utf8_string(json_to(string, property->key), enc);
+      if (err < 0) return err;
+
+      if (enc->spacing) err = json__utf8_encoder_append(enc, (utf8_t *) ": ", 2);
+      else err = json__utf8_encoder_append(enc, (utf8_t *) ":", 1);
+
+      if (err < 0) return err;
+
+      value = property->value;
+
+      goto value;
+    }
+  }
+
+  return 0;
+}
+
+int
+json_encode_utf8(const json_t *value, utf8_t **result) {
+  return json_encode_utf8_with_options(value, NULL, result);
+}
+
+int
+json_encode_utf8_with_options(const json_t *value, const json_encode_options_t *options, utf8_t **result) {
+  int err;
+
+  json_utf8_encoder_t enc = {
+    .value = NULL,
+    .len = 0,
+    .capacity = 0,
+    .frames = NULL,
+    .depth = 0,
+    .frames_capacity = 0,
+    .pretty = false,
+    .spacing = false,
+    .ascii_only = false,
+    .canonical = false,
+    .indent = 0,
+    .newline = "\n",
+    .newline_len = 1,
+    .order = NULL,
+    .order_len = 0,
+    .order_capacity = 0,
+  };
+
+  if (options && options->canonical) {
+    enc.canonical = true;
+  } else if (options) {
+    enc.pretty = options->indent || options->spacing;
+    enc.spacing = options->spacing;
+    enc.ascii_only = options->ascii_only;
+    enc.indent = options->indent;
+
+    if (options->newline == json_newline_crlf) {
+      enc.newline = "\r\n";
+      enc.newline_len = 2;
+    }
+  }
+
+  err = json__encode_utf8(value, &enc);
+  if (err < 0) goto err;
+
+  free(enc.frames);
+  free(enc.order);
+
+  *result = realloc(enc.value, (enc.len + 1) * sizeof(utf8_t));
+
+  return 0;
+
+err:
+  free(enc.frames);
+  free(enc.order);
+  free(enc.value);
+
+  return -1;
+}
+
+// Wide string literals can't stand in for UTF-16 as wchar_t is wider than 16
+// bits on most platforms other than Windows, so ASCII is widened instead.
+static inline int
+json__encode_utf16le_ascii(const char *value, size_t len, json_utf16_encoder_t *enc) {
+  utf16_t widened[32];
+
+  assert(len <= 32);
+
+  for (size_t i = 0; i < len; i++) {
+    widened[i] = (utf16_t) value[i];
+  }
+
+  return json__utf16_encoder_append(enc, widened, len);
+}
+
+static inline int
+json__encode_utf16le_null(json_utf16_encoder_t *enc) {
+  return json__encode_utf16le_ascii("null", 4, enc);
+}
+
+static inline int
+json__encode_utf16le_boolean(const json_boolean_t *boolean, json_utf16_encoder_t *enc) {
+  return boolean->value ? json__encode_utf16le_ascii("true", 4, enc) : json__encode_utf16le_ascii("false", 5, enc);
+}
+
+static inline int
+json__encode_utf16le_number(const json_t *number, json_utf16_encoder_t *enc) {
+  char value[32];
+
+  size_t len = json__format_number(number, value);
+
+  return json__encode_utf16le_ascii(value, len, enc);
+}
+
+static inline int
+json__encode_utf16le_string(const json_string_t *string, json_utf16_encoder_t *enc) {
+  int err;
+
+  assert(string->encoding == json_string_utf16le);
+
+  err = json__encode_utf16le_ascii("\"", 1, enc);
+  if (err < 0) return err;
+
+  size_t len = string->len;
+
+  err = json__utf16_encoder_ensure_capacity(enc, len);
+  if (err < 0) return err;
+
+  const utf16_t *data = json__string_utf16le(string);
+
+  utf16_t escaped[6];
+
+  for (size_t i = 0; i < len; i++) {
+    utf16_t c = data[i];
+
+    if (c >= 32 && c != '"' && c != '\\') {
+      err = json__utf16_encoder_append(enc, &c, 1);
+      if (err < 0) return err;
+    } else {
+      escaped[0] = '\\';
+
+      switch (c) {
+      case '"':
+      case '\\':
+        escaped[1] = c;
+        break;
+
+      case '\b':
+        escaped[1] = 'b';
+        break;
+
+      case '\f':
+        escaped[1] = 'f';
+        break;
+
+      case '\n':
+        escaped[1] = 'n';
+        break;
+
+      case '\r':
+        escaped[1] = 'r';
+        break;
+
+      case '\t':
+        escaped[1] = 't';
+        break;
+
+      default:
+        escaped[1] = 'u';
+        escaped[2] = json__hex[(c >> 12) & 0xf];
+        escaped[3] = json__hex[(c >> 8) & 0xf];
+        escaped[4] = json__hex[(c >> 4) & 0xf];
+        escaped[5] = json__hex[c & 0xf];
+
+        err = json__utf16_encoder_append(enc, escaped, 6);
+        if (err < 0) return err;
+
+        continue;
+      }
+
+      err = json__utf16_encoder_append(enc, escaped, 2);
+      if (err < 0) return err;
+    }
+  }
+
+  err = json__encode_utf16le_ascii("\"", 1, enc);
+  if (err < 0) return err;
+
+  return 0;
+}
+
+static inline int
+json__encode_utf16le_packed_array(const json_array_t *array, json_utf16_encoder_t *enc) {
+  int err;
+
+  err = json__encode_utf16le_ascii("[", 1, enc);
+  if (err < 0) return err;
+
+  for (size_t i = 0, n = array->len; i < n; i++) {
+    if (i) {
+      err = json__encode_utf16le_ascii(",", 1, enc);
+      if (err < 0) return err;
+    }
+
+    char value[32];
+
+    if (array->kind == json_array_doubles) {
+      err = json__encode_utf16le_ascii(value, json__format_double(array->data.doubles[i], value), enc);
+    } else {
+      err = json__encode_utf16le_ascii(value, json__format_int64(array->data.int64s[i], value), enc);
+    }
+
+    if (err < 0) return err;
+  }
+
+  return json__encode_utf16le_ascii("]", 1, enc);
+}
+
+static inline int
+json__encode_utf16le(const json_t *value, json_utf16_encoder_t *enc) {
+  int err;
+
+  json_encoder_frame_t *frame;
+
+value:
+  switch (json_typeof(value)) {
+  case json_null:
+  default:
+    err = json__encode_utf16le_null(enc);
+    break;
+
+  case json_boolean:
+    err = json__encode_utf16le_boolean(json_to(boolean, value), enc);
+    break;
+
+  case json_number:
+    err = json__encode_utf16le_number(value, enc);
+    break;
+
+  case json_string:
+    err = json__encode_utf16le_string(json_to(string, value), enc);
+    break;
+
+  case json_array:
+    if (json_to(array, value)->kind != json_array_values) {
+      err = json__encode_utf16le_packed_array(json_to(array, value), enc);
+      break;
+    }
+
+    err = json__encode_utf16le_ascii("[", 1, enc);
+    if (err < 0) return err;
+
+    err = json__encoder_push(&enc->frames, &enc->depth, &enc->frames_capacity, value);
+    break;
+
+  case json_object:
+    err = json__encode_utf16le_ascii("{", 1, enc);
+    if (err < 0) return err;
+
+    err = json__encoder_push(&enc->frames, &enc->depth, &enc->frames_capacity, value);
+    break;
+  }
+
+  if (err < 0) return err;
+
+  while (enc->depth) {
+    frame = &enc->frames[enc->depth - 1];
+
+    if (json_typeof(frame->value) == json_array) {
+      const json_array_t *arr = json_to(array, frame->value);
+
+      if (frame->index == arr->len) {
+        err = json__encode_utf16le_ascii("]", 1, enc);
+        if (err < 0) return err;
+
+        enc->depth--;
+
+        continue;
+      }
+
+      if (frame->index) {
+        err = json__encode_utf16le_ascii(",", 1, enc);
+        if (err < 0) return err;
+      }
+
+      value = arr->data.values[frame->index++];
+
+      goto value;
+    } else {
+      const json_object_t *obj = json_to(object, frame->value);
+
+      if (frame->index == obj->len) {
+        err = json__encode_utf16le_ascii("}", 1, enc);
+        if (err < 0) return err;
+
+        enc->depth--;
+
+        continue;
+      }
+
+      if (frame->index) {
+        err = json__encode_utf16le_ascii(",", 1, enc);
+        if (err < 0) return err;
+      }
+
+      const json_property_t *property = &obj->properties[frame->index++];
+
+      err = json__encode_utf16le_string(json_to(string, property->key), enc);
+      if (err < 0) return err;
+
+      err = json__encode_utf16le_ascii(":", 1, enc);
+      if (err < 0) return err;
+
+      value = property->value;
+
+      goto value;
+    }
+  }
+
+  return 0;
+}
+
+int
+json_encode_utf16le(const json_t *value, utf16_t **result) {
+  int err;
+
+  json_utf16_encoder_t enc = {
+    .value = NULL,
+    .len = 0,
+    .capacity = 0,
+    .frames = NULL,
+    .depth = 0,
+    .frames_capacity = 0,
+  };
+
+  err = json__encode_utf16le(value, &enc);
+  if (err < 0) goto err;
+
+  free(enc.frames);
+
+  *result = realloc(enc.value, (enc.len + 1) * sizeof(utf16_t));
+
+  return 0;
+
+err:
+  free(enc.frames);
+  free(enc.value);
+
+  return -1;
+}
+
+static inline void
+json__utf8_decoder_skip_whitespace(json_utf8_decoder_t *dec) {
+  while (dec->value < dec->end && isspace(*dec->value)) {
+    dec->value++;
+  }
+}
+
+static inline int
+json__utf8_decoder_scan_number(json_utf8_decoder_t *dec, json_number_token_t *token, bool convert) {
+  const utf8_t *start = dec->value;
+
+  bool negative = false, integral = true;
+
+  if (dec->value < dec->end && *dec->value == '-') {
+    negative = true;
+    dec->value++;
+  }
+
+  const utf8_t *digits = dec->value;
+
+  if (dec->value < dec->end && *dec->value == '0') {
+    dec->value++;
+  } else {
+    while (dec->value < dec->end && isdigit(*dec->value)) {
+      dec->value++;
+    }
+  }
+
+  size_t ndigits = dec->value - digits;
+
+  if (ndigits == 0) return -1;
+
+  if (dec->value < dec->end && *dec->value == '.') {
+    integral = false;
+    dec->value++;
+
+    while (dec->value < dec->end && isdigit(*dec->value)) {
+      dec->value++;
+    }
+  }
+
+  if (dec->value < dec->end && (*dec->value == 'e' || *dec->value == 'E')) {
+    integral = false;
+    dec->value++;
+
+    if (dec->value < dec->end && (*dec->value == '+' || *dec->value == '-')) {
+      dec->value++;
+    }
+
+    while (dec->value < dec->end && isdigit(*dec->value)) {
+      dec->value++;
+    }
+  }
+
+  size_t len = dec->value - start;
+
+  if (len == 0 || len > 64) return -1;
+
+  // Integral tokens are kept exact as long as they fit in 64 bits. Negative
+  // zero has no integer representation and takes the double path.
+  if (integral && ndigits <= 20 && !(negative && *digits == '0')) {
+    uint64_t value = 0;
+
+    bool overflow = false;
+
+    for (size_t i = 0; i < ndigits; i++) {
+      uint64_t digit = digits[i] - '0';
+
+      if (value > (UINT64_MAX - digit) / 10) {
+        overflow = true;
+        break;
+      }
+
+      value = value * 10 + digit;
+    }
+
+    if (!overflow) {
+      if (!negative) {
+        if (value <= INT64_MAX) {
+          token->kind = json_number_int64;
+          token->value.i64 = (int64_t) value;
+        } else {
+          token->kind = json_number_uint64;
+          token->value.u64 = value;
+        }
+
+        return 0;
+      }
+
+      if (value <= (uint64_t) INT64_MAX + 1) {
+        token->kind = json_number_int64;
+        token->value.i64 = value == (uint64_t) INT64_MAX + 1 ? INT64_MIN : -(int64_t) value;
+
+        return 0;
+      }
+    }
+  }
+
+  token->kind = json_number_double;
+
+  if (convert) {
+    char value[65];
+    value[len] = '\0';
+    memcpy(value, start, len);
+
+    token->value.f64 = strtod(value, NULL);
+  }
+
+  return 0;
+}
+
+static inline int
+json__utf8_decoder_number(json_utf8_decoder_t *dec, const json_number_token_t *token, json_t **result) {
+  if (token->kind == json_number_int64 && token->value.i64 >= json__tagged_int_min && token->value.i64 <= json__tagged_int_max) {
+    *result = json__tag_int64(token->value.i64);
+
+    return 0;
+  }
+
+  json_number_t *num = json__number_alloc_in(dec->arena, token->kind);
+
+  if (num == NULL) return -1;
+
+  switch (token->kind) {
+  case json_number_double:
+  default:
+    num->value.f64 = token->value.f64;
+    break;
+
+  case json_number_int64:
+    num->value.i64 = token->value.i64;
+    break;
+
+  case json_number_uint64:
+    num->value.u64 = token->value.u64;
+    break;
+  }
+
+  *result = (json_t *) num;
+
+  return 0;
+}
+
+static inline int
+json__decode_utf8_number(json_utf8_decoder_t *dec, json_t **result) {
+  int err;
+
+  json_number_token_t token;
+  err = json__utf8_decoder_scan_number(dec, &token, result != NULL);
+  if (err < 0) return err;
+
+  if (result == NULL) return 0;
+
+  return json__utf8_decoder_number(dec, &token, result);
+}
+
+static inline int
+json__utf8_decoder_hex(json_utf8_decoder_t *dec, uint32_t *result) {
+  if (dec->end - dec->value < 4) return -1;
+
+  uint32_t code = 0;
+
+  for (int i = 0; i < 4; i++) {
+    utf8_t c = *dec->value++;
+
+    if (c >= '0' && c <= '9') code = code << 4 | (c - '0');
+    else if (c >= 'a' && c <= 'f') code = code << 4 | (c - 'a' + 10);
+    else if (c >= 'A' && c <= 'F') code = code << 4 | (c - 'A' + 10);
+    else return -1;
+  }
+
+  *result = code;
+
+  return 0;
+}
+
+// Decode the escape sequence following a backslash into at most 4 bytes of
+// UTF-8. Surrogates must come in pairs, each written as its own \u escape.
+static inline int
+json__utf8_decoder_escape(json_utf8_decoder_t *dec, utf8_t data[4], size_t *len) {
+  int err;
+
+  if (dec->value >= dec->end) return -1;
+
+  utf8_t e = *dec->value++;
+
+  *len = 1;
+
+  switch (e) {
+  case '\"':
+  case '\\':
+  case '/':
+    data[0] = e;
+    return 0;
+
+  case 'b':
+    data[0] = '\b';
+    return 0;
+
+  case 'f':
+    data[0] = '\f';
+    return 0;
+
+  case 'n':
+    data[0] = '\n';
+    return 0;
+
+  case 'r':
+    data[0] = '\r';
+    return 0;
+
+  case 't':
+    data[0] = '\t';
+    return 0;
+
+  case 'u':
+    break;
+
+  default:
+    return -1;
+  }
+
+  uint32_t code;
+  err = json__utf8_decoder_hex(dec, &code);
+  if (err < 0) return err;
+
+  if (code >= 0xdc00 && code <= 0xdfff) return -1;
+
+  if (code >= 0xd800 && code <= 0xdbff) {
+    if (dec->end - dec->value < 2 || dec->value[0] != '\\' || dec->value[1] != 'u') return -1;
+
+    dec->value += 2;
+
+    uint32_t low;
+    err = json__utf8_decoder_hex(dec, &low);
+    if (err < 0) return err;
+
+    if (low < 0xdc00 || low > 0xdfff) return -1;
+
+    code = 0x10000 + ((code - 0xd800) << 10) + (low - 0xdc00);
+  }
+
+  if (code < 0x80) {
+    data[0] = (utf8_t) code;
+  } else if (code < 0x800) {
+    data[0] = (utf8_t) (0xc0 | code >> 6);
+    data[1] = (utf8_t) (0x80 | (code & 0x3f));
+    *len = 2;
+  } else if (code < 0x10000) {
+    data[0] = (utf8_t) (0xe0 | code >> 12);
+    data[1] = (utf8_t) (0x80 | ((code >> 6) & 0x3f));
+    data[2] = (utf8_t) (0x80 | (code & 0x3f));
+    *len = 3;
+  } else {
+    data[0] = (utf8_t) (0xf0 | code >> 18);
+    data[1] = (utf8_t) (0x80 | ((code >> 12) & 0x3f));
+    data[2] = (utf8_t) (0x80 | ((code >> 6) & 0x3f));
+    data[3] = (utf8_t) (0x80 | (code & 0x3f));
+    *len = 4;
+  }
+
+  return 0;
+}
+
+static inline int
+json__decode_utf8_string(json_utf8_decoder_t *dec, json_t **result) {
+  int err;
+
+  const utf8_t *start = ++dec->value;
+
+  size_t len = 0;
+
+  utf8_t escape[4];
+  size_t n;
+
+  while (true) {
+    if (dec->value >= dec->end) return -1;
+
+    utf8_t c = *dec->value++;
+
+    if (c == '"') break;
+
+    if (c == '\\') {
+      err = json__utf8_decoder_escape(dec, escape, &n);
+      if (err < 0) return err;
+
+      len += n;
+    } else {
+      len++;
+    }
+  }
+
+  if (result == NULL) return 0;
+
+  json_string_t *str = json__string_alloc_in(dec->arena, json_string_utf8, len);
+
+  if (str == NULL) return -1;
+
+  utf8_t *data = json__string_utf8(str);
+
+  dec->value = start;
+
+  size_t i = 0;
+
+  while (true) {
+    utf8_t c = *dec->value++;
+
+    if (c == '"') break;
+
+    if (c == '\\') {
+      json__utf8_decoder_escape(dec, &data[i], &n);
+
+      i += n;
+    } else {
+      data[i++] = c;
+    }
+  }
+
+  *result = (json_t *) str;
+
+  return 0;
+}
+
+static inline int
+json__decode_utf8_scalar(json_utf8_decoder_t *dec, json_t **result) {
+  if (
+    dec->end - dec->value >= 4 &&
+    dec->value[0] == 't' &&
+    dec->value[1] == 'r' &&
+    dec->value[2] == 'u' &&
+    dec->value[3] == 'e'
+  ) {
+    dec->value += 4;
+
+    if (result) *result = (json_t *) &json__true;
+
+    return 0;
+  }
+
+  if (
+    dec->end - dec->value >= 5 &&
+    dec->value[0] == 'f' &&
+    dec->value[1] == 'a' &&
+    dec->value[2] == 'l' &&
+    dec->value[3] == 's' &&
+    dec->value[4] == 'e'
+  ) {
+    dec->value += 5;
+
+    if (result) *result = (json_t *) &json__false;
+
+    return 0;
+  }
+
+  if (
+    dec->end - dec->value >= 4 &&
+    dec->value[0] == 'n' &&
+    dec->value[1] == 'u' &&
+    dec->value[2] == 'l' &&
+    dec->value[3] == 'l'
+  ) {
+    dec->value += 4;
+
+    if (result) *result = (json_t *) &json__null;
+
+    return 0;
+  }
+
+  if (*dec->value == '"') {
+    return json__decode_utf8_string(dec, result);
+  }
+
+  return json__decode_utf8_number(dec, result);
+}
+
+static inline int
+json__utf8_decoder_reserve(json_utf8_decoder_t *dec) {
+  if (dec->len < dec->capacity) return 0;
+
+  size_t capacity = json__storage_grow(dec->capacity, dec->len + 1);
+
+  json_decoder_slot_t *slots = capacity > SIZE_MAX / sizeof(json_decoder_slot_t) ? NULL : realloc(dec->slots, capacity * sizeof(json_decoder_slot_t));
+
+  if (slots == NULL) return -1;
+
+  dec->slots = slots;
+  dec->capacity = capacity;
+
+  return 0;
+}
+
+// Box the raw numbers of a packed array candidate once it turns out to hold
+// other values as well.
+static inline int
+json__utf8_decoder_unpack(json_utf8_decoder_t *dec, json_decoder_frame_t *frame) {
+  int err;
+
+  int kind = frame->kind;
+
+  frame->kind = json_array_values;
+
+  for (size_t i = frame->start, n = dec->len; i < n; i++) {
+    json_decoder_slot_t *slot = &dec->slots[i];
+
+    json_number_token_t token = {.kind = kind == json_array_doubles ? json_number_double : json_number_int64};
+
+    if (kind == json_array_doubles) token.value.f64 = slot->f64;
+    else token.value.i64 = slot->i64;
+
+    err = json__utf8_decoder_number(dec, &token, &slot->value);
+
+    if (err < 0) {
+      dec->len = i; // Drop the numbers that are still raw
+
+      return err;
+    }
+  }
+
+  return 0;
+}
+
+// Takes ownership of the value, which is released if it can't be added.
+static inline int
+json__utf8_decoder_push(json_utf8_decoder_t *dec, json_t *value) {
+  int err;
+
+  if (dec->depth) {
+    json_decoder_frame_t *frame = &dec->frames[dec->depth - 1];
+
+    if (frame->kind != json_array_values) {
+      err = json__utf8_decoder_unpack(dec, frame);
+      if (err < 0) goto err;
+    }
+  }
+
+  err = json__utf8_decoder_reserve(dec);
+  if (err < 0) goto err;
+
+  dec->slots[dec->len++].value = value;
+
+  return 0;
+
+err:
+  json_deref(value);
+
+  return err;
+}
+
+// Integers up to 2^53 survive a round trip through a double.
+#define json__double_exact_max (INT64_C(1) << 53)
+
+// Add a number to a packed array candidate, which stays packed as long as it
+// holds only doubles and exactly convertible integers, or only int64 values.
+static inline int
+json__utf8_decoder_push_number(json_utf8_decoder_t *dec, json_decoder_frame_t *frame, const json_number_token_t *token) {
+  int err;
+
+  switch (token->kind) {
+  case json_number_double:
+    if (frame->kind == json_array_int64s) {
+      if (!frame->exact) break;
+
+      for (size_t i = frame->start, n = dec->len; i < n; i++) {
+        dec->slots[i].f64 = (double) dec->slots[i].i64;
+      }
+
+      frame->kind = json_array_doubles;
+    }
+
+    err = json__utf8_decoder_reserve(dec);
+    if (err < 0) return err;
+
+    dec->slots[dec->len++].f64 = token->value.f64;
+
+    return 0;
+
+  case json_number_int64: {
+    bool exact = token->value.i64 >= -json__double_exact_max && token->value.i64 <= json__double_exact_max;
+
+    if (frame->kind == json_array_doubles && !exact) break;
+
+    err = json__utf8_decoder_reserve(dec);
+    if (err < 0) return err;
+
+    if (frame->kind == json_array_doubles) {
+      dec->slots[dec->len++].f64 = (double) token->value.i64;
+    } else {
+      if (!exact) frame->exact = false;
+
+      dec->slots[dec->len++].i64 = token->value.i64;
+    }
+
+    return 0;
+  }
+
+  case json_number_uint64:
+  default:
+    break;
+  }
+
+  json_t *value;
+  err = json__utf8_decoder_number(dec, token, &value);
+  if (err < 0) return err;
+
+  return json__utf8_decoder_push(dec, value);
+}
+
+static inline int
+json__utf8_decoder_open(json_utf8_decoder_t *dec, json_type_t type) {
+  if (dec->max_depth && dec->depth == dec->max_depth) return -1;
+
+  if (dec->depth == dec->frames_capacity) {
+    size_t capacity = json__storage_grow(dec->frames_capacity, dec->depth + 1);
+
+    json_decoder_frame_t *frames = capacity > SIZE_MAX / sizeof(json_decoder_frame_t) ? NULL : realloc(dec->frames, capacity * sizeof(json_decoder_frame_t));
+
+    if (frames == NULL) return -1;
+
+    dec->frames = frames;
+    dec->frames_capacity = capacity;
+  }
+
+  dec->frames[dec->depth++] = (json_decoder_frame_t) {
+    .type = type,
+    .kind = type == json_array ? json_array_int64s : json_array_values,
+    .exact = true,
+    .start = dec->len,
+    .projection = 0,
+    .index = 0,
+  };
+
+  return 0;
+}
+
+static inline int
+json__utf8_decoder_close(json_utf8_decoder_t *dec) {
+  json_decoder_frame_t *frame = &dec->frames[dec->depth - 1];
+
+  json_decoder_slot_t *slots = &dec->slots[frame->start];
+
+  size_t len = dec->len - frame->start;
+
+  json_t *value;
+
+  if (frame->type == json_array) {
+    int kind = len ? frame->kind : json_array_values;
+
+    json_array_t *arr = json__array_alloc_in(dec->arena, kind, len);
+
+    if (arr == NULL) return -1;
+
+    switch (kind) {
+    case json_array_values:
+    default:
+      for (size_t i = 0; i < len; i++) arr->data.values[i] = slots[i].value;
+      break;
+
+    case json_array_doubles:
+      for (size_t i = 0; i < len; i++) arr->data.doubles[i] = slots[i].f64;
+      break;
+
+    case json_array_int64s:
+      for (size_t i = 0; i < len; i++) arr->data.int64s[i] = slots[i].i64;
+      break;
+    }
+
+    value = (json_t *) arr;
+  } else {
+    len /= 2;
+
+    json_object_t *obj = json__object_alloc_in(dec->arena, len);
+
+    if (obj == NULL) return -1;
+
+    for (size_t i = 0; i < len; i++) {
+      obj->properties[i].key = slots[i * 2].value;
+      obj->properties[i].value = slots[i * 2 + 1].value;
+    }
+
+    obj->len = len;
+
+    value = (json_t *) obj;
+  }
+
+  dec->len = frame->start;
+  dec->depth--;
+
+  return json__utf8_decoder_push(dec, value);
+}
+
+static inline int
+json__utf8_decoder_key(json_utf8_decoder_t *dec) {
+  int err;
+
+  json__utf8_decoder_skip_whitespace(dec);
+
+  if (dec->value >= dec->end || *dec->value != '"') return -1;
+
+  json_t *key;
+  err = json__decode_utf8_string(dec, &key);
+  if (err < 0) return err;
+
+  err = json__utf8_decoder_push(dec, key);
+  if (err < 0) return err;
+
+  json__utf8_decoder_skip_whitespace(dec);
+
+  if (dec->value >= dec->end || *dec->value != ':') return -1;
+
+  dec->value++;
+
+  return 0;
+}
+
+static inline void
+json__utf8_decoder_destroy(json_utf8_decoder_t *dec) {
+  size_t end = dec->len;
+
+  for (size_t i = dec->depth; i-- > 0;) {
+    json_decoder_frame_t *frame = &dec->frames[i];
+
+    if (frame->kind == json_array_values) {
+      for (size_t j = frame->start; j < end; j++) json_deref(dec->slots[j].value);
+    }
+
+    end = frame->start;
+  }
+
+  for (size_t j = 0; j < end; j++) json_deref(dec->slots[j].value);
+
+  free(dec->slots);
+  free(dec->frames);
+}
+
+// Decode a single value into the container currently open, if any.
+static inline int
+json__decode_utf8(json_utf8_decoder_t *dec) {
+  int err;
+
+  size_t depth = dec->depth;
+
+  json_decoder_frame_t *frame;
+
+  utf8_t c;
+
+value:
+  json__utf8_decoder_skip_whitespace(dec);
+
+  if (dec->value >= dec->end) return -1;
+
+  c = *dec->value;
+
+  if (c == '[' || c == '{') {
+    dec->value++;
+
+    err = json__utf8_decoder_open(dec, c == '[' ? json_array : json_object);
+    if (err < 0) return err;
+
+    json__utf8_decoder_skip_whitespace(dec);
+
+    if (dec->value >= dec->end) return -1;
+
+    if (*dec->value == (c == '[' ? ']' : '}')) {
+      dec->value++;
+
+      goto close;
+    }
+
+    if (c == '{') {
+      err = json__utf8_decoder_key(dec);
+      if (err < 0) return err;
+    }
+
+    goto value;
+  }
+
+  frame = dec->depth ? &dec->frames[dec->depth - 1] : NULL;
+
+  if (frame && frame->kind != json_array_values && (c == '-' || isdigit(c))) {
+    json_number_token_t token;
+    err = json__utf8_decoder_scan_number(dec, &token, true);
+    if (err < 0) return err;
+
+    err = json__utf8_decoder_push_number(dec, frame, &token);
+    if (err < 0) return err;
+  } else {
+    json_t *value;
+    err = json__decode_utf8_scalar(dec, &value);
+    if (err < 0) return err;
+
+    err = json__utf8_decoder_push(dec, value);
+    if (err < 0) return err;
+  }
+
+  goto next;
+
+close:
+  err = json__utf8_decoder_close(dec);
+  if (err < 0) return err;
+
+next:
+  if (dec->depth == depth) return 0;
+
+  json__utf8_decoder_skip_whitespace(dec);
+
+  if (dec->value >= dec->end) return -1;
+
+  c = *dec->value++;
+
+  frame = &dec->frames[dec->depth - 1];
+
+  if (c == ',') {
+    if (frame->type == json_object) {
+      err = json__utf8_decoder_key(dec);
+      if (err < 0) return err;
+    }
+
+    goto value;
+  }
+
+  if (c == (frame->type == json_array ? ']' : '}')) goto close;
+
+  return -1;
+}
+
+static inline int
+json__utf8_decoder_skip(json_utf8_decoder_t *dec);
+
+static inline int
+json__utf8_decoder_skip_key(json_utf8_decoder_t *dec);
+
+static inline int
+json__utf8_decoder_match_key(json_utf8_decoder_t *dec, const utf8_t *key, size_t len, bool *result);
+
+// Decode only the values selected by a set of pointers, along with the
+// containers leading up to them. Everything else is skipped over without
+// being built.
+static inline int
+json__decode_utf8_projected(json_utf8_decoder_t *dec, size_t len) {
+  int err;
+
+  json_decoder_frame_t *frame;
+
+  uint64_t projection = len == 64 ? UINT64_MAX : (UINT64_C(1) << len) - 1;
+
+  for (size_t i = 0; i < len; i++) {
+    if (dec->projection[i]->len == 0) return json__decode_utf8(dec);
+  }
+
+  json__utf8_decoder_skip_whitespace(dec);
+
+  if (dec->value >= dec->end) return -1;
+
+  utf8_t c = *dec->value;
+
+  if (c != '[' && c != '{') return json__decode_utf8(dec);
+
+open:
+  dec->value++;
+
+  err = json__utf8_decoder_open(dec, c == '[' ? json_array : json_object);
+  if (err < 0) return err;
+
+  dec->frames[dec->depth - 1].projection = projection;
+
+  json__utf8_decoder_skip_whitespace(dec);
+
+  if (dec->value >= dec->end) return -1;
+
+  if (*dec->value == (c == '[' ? ']' : '}')) {
+    dec->value++;
+
+    goto close;
+  }
+
+element:
+  frame = &dec->frames[dec->depth - 1];
+
+  size_t segment = dec->depth - 1;
+
+  projection = 0;
+
+  uint64_t complete = 0;
+
+  json_t *key = NULL;
+
+  if (frame->type == json_object) {
+    json__utf8_decoder_skip_whitespace(dec);
+
+    const utf8_t *start = dec->value;
+
+    if (start >= dec->end || *start != '"') return -1;
+
+    // Keys without escapes, which is nearly all of them, are compared in
+    // place in a single pass.
+    const utf8_t *raw = start + 1, *end = raw;
+
+    while (end < dec->end && *end != '"' && *end != '\\') end++;
+
+    bool escaped = end >= dec->end || *end == '\\';
+
+    for (size_t i = 0; i < len; i++) {
+      if ((frame->projection & (UINT64_C(1) << i)) == 0) continue;
+
+      const json_pointer_segment_t *s = &dec->projection[i]->segments[segment];
+
+      bool match;
+
+      if (escaped) {
+        dec->value = start;
+
+        err = json__utf8_decoder_match_key(dec, s->key, s->len, &match);
+        if (err < 0) return err;
+      } else {
+        match = s->len == (size_t) (end - raw) && memcmp(s->key, raw, s->len) == 0;
+      }
+
+      if (match) projection |= UINT64_C(1) << i;
+    }
+
+    dec->value = start;
+
+    if (projection) {
+      err = json__decode_utf8_string(dec, &key);
+      if (err < 0) return err;
+
+      json__utf8_decoder_skip_whitespace(dec);
+
+      if (dec->value >= dec->end || *dec->value != ':') goto err;
+
+      dec->value++;
+    } else {
+      err = json__utf8_decoder_skip_key(dec);
+      if (err < 0) return err;
+    }
+  } else {
+    for (size_t i = 0; i < len; i++) {
+      if ((frame->projection & (UINT64_C(1) << i)) == 0) continue;
+
+      if (dec->projection[i]->segments[segment].index == frame->index) projection |= UINT64_C(1) << i;
+    }
+  }
+
+  for (size_t i = 0; i < len; i++) {
+    if ((projection & (UINT64_C(1) << i)) && dec->projection[i]->len == segment + 1) complete |= UINT64_C(1) << i;
+  }
+
+  json__utf8_decoder_skip_whitespace(dec);
+
+  if (dec->value >= dec->end) goto err;
+
+  c = *dec->value;
+
+  if (projection == 0 || (complete == 0 && c != '[' && c != '{')) {
+    if (key) json_deref(key);
+
+    err = json__utf8_decoder_skip(dec);
+    if (err < 0) return err;
+
+    goto next;
+  }
+
+  if (key) {
+    err = json__utf8_decoder_push(dec, key);
+    if (err < 0) return err;
+  }
+
+  if (complete == 0) goto open;
+
+  err = json__decode_utf8(dec);
+  if (err < 0) return err;
+
+  goto next;
+
+close:
+  err = json__utf8_decoder_close(dec);
+  if (err < 0) return err;
+
+next:
+  if (dec->depth == 0) return 0;
+
+  json__utf8_decoder_skip_whitespace(dec);
+
+  if (dec->value >= dec->end) return -1;
+
+  c = *dec->value++;
+
+  frame = &dec->frames[dec->depth - 1];
+
+  frame->index++;
+
+  if (c == ',') goto element;
+
+  if (c == (frame->type == json_array ? ']' : '}')) goto close;
+
+  return -1;
+
+err:
+  if (key) json_deref(key);
+
+  return -1;
+}
+
+int
+json_decode_utf8(const utf8_t *buffer, size_t len, json_t **result) {
+  return json_decode_utf8_with_options(buffer, len, NULL, result);
+}
+
+int
+json_decode_utf8_with_options(const utf8_t *buffer, size_t len, const json_decode_options_t *options, json_t **result) {
+  int err;
+
+  if (len == (size_t) -1) len = strlen((char *) buffer);
+
+  json_utf8_decoder_t dec = {
+    .value = buffer,
+    .start = buffer,
+    .end = buffer + len,
+    .slots = NULL,
+    .len = 0,
+    .capacity = 0,
+    .frames = NULL,
+    .depth = 0,
+    .frames_capacity = 0,
+    .max_depth = options ? options->max_depth : 0,
+    .projection = options ? options->projection : NULL,
+    .arena = NULL,
+  };
+
+  size_t projection_len = options ? options->projection_len : 0;
+
+  if (projection_len > 64) return -1;
+
+  if (projection_len) {
+    err = json__decode_utf8_projected(&dec, projection_len);
+  } else {
+    err = json__decode_utf8(&dec);
+  }
+
+  if (err < 0 || dec.value != dec.end) {
+    json__utf8_decoder_destroy(&dec);
+
+    return -1;
+  }
+
+  *result = dec.slots[0].value;
+
+  free(dec.slots);
+  free(dec.frames);
+
+  return 0;
+}
+
+int
+json_decode_file_utf8(const char *path, const json_decode_options_t *options, json_t **result) {
+  int err;
+
+  const utf8_t *buffer;
+  size_t len;
+
+#ifdef _WIN32
+  HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+
+  if (file == INVALID_HANDLE_VALUE) return -1;
+
+  LARGE_INTEGER size;
+
+  if (!GetFileSizeEx(file, &size) || size.QuadPart == 0 || (uint64_t) size.QuadPart > SIZE_MAX) {
+    CloseHandle(file);
+
+    return -1;
+  }
+
+  len = (size_t) size.QuadPart;
+
+  HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_READONLY, 0, 0, NULL);
+
+  CloseHandle(file);
+
+  if (mapping == NULL) return -1;
+
+  buffer = MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, len);
+
+  CloseHandle(mapping);
+
+  if (buffer == NULL) return -1;
+#else
+  int fd = open(path, O_RDONLY);
+
+  if (fd < 0) return -1;
+
+  struct stat st;
+
+  if (fstat(fd, &st) < 0 || st.st_size == 0 || (uint64_t) st.st_size > SIZE_MAX) {
+    close(fd);
+
+    return -1;
+  }
+
+  len = (size_t) st.st_size;
+
+  void *mapping = mmap(NULL, len, PROT_READ, MAP_PRIVATE, fd, 0);
+
+  close(fd);
+
+  if (mapping == MAP_FAILED) return -1;
+
+  buffer = mapping;
+
+  // The document is read front to back exactly once, so ask for aggressive
+  // read ahead. This at most makes pages that have been read cheaper to
+  // reclaim under memory pressure; nothing is released before the mapping is.
+  // Hints that aren't supported are ignored.
+  madvise(mapping, len, MADV_SEQUENTIAL);
+  madvise(mapping, len, MADV_WILLNEED);
+
+#ifdef MADV_HUGEPAGE
+  madvise(mapping, len, MADV_HUGEPAGE);
+#endif
+#endif
+
+  // Files usually end in a newline, which isn't part of the document.
+  size_t trimmed = len;
+
+  while (trimmed > 0 && isspace(buffer[trimmed - 1])) trimmed--;
+
+  err = json_decode_utf8_with_options(buffer, trimmed, options, result);
+
+#ifdef _WIN32
+  UnmapViewOfFile(buffer);
+#else
+  munmap((void *) buffer, len);
+#endif
+
+  return err;
+}
+
+int
+json_decode_utf16le(const utf16_t *buffer, size_t len, json_t **result) {
+  return -1;
+}
+
+// Each worker of a lines decoder decodes a contiguous run of lines into an
+// arena of its own, keeping the decoder scratch space between lines.
+struct json_lines_worker_s {
+  json_utf8_decoder_t dec;
+  json_arena_t arena;
+
+  const utf8_t *start;
+  const utf8_t *end;
+
+  // Records decoded so far when running on a thread of its own, in order.
+  json_t **records;
+  size_t len;
+  size_t capacity;
+
+  int err;
+
+  json__thread_t thread;
+};
+
+struct json_lines_decoder_s {
+  json_lines_worker_t *workers;
+  size_t threads;
 };
 
-int
-json_create_boolean(bool value, json_t **result) {
-  *result = value ? (json_t *) &json__true : (json_t *) &json__false;
+static inline int
+json__lines_worker_append(json_lines_worker_t *worker, json_t *record) {
+  if (worker->len == worker->capacity) {
+    size_t capacity = json__storage_grow(worker->capacity, worker->len + 1);
+
+    json_t **records = capacity > SIZE_MAX / sizeof(json_t *) ? NULL : realloc(worker->records, capacity * sizeof(json_t *));
+
+    if (records == NULL) return -1;
+
+    worker->records = records;
+    worker->capacity = capacity;
+  }
+
+  worker->records[worker->len++] = record;
+
+  return 0;
+}
+
+// Decode the next non-blank line of the worker, setting the record to NULL
+// once there are none left.
+static inline int
+json__lines_worker_next(json_lines_worker_t *worker, json_t **result) {
+  int err;
+
+  json_utf8_decoder_t *dec = &worker->dec;
+
+  while (worker->start < worker->end) {
+    const utf8_t *start = worker->start;
+
+    // Line boundaries are found with memchr(), which is vectorized by the C
+    // library on every platform that matters.
+    const utf8_t *end = memchr(start, '\n', worker->end - start);
+
+    if (end == NULL) end = worker->end;
+
+    worker->start = end < worker->end ? end + 1 : end;
+
+    while (start < end && isspace(*start)) start++;
+    while (end > start && isspace(end[-1])) end--;
+
+    if (start == end) continue;
+
+    dec->value = dec->start = start;
+    dec->end = end;
+    dec->len = 0;
+    dec->depth = 0;
+
+    // Nodes live in the arena, so a failed line leaves nothing to release.
+    err = json__decode_utf8(dec);
+    if (err < 0 || dec->value != dec->end) return -1;
+
+    *result = dec->slots[0].value;
+
+    return 0;
+  }
+
+  *result = NULL;
+
+  return 0;
+}
+
+static inline void
+json__lines_worker_decode(json_lines_worker_t *worker) {
+  json_t *record;
+
+  while ((worker->err = json__lines_worker_next(worker, &record)) == 0 && record) {
+    worker->err = json__lines_worker_append(worker, record);
+
+    if (worker->err < 0) break;
+  }
+}
+
+#ifdef _WIN32
+static DWORD WINAPI
+json__lines_worker_run(LPVOID data) {
+#else
+static void *
+json__lines_worker_run(void *data) {
+#endif
+  json__lines_worker_decode(data);
+
+  return 0;
+}
+
+int
+json_create_lines_decoder(size_t threads, json_lines_decoder_t **result) {
+  if (threads == 0) threads = 1;
+
+  json_lines_decoder_t *decoder = malloc(sizeof(json_lines_decoder_t));
+
+  if (decoder == NULL) return -1;
+
+  decoder->workers = threads > SIZE_MAX / sizeof(json_lines_worker_t) ? NULL : malloc(threads * sizeof(json_lines_worker_t));
+
+  if (decoder->workers == NULL) {
+    free(decoder);
+
+    return -1;
+  }
+
+  decoder->threads = threads;
+
+  for (size_t i = 0; i < threads; i++) {
+    decoder->workers[i] = (json_lines_worker_t) {
+      .dec = {
+        .value = NULL,
+        .start = NULL,
+        .end = NULL,
+        .slots = NULL,
+        .len = 0,
+        .capacity = 0,
+        .frames = NULL,
+        .depth = 0,
+        .frames_capacity = 0,
+        .max_depth = 0,
+        .projection = NULL,
+        .arena = &decoder->workers[i].arena,
+      },
+      .arena = {
+        .head = NULL,
+        .current = NULL,
+      },
+      .start = NULL,
+      .end = NULL,
+      .records = NULL,
+      .len = 0,
+      .capacity = 0,
+      .err = 0,
+    };
+  }
+
+  *result = decoder;
+
+  return 0;
+}
+
+void
+json_destroy_lines_decoder(json_lines_decoder_t *decoder) {
+  for (size_t i = 0; i < decoder->threads; i++) {
+    json_lines_worker_t *worker = &decoder->workers[i];
+
+    json__arena_destroy(&worker->arena);
+
+    free(worker->dec.slots);
+    free(worker->dec.frames);
+    free(worker->records);
+  }
+
+  free(decoder->workers);
+  free(decoder);
+}
+
+// Batches are only split across threads in runs of at least this many bytes.
+#define json__lines_min_run 65536
+
+int
+json_lines_decoder_decode_utf8(json_lines_decoder_t *decoder, const utf8_t *buffer, size_t len, json_lines_cb cb, void *data) {
+  int err;
+
+  if (len == (size_t) -1) len = strlen((char *) buffer);
+
+  const utf8_t *end = buffer + len;
+
+  size_t threads = len / json__lines_min_run + 1;
+
+  if (threads > decoder->threads) threads = decoder->threads;
+
+  for (size_t i = 0; i < decoder->threads; i++) {
+    json_lines_worker_t *worker = &decoder->workers[i];
+
+    json__arena_reset(&worker->arena);
+
+    worker->start = worker->end = end;
+    worker->len = 0;
+    worker->err = 0;
+  }
+
+  size_t index = 0;
+
+  // A single worker hands over each record as soon as it is decoded.
+  if (threads == 1) {
+    json_lines_worker_t *worker = &decoder->workers[0];
+
+    worker->start = buffer;
+
+    json_t *record;
+
+    while ((err = json__lines_worker_next(worker, &record)) == 0 && record) {
+      err = cb(record, index++, data);
+      if (err != 0) return err;
+    }
+
+    return err;
+  }
+
+  // Split the batch into runs of about the same size, ending each at a line
+  // boundary.
+  const utf8_t *start = buffer;
+
+  for (size_t i = 0; i < threads; i++) {
+    json_lines_worker_t *worker = &decoder->workers[i];
+
+    const utf8_t *split = i == threads - 1 ? end : buffer + len / threads * (i + 1);
+
+    if (split < start) split = start;
+
+    const utf8_t *newline = memchr(split, '\n', end - split);
+
+    worker->start = start;
+    worker->end = start = newline ? newline + 1 : end;
+  }
+
+  size_t started = 1;
+
+  for (size_t i = 1; i < threads; i++, started++) {
+    json_lines_worker_t *worker = &decoder->workers[i];
+
+#ifdef _WIN32
+    worker->thread = CreateThread(NULL, 0, json__lines_worker_run, worker, 0, NULL);
+
+    if (worker->thread == NULL) break;
+#else
+    if (pthread_create(&worker->thread, NULL, json__lines_worker_run, worker) != 0) break;
+#endif
+  }
+
+  // Runs that didn't get a thread of their own are decoded on this one.
+  for (size_t i = started; i < threads; i++) {
+    json__lines_worker_decode(&decoder->workers[i]);
+  }
+
+  json__lines_worker_decode(&decoder->workers[0]);
+
+  for (size_t i = 1; i < started; i++) {
+#ifdef _WIN32
+    WaitForSingleObject(decoder->workers[i].thread, INFINITE);
+    CloseHandle(decoder->workers[i].thread);
+#else
+    pthread_join(decoder->workers[i].thread, NULL);
+#endif
+  }
+
+  // Hand over the records in order, up to the first line that failed.
+  for (size_t i = 0; i < threads; i++) {
+    json_lines_worker_t *worker = &decoder->workers[i];
+
+    for (size_t j = 0; j < worker->len; j++) {
+      err = cb(worker->records[j], index++, data);
+      if (err != 0) return err;
+    }
+
+    if (worker->err < 0) return worker->err;
+  }
+
+  return 0;
+}
+
+static inline int
+json__cbor_encoder_reserve(json_cbor_encoder_t *enc, size_t len) {
+  if (enc->len + len <= enc->capacity) return 0;
+
+  size_t capacity = json__storage_grow(enc->capacity, enc->len + len);
+
+  uint8_t *value = realloc(enc->value, capacity);
+
+  if (value == NULL) return -1;
+
+  enc->value = value;
+  enc->capacity = capacity;
+
+  return 0;
+}
+
+// Write the initial byte of an item along with its argument, using the
+// shortest encoding of the argument.
+static inline int
+json__encode_cbor_head(json_cbor_encoder_t *enc, uint8_t major, uint64_t arg) {
+  int err;
+
+  err = json__cbor_encoder_reserve(enc, 9);
+  if (err < 0) return err;
+
+  uint8_t *value = &enc->value[enc->len];
+
+  size_t n;
+
+  if (arg < 24) {
+    value[0] = (major << 5) | (uint8_t) arg;
+
+    enc->len += 1;
+
+    return 0;
+  }
+
+  if (arg <= UINT8_MAX) n = 1, value[0] = (major << 5) | 24;
+  else if (arg <= UINT16_MAX) n = 2, value[0] = (major << 5) | 25;
+  else if (arg <= UINT32_MAX) n = 4, value[0] = (major << 5) | 26;
+  else n = 8, value[0] = (major << 5) | 27;
+
+  for (size_t i = 0; i < n; i++) {
+    value[n - i] = (uint8_t) (arg >> (i * 8));
+  }
+
+  enc->len += n + 1;
+
+  return 0;
+}
+
+static inline int
+json__encode_cbor_int64(json_cbor_encoder_t *enc, int64_t value) {
+  if (value >= 0) return json__encode_cbor_head(enc, 0, (uint64_t) value);
+
+  return json__encode_cbor_head(enc, 1, (uint64_t) -(value + 1));
+}
+
+// Find the half precision float that represents a single precision float
+// exactly, if any.
+static inline bool
+json__cbor_half(float value, uint16_t *result) {
+  uint32_t bits;
+  memcpy(&bits, &value, sizeof(bits));
+
+  uint16_t sign = (bits >> 16) & 0x8000;
+
+  int exponent = (bits >> 23) & 0xff;
+
+  uint32_t mantissa = bits & 0x7fffff;
+
+  if (exponent == 0xff) {
+    *result = sign | 0x7c00 | (mantissa ? 0x200 : 0);
+
+    return mantissa == 0 || value != value;
+  }
+
+  if (exponent == 0) {
+    if (mantissa) return false;
+
+    *result = sign;
+
+    return true;
+  }
+
+  exponent -= 127;
+
+  if (exponent > 15 || exponent < -24) return false;
+
+  if (exponent >= -14) {
+    if (mantissa & 0x1fff) return false;
+
+    *result = sign | (uint16_t) ((exponent + 15) << 10) | (uint16_t) (mantissa >> 13);
+
+    return true;
+  }
+
+  // Subnormal halves have no implicit leading bit.
+  mantissa |= 0x800000;
+
+  int shift = 13 + (-14 - exponent);
+
+  if (mantissa & ((1u << shift) - 1)) return false;
+
+  *result = sign | (uint16_t) (mantissa >> shift);
+
+  return true;
+}
+
+// Doubles are written in the narrowest width that holds them exactly.
+static inline int
+json__encode_cbor_double(json_cbor_encoder_t *enc, double value) {
+  int err;
+
+  float f = (float) value;
+
+  uint16_t half;
+
+  if (value != value) {
+    half = 0x7e00;
+  } else if ((double) f != value || !json__cbor_half(f, &half)) {
+    err = json__cbor_encoder_reserve(enc, 9);
+    if (err < 0) return err;
+
+    uint8_t *result = &enc->value[enc->len];
+
+    uint64_t bits;
+    size_t n;
+
+    if ((double) f == value) {
+      uint32_t single;
+      memcpy(&single, &f, sizeof(single));
+
+      bits = single;
+      n = 4;
+      result[0] = 0xfa;
+    } else {
+      memcpy(&bits, &value, sizeof(bits));
+
+      n = 8;
+      result[0] = 0xfb;
+    }
+
+    for (size_t i = 0; i < n; i++) {
+      result[n - i] = (uint8_t) (bits >> (i * 8));
+    }
+
+    enc->len += n + 1;
+
+    return 0;
+  }
+
+  err = json__cbor_encoder_reserve(enc, 3);
+  if (err < 0) return err;
+
+  enc->value[enc->len++] = 0xf9;
+  enc->value[enc->len++] = (uint8_t) (half >> 8);
+  enc->value[enc->len++] = (uint8_t) half;
+
+  return 0;
+}
+
+static inline int
+json__encode_cbor_number(json_cbor_encoder_t *enc, const json_t *number) {
+  switch (json__number_kind(number)) {
+  case json_number_double:
+  default:
+    return json__encode_cbor_double(enc, json__number_f64(number));
+
+  case json_number_int64:
+    return json__encode_cbor_int64(enc, json__number_i64(number));
+
+  case json_number_uint64:
+    return json__encode_cbor_head(enc, 0, json__number_u64(number));
+  }
+}
+
+static inline int
+json__encode_cbor_string(json_cbor_encoder_t *enc, const json_string_t *string) {
+  int err;
+
+  if (string->encoding != json_string_utf8) return -1;
+
+  err = json__encode_cbor_head(enc, 3, string->len);
+  if (err < 0) return err;
+
+  err = json__cbor_encoder_reserve(enc, string->len);
+  if (err < 0) return err;
+
+  memcpy(&enc->value[enc->len], json__string_utf8(string), string->len);
+
+  enc->len += string->len;
+
+  return 0;
+}
+
+static inline int
+json__encode_cbor_packed_array(json_cbor_encoder_t *enc, const json_array_t *array) {
+  int err;
+
+  for (size_t i = 0, n = array->len; i < n; i++) {
+    if (array->kind == json_array_doubles) {
+      err = json__encode_cbor_double(enc, array->data.doubles[i]);
+    } else {
+      err = json__encode_cbor_int64(enc, array->data.int64s[i]);
+    }
+
+    if (err < 0) return err;
+  }
+
+  return 0;
+}
+
+static inline int
+json__encode_cbor(const json_t *value, json_cbor_encoder_t *enc) {
+  int err;
+
+  json_encoder_frame_t *frame;
+
+value:
+  switch (json_typeof(value)) {
+  case json_null:
+  default:
+    err = json__encode_cbor_head(enc, 7, 22);
+    break;
+
+  case json_boolean:
+    err = json__encode_cbor_head(enc, 7, json_to(boolean, value)->value ? 21 : 20);
+    break;
+
+  case json_number:
+    err = json__encode_cbor_number(enc, value);
+    break;
+
+  case json_string:
+    err = json__encode_cbor_string(enc, json_to(string, value));
+    break;
+
+  case json_array:
+    err = json__encode_cbor_head(enc, 4, json_to(array, value)->len);
+    if (err < 0) return err;
+
+    if (json_to(array, value)->kind != json_array_values) {
+      err = json__encode_cbor_packed_array(enc, json_to(array, value));
+      break;
+    }
+
+    err = json__encoder_push(&enc->frames, &enc->depth, &enc->frames_capacity, value);
+    break;
+
+  case json_object:
+    err = json__encode_cbor_head(enc, 5, json_to(object, value)->len);
+    if (err < 0) return err;
+
+    err = json__encoder_push(&enc->frames, &enc->depth, &enc->frames_capacity, value);
+    break;
+  }
+
+  if (err < 0) return err;
+
+  while (enc->depth) {
+    frame = &enc->frames[enc->depth - 1];
+
+    if (json_typeof(frame->value) == json_array) {
+      const json_array_t *arr = json_to(array, frame->value);
+
+      if (frame->index == arr->len) {
+        enc->depth--;
+
+        continue;
+      }
+
+      value = arr->data.values[frame->index++];
+
+      goto value;
+    } else {
+      const json_object_t *obj = json_to(object, frame->value);
+
+      if (frame->index == obj->len) {
+        enc->depth--;
+
+        continue;
+      }
+
+      const json_property_t *property = &obj->properties[frame->index++];
+
+      err = json__encode_cbor_string(enc, json_to(string, property->key));
+      if (err < 0) return err;
+
+      value = property->value;
+
+      goto value;
+    }
+  }
+
+  return 0;
+}
+
+int
+json_encode_cbor(const json_t *value, uint8_t **result, size_t *len) {
+  int err;
+
+  json_cbor_encoder_t enc = {
+    .value = NULL,
+    .len = 0,
+    .capacity = 0,
+    .frames = NULL,
+    .depth = 0,
+    .frames_capacity = 0,
+  };
+
+  err = json__encode_cbor(value, &enc);
+  if (err < 0) goto err;
+
+  free(enc.frames);
+
+  *result = realloc(enc.value, enc.len);
+  *len = enc.len;
+
+  return 0;
+
+err:
+  free(enc.frames);
+  free(enc.value);
+
+  return -1;
+}
+
+static inline int
+json__cbor_decoder_head(json_cbor_decoder_t *dec, uint8_t *major, uint64_t *arg) {
+  if (dec->value >= dec->end) return -1;
+
+  uint8_t initial = *dec->value++;
+
+  *major = initial >> 5;
+
+  uint8_t info = initial & 0x1f;
+
+  if (info < 24) {
+    *arg = info;
+
+    return 0;
+  }
+
+  // Indefinite lengths and the reserved values aren't supported.
+  if (info > 27) return -1;
+
+  size_t n = (size_t) 1 << (info - 24);
+
+  if ((size_t) (dec->end - dec->value) < n) return -1;
+
+  *arg = 0;
+
+  for (size_t i = 0; i < n; i++) {
+    *arg = (*arg << 8) | dec->value[i];
+  }
+
+  dec->value += n;
+
+  return 0;
+}
+
+static inline double
+json__cbor_half_value(uint16_t half) {
+  uint32_t sign = (uint32_t) (half & 0x8000) << 16;
+
+  uint32_t exponent = (half >> 10) & 0x1f;
+
+  uint32_t mantissa = half & 0x3ff;
+
+  if (exponent == 0) {
+    float value = (float) mantissa / 16777216.0f;
+
+    return sign ? -value : value;
+  }
+
+  uint32_t bits = sign | (exponent == 31 ? 0xff : exponent - 15 + 127) << 23 | mantissa << 13;
+
+  float value;
+  memcpy(&value, &bits, sizeof(value));
+
+  return value;
+}
+
+static inline int
+json__cbor_decoder_open(json_cbor_decoder_t *dec, json_t *value, size_t len) {
+  if (dec->depth == dec->frames_capacity) {
+    size_t capacity = json__storage_grow(dec->frames_capacity, dec->depth + 1);
+
+    json_cbor_frame_t *frames = capacity > SIZE_MAX / sizeof(json_cbor_frame_t) ? NULL : realloc(dec->frames, capacity * sizeof(json_cbor_frame_t));
+
+    if (frames == NULL) return -1;
+
+    dec->frames = frames;
+    dec->frames_capacity = capacity;
+  }
+
+  dec->frames[dec->depth++] = (json_cbor_frame_t) {
+    .value = value,
+    .len = len,
+    .key = true,
+  };
+
+  return 0;
+}
+
+// Containers start out with room for this many items, or their length if
+// shorter.
+#define json__cbor_initial_capacity 16
+
+// Make room for one more item in the container currently open.
+static inline int
+json__cbor_decoder_grow(json_cbor_frame_t *frame) {
+  size_t capacity;
+
+  if (json_typeof(frame->value) == json_array) {
+    json_array_t *arr = json_to(array, frame->value);
+
+    if (arr->len < arr->capacity) return 0;
+
+    capacity = json__storage_grow(arr->capacity, arr->len + 1);
+
+    return json__array_reserve(arr, capacity < frame->len ? capacity : frame->len);
+  }
+
+  json_object_t *obj = json_to(object, frame->value);
+
+  if (obj->len < obj->capacity) return 0;
+
+  capacity = json__storage_grow(obj->capacity, obj->len + 1);
+
+  return json__object_reserve(obj, capacity < frame->len ? capacity : frame->len);
+}
+
+// Store a value in the container currently open, handing over the reference.
+static inline int
+json__cbor_decoder_push(json_cbor_decoder_t *dec, json_t *value) {
+  int err;
+
+  if (dec->depth == 0) {
+    dec->root = value;
+
+    return 0;
+  }
+
+  json_cbor_frame_t *frame = &dec->frames[dec->depth - 1];
+
+  if (json_typeof(frame->value) == json_array) {
+    json_array_t *arr = json_to(array, frame->value);
+
+    err = json__array_unpack(arr);
+    if (err == 0) err = json__cbor_decoder_grow(frame);
+
+    if (err < 0) {
+      json_deref(value);
+
+      return err;
+    }
+
+    arr->data.values[arr->len++] = value;
+
+    return 0;
+  }
+
+  json_object_t *obj = json_to(object, frame->value);
+
+  if (frame->key) {
+    if (json_typeof(value) != json_string) {
+      json_deref(value);
+
+      return -1;
+    }
+
+    err = json__cbor_decoder_grow(frame);
+
+    if (err < 0) {
+      json_deref(value);
+
+      return err;
+    }
+
+    obj->properties[obj->len++] = (json_property_t) {
+      .key = value,
+      .value = (json_t *) &json__null,
+    };
+  } else {
+    obj->properties[obj->len - 1].value = value;
+  }
+
+  frame->key = !frame->key;
+
+  return 0;
+}
+
+// Store a number in the container currently open, keeping packed arrays packed
+// for as long as the number is of their kind. Numbers of another kind box the
+// array instead of converting it, so that integers stay integers.
+static inline int
+json__cbor_decoder_push_number(json_cbor_decoder_t *dec, const json_number_token_t *token) {
+  int err;
+
+  json_cbor_frame_t *frame = dec->depth ? &dec->frames[dec->depth - 1] : NULL;
+
+  json_array_t *arr = frame && json_typeof(frame->value) == json_array ? json_to(array, frame->value) : NULL;
+
+  if (arr && arr->kind != json_array_values) {
+    err = json__cbor_decoder_grow(frame);
+    if (err < 0) return err;
+  }
+
+  if (arr && arr->kind == json_array_int64s && token->kind == json_number_int64) {
+    arr->data.int64s[arr->len++] = token->value.i64;
+
+    return 0;
+  }
+
+  if (arr && arr->kind == json_array_doubles && token->kind == json_number_double) {
+    arr->data.doubles[arr->len++] = token->value.f64;
+
+    return 0;
+  }
+
+  json_t *value;
+
+  if (token->kind == json_number_double) {
+    err = json_create_number(token->value.f64, &value);
+  } else if (token->kind == json_number_int64) {
+    err = json_create_number_int64(token->value.i64, &value);
+  } else {
+    err = json_create_number_uint64(token->value.u64, &value);
+  }
+
+  if (err < 0) return err;
+
+  return json__cbor_decoder_push(dec, value);
+}
+
+// Pick the storage of an array from its first element, which is enough to
+// keep arrays of only integers or only floats packed.
+static inline int
+json__cbor_decoder_array_kind(json_cbor_decoder_t *dec, size_t len) {
+  if (len == 0) return json_array_values;
+
+  uint8_t initial = *dec->value;
+
+  if ((initial >> 5) <= 1) return json_array_int64s;
+
+  if (initial >= 0xf9 && initial <= 0xfb) return json_array_doubles;
+
+  return json_array_values;
+}
+
+// Text strings must be well-formed UTF-8, which rules out overlong forms,
+// surrogates and code points past U+10FFFF.
+static inline bool
+json__cbor_valid_utf8(const uint8_t *data, size_t len) {
+  size_t i = 0;
+
+  while (i < len) {
+    uint8_t c = data[i++];
+
+    if (c < 0x80) continue;
+
+    size_t n;
+    uint32_t code, min;
+
+    if ((c & 0xe0) == 0xc0) n = 1, code = c & 0x1f, min = 0x80;
+    else if ((c & 0xf0) == 0xe0) n = 2, code = c & 0x0f, min = 0x800;
+    else if ((c & 0xf8) == 0xf0) n = 3, code = c & 0x07, min = 0x10000;
+    else return false;
+
+    if (len - i < n) return false;
+
+    for (size_t j = 0; j < n; j++) {
+      c = data[i++];
+
+      if ((c & 0xc0) != 0x80) return false;
+
+      code = (code << 6) | (c & 0x3f);
+    }
+
+    if (code < min || code > 0x10ffff || (code >= 0xd800 && code <= 0xdfff)) return false;
+  }
+
+  return true;
+}
+
+static inline int
+json__decode_cbor(json_cbor_decoder_t *dec) {
+  int err;
+
+  uint8_t major;
+  uint64_t arg;
+
+  json_number_token_t token;
+
+  do {
+    uint8_t initial;
+
+    // Tags carry no meaning in the tree and only the tagged item is kept.
+    do {
+      if (dec->value >= dec->end) return -1;
+
+      initial = *dec->value;
+
+      err = json__cbor_decoder_head(dec, &major, &arg);
+      if (err < 0) return err;
+    } while (major == 6);
+
+    // Every item takes up at least a byte, so a length can't exceed what is
+    // left of the input, counting two items for each pair of a map.
+    size_t remaining = dec->end - dec->value;
+
+    switch (major) {
+    case 0:
+      if (arg <= INT64_MAX) {
+        token.kind = json_number_int64;
+        token.value.i64 = (int64_t) arg;
+      } else {
+        token.kind = json_number_uint64;
+        token.value.u64 = arg;
+      }
+
+      err = json__cbor_decoder_push_number(dec, &token);
+      break;
+
+    case 1:
+      if (arg <= INT64_MAX) {
+        token.kind = json_number_int64;
+        token.value.i64 = -1 - (int64_t) arg;
+      } else {
+        token.kind = json_number_double;
+        token.value.f64 = -1.0 - (double) arg;
+      }
+
+      err = json__cbor_decoder_push_number(dec, &token);
+      break;
+
+    case 3: {
+      if (arg > remaining || !json__cbor_valid_utf8(dec->value, (size_t) arg)) return -1;
+
+      json_t *value;
+      err = json_create_string_utf8(dec->value, (size_t) arg, &value);
+      if (err < 0) return err;
+
+      dec->value += arg;
+
+      err = json__cbor_decoder_push(dec, value);
+      break;
+    }
+
+    case 4: {
+      if (arg > remaining) return -1;
+
+      json_array_t *arr = json__array_alloc(json__cbor_decoder_array_kind(dec, (size_t) arg), arg < json__cbor_initial_capacity ? (size_t) arg : json__cbor_initial_capacity);
+
+      if (arr == NULL) return -1;
+
+      arr->len = 0;
+
+      err = json__cbor_decoder_push(dec, (json_t *) arr);
+      if (err < 0) return err;
+
+      if (arg) err = json__cbor_decoder_open(dec, (json_t *) arr, (size_t) arg);
+      break;
+    }
+
+    case 5: {
+      if (arg > remaining / 2) return -1;
+
+      json_object_t *obj = json__object_alloc(arg < json__cbor_initial_capacity ? (size_t) arg : json__cbor_initial_capacity);
+
+      if (obj == NULL) return -1;
+
+      err = json__cbor_decoder_push(dec, (json_t *) obj);
+      if (err < 0) return err;
+
+      if (arg) err = json__cbor_decoder_open(dec, (json_t *) obj, (size_t) arg);
+      break;
+    }
+
+    case 7:
+      switch (initial & 0x1f) {
+      case 20:
+      case 21:
+        err = json__cbor_decoder_push(dec, arg == 21 ? (json_t *) &json__true : (json_t *) &json__false);
+        break;
+
+      case 22:
+      case 23:
+        err = json__cbor_decoder_push(dec, (json_t *) &json__null);
+        break;
+
+      case 25:
+      case 26:
+      case 27:
+        token.kind = json_number_double;
+
+        if ((initial & 0x1f) == 25) {
+          token.value.f64 = json__cbor_half_value((uint16_t) arg);
+        } else if ((initial & 0x1f) == 26) {
+          uint32_t bits = (uint32_t) arg;
+
+          float f;
+          memcpy(&f, &bits, sizeof(f));
+
+          token.value.f64 = f;
+        } else {
+          memcpy(&token.value.f64, &arg, sizeof(double));
+        }
+
+        err = json__cbor_decoder_push_number(dec, &token);
+        break;
+
+      default:
+        return -1;
+      }
+
+      break;
+
+    default:
+      return -1; // Byte strings have no counterpart in the tree
+    }
+
+    if (err < 0) return err;
+
+    // Close every container that is now complete.
+    while (dec->depth) {
+      json_cbor_frame_t *frame = &dec->frames[dec->depth - 1];
+
+      if (json_typeof(frame->value) == json_array) {
+        if (json_to(array, frame->value)->len < frame->len) break;
+      } else {
+        if (json_to(object, frame->value)->len < frame->len || !frame->key) break;
+      }
+
+      dec->depth--;
+    }
+  } while (dec->depth);
+
+  return 0;
+}
+
+int
+json_decode_cbor(const uint8_t *buffer, size_t len, json_t **result) {
+  int err;
+
+  json_cbor_decoder_t dec = {
+    .value = buffer,
+    .end = buffer + len,
+    .root = NULL,
+    .frames = NULL,
+    .depth = 0,
+    .frames_capacity = 0,
+  };
+
+  err = json__decode_cbor(&dec);
+
+  free(dec.frames);
+
+  if (err < 0 || dec.value != dec.end) {
+    if (dec.root) json_deref(dec.root);
+
+    return -1;
+  }
+
+  *result = dec.root;
+
+  return 0;
+}
+
+int
+json_create_pointer_utf8(const utf8_t *pointer, size_t len, json_pointer_t **result) {
+  if (len == (size_t) -1) len = strlen((char *) pointer);
+
+  if (len && pointer[0] != '/') return -1;
+
+  size_t segments = 0;
+
+  for (size_t i = 0; i < len; i++) {
+    if (pointer[i] == '/') segments++;
+  }
+
+  // The segments are stored along with their unescaped keys, which are never
+  // longer than the pointer itself.
+  json_pointer_t *ptr = malloc(sizeof(json_pointer_t) + segments * sizeof(json_pointer_segment_t) + len);
+
+  if (ptr == NULL) return -1;
+
+  ptr->segments = (json_pointer_segment_t *) &ptr[1];
+  ptr->len = segments;
+
+  utf8_t *keys = (utf8_t *) &ptr->segments[segments];
+
+  for (size_t i = 0, j = 0; i < segments; i++) {
+    json_pointer_segment_t *segment = &ptr->segments[i];
+
+    segment->key = keys;
+    segment->len = 0;
+
+    for (j++; j < len && pointer[j] != '/'; j++) {
+      utf8_t c = pointer[j];
+
+      if (c == '~') {
+        c = j + 1 < len ? pointer[++j] : 0;
+
+        if (c == '0') c = '~';
+        else if (c == '1') c = '/';
+        else goto err;
+      }
+
+      keys[segment->len++] = c;
+    }
+
+    keys += segment->len;
+
+    // Array indices are decimal without leading zeros.
+    segment->index = segment->len ? 0 : SIZE_MAX;
+
+    if (segment->len > 1 && segment->key[0] == '0') segment->index = SIZE_MAX;
+
+    for (size_t k = 0; k < segment->len && segment->index != SIZE_MAX; k++) {
+      size_t digit = segment->key[k] - '0';
+
+      if (digit > 9 || segment->index > (SIZE_MAX - 1 - digit) / 10) segment->index = SIZE_MAX;
+      else segment->index = segment->index * 10 + digit;
+    }
+  }
+
+  *result = ptr;
+
+  return 0;
+
+err:
+  free(ptr);
+
+  return -1;
+}
+
+void
+json_destroy_pointer(json_pointer_t *pointer) {
+  free(pointer);
+}
+
+static inline const json_t *
+json__pointer_step(const json_pointer_segment_t *segment, const json_t *value) {
+  switch (json_typeof(value)) {
+  case json_array:
+    return segment->index == SIZE_MAX ? NULL : json_array_peek(value, segment->index);
+
+  case json_object:
+    return json_object_peek_utf8(value, segment->key, segment->len);
+
+  default:
+    return NULL;
+  }
+}
+
+const json_t *
+json_pointer_peek(const json_pointer_t *pointer, const json_t *value) {
+  for (size_t i = 0, n = pointer->len; i < n && value; i++) {
+    value = json__pointer_step(&pointer->segments[i], value);
+  }
+
+  return value;
+}
+
+json_t *
+json_pointer_get(const json_pointer_t *pointer, const json_t *value) {
+  int err;
+
+  const json_t *target = json_pointer_peek(pointer, value);
+
+  if (target == NULL) return NULL;
+
+  json_t *result;
+  err = json__retain((json_t *) target, &result);
+  if (err < 0) return NULL;
+
+  return result;
+}
+
+static inline int
+json__utf8_decoder_skip_key(json_utf8_decoder_t *dec) {
+  int err;
+
+  json__utf8_decoder_skip_whitespace(dec);
+
+  if (dec->value >= dec->end || *dec->value != '"') return -1;
+
+  err = json__decode_utf8_string(dec, NULL);
+  if (err < 0) return err;
+
+  json__utf8_decoder_skip_whitespace(dec);
+
+  if (dec->value >= dec->end || *dec->value != ':') return -1;
+
+  dec->value++;
+
+  return 0;
+}
+
+// Skip over a single value without decoding it. This mirrors
+// json__decode_utf8(), but only keeps track of the open containers.
+static inline int
+json__utf8_decoder_skip(json_utf8_decoder_t *dec) {
+  int err;
+
+  size_t depth = dec->depth;
+
+  json_type_t type;
+
+  utf8_t c;
+
+value:
+  json__utf8_decoder_skip_whitespace(dec);
+
+  if (dec->value >= dec->end) return -1;
+
+  c = *dec->value;
+
+  if (c == '[' || c == '{') {
+    dec->value++;
+
+    err = json__utf8_decoder_open(dec, c == '[' ? json_array : json_object);
+    if (err < 0) return err;
+
+    json__utf8_decoder_skip_whitespace(dec);
+
+    if (dec->value >= dec->end) return -1;
+
+    if (*dec->value == (c == '[' ? ']' : '}')) {
+      dec->value++;
+
+      goto close;
+    }
+
+    if (c == '{') {
+      err = json__utf8_decoder_skip_key(dec);
+      if (err < 0) return err;
+    }
+
+    goto value;
+  }
+
+  err = json__decode_utf8_scalar(dec, NULL);
+  if (err < 0) return err;
+
+  goto next;
+
+close:
+  dec->depth--;
+
+next:
+  if (dec->depth == depth) return 0;
+
+  json__utf8_decoder_skip_whitespace(dec);
+
+  if (dec->value >= dec->end) return -1;
+
+  c = *dec->value++;
+
+  type = dec->frames[dec->depth - 1].type;
+
+  if (c == ',') {
+    if (type == json_object) {
+      err = json__utf8_decoder_skip_key(dec);
+      if (err < 0) return err;
+    }
+
+    goto value;
+  }
+
+  if (c == (type == json_array ? ']' : '}')) goto close;
+
+  return -1;
+}
+
+// Read a key and compare it to a literal without decoding it into a string.
+static inline int
+json__utf8_decoder_match_key(json_utf8_decoder_t *dec, const utf8_t *key, size_t len, bool *result) {
+  int err;
+
+  json__utf8_decoder_skip_whitespace(dec);
+
+  if (dec->value >= dec->end || *dec->value != '"') return -1;
+
+  dec->value++;
+
+  size_t i = 0;
+
+  bool match = true;
+
+  utf8_t escape[4];
+  size_t n;
+
+  while (true) {
+    if (dec->value >= dec->end) return -1;
+
+    utf8_t c = *dec->value++;
+
+    if (c == '"') break;
+
+    if (c == '\\') {
+      err = json__utf8_decoder_escape(dec, escape, &n);
+      if (err < 0) return err;
+    } else {
+      escape[0] = c;
+      n = 1;
+    }
+
+    if (i + n > len || memcmp(&key[i], escape, n) != 0) match = false;
+
+    i += n;
+  }
+
+  json__utf8_decoder_skip_whitespace(dec);
+
+  if (dec->value >= dec->end || *dec->value != ':') return -1;
+
+  dec->value++;
+
+  *result = match && i == len;
+
+  return 0;
+}
+
+// Move to the value denoted by a segment within the container at the current
+// position, returning 1 if there is no such value.
+static inline int
+json__utf8_decoder_seek(json_utf8_decoder_t *dec, const json_pointer_segment_t *segment) {
+  int err;
+
+  json__utf8_decoder_skip_whitespace(dec);
+
+  if (dec->value >= dec->end) return -1;
+
+  utf8_t c = *dec->value;
+
+  if (c != '[' && c != '{') return 1;
+
+  dec->value++;
+
+  json__utf8_decoder_skip_whitespace(dec);
+
+  if (dec->value >= dec->end) return -1;
+
+  if (*dec->value == (c == '[' ? ']' : '}')) return 1;
+
+  if (c == '[' && segment->index == SIZE_MAX) return 1;
+
+  for (size_t i = 0;; i++) {
+    if (c == '[') {
+      if (i == segment->index) return 0;
+    } else {
+      bool match;
+      err = json__utf8_decoder_match_key(dec, segment->key, segment->len, &match);
+      if (err < 0) return err;
+
+      if (match) return 0;
+    }
+
+    err = json__utf8_decoder_skip(dec);
+    if (err < 0) return err;
+
+    json__utf8_decoder_skip_whitespace(dec);
+
+    if (dec->value >= dec->end) return -1;
+
+    utf8_t d = *dec->value++;
+
+    if (d == (c == '[' ? ']' : '}')) return 1;
+
+    if (d != ',') return -1;
+  }
+}
+
+int
+json_pointer_decode_utf8(const json_pointer_t *pointer, const utf8_t *buffer, size_t len, json_t **result) {
+  int err;
+
+  if (len == (size_t) -1) len = strlen((char *) buffer);
+
+  json_utf8_decoder_t dec = {
+    .value = buffer,
+    .start = buffer,
+    .end = buffer + len,
+    .slots = NULL,
+    .len = 0,
+    .capacity = 0,
+    .frames = NULL,
+    .depth = 0,
+    .frames_capacity = 0,
+    .max_depth = 0,
+    .projection = NULL,
+    .arena = NULL,
+  };
+
+  for (size_t i = 0, n = pointer->len; i < n; i++) {
+    err = json__utf8_decoder_seek(&dec, &pointer->segments[i]);
+
+    if (err != 0) {
+      free(dec.frames);
+
+      if (err < 0) return err;
+
+      *result = NULL;
+
+      return 0;
+    }
+  }
+
+  err = json__decode_utf8(&dec);
+
+  if (err < 0) {
+    json__utf8_decoder_destroy(&dec);
+
+    return -1;
+  }
+
+  *result = dec.slots[0].value;
+
+  free(dec.slots);
+  free(dec.frames);
+
+  return 0;
+}
+
+static inline bool
+json__query_is_name(utf8_t c) {
+  return c >= 0x80 || isalnum(c) || c == '_' || c == '$' || c == '-';
+}
+
+static inline void
+json__query_skip_whitespace(const utf8_t **p, const utf8_t *end) {
+  while (*p < end && isspace(**p)) (*p)++;
+}
+
+static inline int
+json__query_parse_name(const utf8_t **p, const utf8_t *end, utf8_t **key, size_t *len) {
+  const utf8_t *start = *p;
+
+  while (*p < end && json__query_is_name(**p)) (*p)++;
+
+  *len = *p - start;
+
+  if (*len == 0) return -1;
+
+  *key = malloc(*len);
+
+  if (*key == NULL) return -1;
+
+  memcpy(*key, start, *len);
+
+  return 0;
+}
+
+// Quoted names may use either single or double quotes, and a backslash takes
+// the following character literally.
+static inline int
+json__query_parse_quoted(const utf8_t **p, const utf8_t *end, utf8_t **key, size_t *len) {
+  utf8_t quote = *(*p)++;
+
+  utf8_t *data = malloc(end - *p + 1);
+
+  if (data == NULL) return -1;
+
+  size_t i = 0;
+
+  while (true) {
+    if (*p >= end) goto err;
+
+    utf8_t c = *(*p)++;
+
+    if (c == quote) break;
+
+    if (c == '\\') {
+      if (*p >= end) goto err;
+
+      c = *(*p)++;
+    }
+
+    data[i++] = c;
+  }
+
+  *key = data;
+  *len = i;
+
+  return 0;
+
+err:
+  free(data);
+
+  return -1;
+}
+
+// Negative indices would require the length of arrays to be known up front,
+// which streaming evaluation doesn't have, and so aren't supported.
+static inline int
+json__query_parse_integer(const utf8_t **p, const utf8_t *end, size_t *result) {
+  if (*p >= end || !isdigit(**p)) return -1;
+
+  size_t value = 0;
+
+  while (*p < end && isdigit(**p)) {
+    size_t digit = *(*p)++ - '0';
+
+    if (value > (SIZE_MAX - 1 - digit) / 10) return -1;
+
+    value = value * 10 + digit;
+  }
+
+  *result = value;
+
+  return 0;
+}
+
+static inline int
+json__query_parse_literal(const utf8_t **p, const utf8_t *end, json_t **result) {
+  int err;
+
+  if (*p < end && (**p == '\'' || **p == '"')) {
+    utf8_t *data;
+    size_t len;
+    err = json__query_parse_quoted(p, end, &data, &len);
+    if (err < 0) return err;
+
+    err = json_create_string_utf8(data, len, result);
+
+    free(data);
+
+    return err;
+  }
+
+  const utf8_t *start = *p;
+
+  while (*p < end && (isalnum(**p) || **p == '-' || **p == '+' || **p == '.')) (*p)++;
+
+  if (*p == start) return -1;
+
+  return json_decode_utf8(start, *p - start, result);
+}
+
+static inline int
+json__query_parse_operator(const utf8_t **p, const utf8_t *end) {
+  if (*p >= end) return json__query_exists;
+
+  utf8_t c = **p;
+
+  bool equals = *p + 1 < end && (*p)[1] == '=';
+
+  if (c == '=' && equals) {
+    *p += 2;
+    return json__query_eq;
+  }
+
+  if (c == '!' && equals) {
+    *p += 2;
+    return json__query_ne;
+  }
+
+  if (c == '<' || c == '>') {
+    *p += equals ? 2 : 1;
+
+    if (c == '<') return equals ? json__query_le : json__query_lt;
+
+    return equals ? json__query_ge : json__query_gt;
+  }
+
+  return json__query_exists;
+}
+
+static inline void
+json__query_append_pointer_segment(utf8_t *pointer, size_t *len, const utf8_t *key, size_t key_len) {
+  pointer[(*len)++] = '/';
+
+  for (size_t i = 0; i < key_len; i++) {
+    if (key[i] == '~' || key[i] == '/') {
+      pointer[(*len)++] = '~';
+      pointer[(*len)++] = key[i] == '~' ? '0' : '1';
+    } else {
+      pointer[(*len)++] = key[i];
+    }
+  }
+}
+
+// Parse a filter of the form @.path, or @.path <op> <literal>, where the path
+// is compiled into a JSON Pointer relative to the filtered value.
+static inline int
+json__query_parse_filter(const utf8_t **p, const utf8_t *end, json_query_step_t *step) {
+  int err;
+
+  json__query_skip_whitespace(p, end);
+
+  if (*p >= end || **p != '@') return -1;
+
+  (*p)++;
+
+  // Escaping at most doubles the length of the path.
+  utf8_t *pointer = malloc(2 * (end - *p) + 1);
+
+  if (pointer == NULL) return -1;
+
+  size_t len = 0;
+
+  while (*p < end && (**p == '.' || **p == '[')) {
+    utf8_t *key = NULL;
+    size_t key_len = 0;
+
+    if (*(*p)++ == '.') {
+      err = json__query_parse_name(p, end, &key, &key_len);
+    } else {
+      json__query_skip_whitespace(p, end);
+
+      if (*p < end && (**p == '\'' || **p == '"')) {
+        err = json__query_parse_quoted(p, end, &key, &key_len);
+      } else {
+        const utf8_t *start = *p;
+
+        size_t index;
+        err = json__query_parse_integer(p, end, &index);
+
+        key = NULL;
+        key_len = *p - start;
+
+        if (err == 0) json__query_append_pointer_segment(pointer, &len, start, key_len);
+      }
+
+      json__query_skip_whitespace(p, end);
+
+      if (err == 0 && (*p >= end || *(*p)++ != ']')) err = -1;
+    }
+
+    if (err < 0) {
+      free(key);
+
+      goto err;
+    }
+
+    if (key) {
+      json__query_append_pointer_segment(pointer, &len, key, key_len);
+
+      free(key);
+    }
+  }
+
+  err = json_create_pointer_utf8(pointer, len, &step->path);
+  if (err < 0) goto err;
+
+  free(pointer);
+
+  json__query_skip_whitespace(p, end);
+
+  step->op = json__query_parse_operator(p, end);
+
+  if (step->op != json__query_exists) {
+    json__query_skip_whitespace(p, end);
+
+    err = json__query_parse_literal(p, end, &step->literal);
+    if (err < 0) return err;
+  }
+
+  return 0;
+
+err:
+  free(pointer);
+
+  return -1;
+}
+
+static inline json_query_step_t *
+json__query_push(json_query_t *query, bool descendant) {
+  if (query->len == json__query_max_steps) return NULL;
+
+  if (query->len == query->capacity) {
+    size_t capacity = json__storage_grow(query->capacity, query->len + 1);
+
+    json_query_step_t *steps = realloc(query->steps, capacity * sizeof(json_query_step_t));
+
+    if (steps == NULL) return NULL;
+
+    query->steps = steps;
+    query->capacity = capacity;
+  }
+
+  json_query_step_t *step = &query->steps[query->len++];
+
+  memset(step, 0, sizeof(json_query_step_t));
+
+  step->descendant = descendant;
+
+  return step;
+}
+
+static inline int
+json__query_parse_bracket(const utf8_t **p, const utf8_t *end, json_query_t *query, json_query_step_t *step) {
+  int err;
+
+  json__query_skip_whitespace(p, end);
+
+  if (*p >= end) return -1;
+
+  utf8_t c = **p;
+
+  if (c == '*') {
+    (*p)++;
+
+    step->kind = json__query_wildcard;
+  } else if (c == '\'' || c == '"') {
+    step->kind = json__query_name;
+
+    err = json__query_parse_quoted(p, end, &step->key, &step->len);
+    if (err < 0) return err;
+  } else if (c == '?') {
+    (*p)++;
+
+    step->kind = json__query_filter;
+
+    query->filters |= UINT64_C(1) << (query->len - 1);
+
+    json__query_skip_whitespace(p, end);
+
+    if (*p >= end || *(*p)++ != '(') return -1;
+
+    err = json__query_parse_filter(p, end, step);
+    if (err < 0) return err;
+
+    json__query_skip_whitespace(p, end);
+
+    if (*p >= end || *(*p)++ != ')') return -1;
+  } else {
+    step->kind = json__query_index;
+
+    step->start = 0;
+    step->end = SIZE_MAX;
+    step->stride = 1;
+
+    if (c != ':') {
+      err = json__query_parse_integer(p, end, &step->start);
+      if (err < 0) return err;
+
+      json__query_skip_whitespace(p, end);
+    }
+
+    if (*p < end && **p == ':') {
+      (*p)++;
+
+      step->kind = json__query_slice;
+
+      json__query_skip_whitespace(p, end);
+
+      if (*p < end && isdigit(**p)) {
+        err = json__query_parse_integer(p, end, &step->end);
+        if (err < 0) return err;
+
+        json__query_skip_whitespace(p, end);
+      }
+
+      if (*p < end && **p == ':') {
+        (*p)++;
+
+        json__query_skip_whitespace(p, end);
+
+        if (*p < end && isdigit(**p)) {
+          err = json__query_parse_integer(p, end, &step->stride);
+          if (err < 0) return err;
+
+          if (step->stride == 0) return -1;
+        }
+      }
+    } else if (c == ':') {
+      return -1;
+    }
+  }
+
+  json__query_skip_whitespace(p, end);
+
+  if (*p >= end || *(*p)++ != ']') return -1;
+
+  return 0;
+}
+
+int
+json_create_query_utf8(const utf8_t *query, size_t len, json_query_t **result) {
+  int err;
+
+  if (len == (size_t) -1) len = strlen((char *) query);
+
+  const utf8_t *p = query, *end = query + len;
+
+  if (p >= end || *p++ != '$') return -1;
+
+  json_query_t *q = malloc(sizeof(json_query_t));
+
+  if (q == NULL) return -1;
+
+  q->steps = NULL;
+  q->len = 0;
+  q->capacity = 0;
+  q->filters = 0;
+
+  while (p < end) {
+    bool descendant = false;
+
+    utf8_t c = *p++;
+
+    if (c == '.' && p < end && *p == '.') {
+      descendant = true;
+      p++;
+    } else if (c != '.' && c != '[') {
+      goto err;
+    }
+
+    json_query_step_t *step = json__query_push(q, descendant);
+
+    if (step == NULL) goto err;
+
+    if (c == '[' || (descendant && p < end && *p == '[')) {
+      if (c != '[') p++;
+
+      err = json__query_parse_bracket(&p, end, q, step);
+    } else if (p < end && *p == '*') {
+      p++;
+
+      step->kind = json__query_wildcard;
+
+      err = 0;
+    } else {
+      step->kind = json__query_name;
+
+      err = json__query_parse_name(&p, end, &step->key, &step->len);
+    }
+
+    if (err < 0) goto err;
+  }
+
+  *result = q;
+
+  return 0;
+
+err:
+  json_destroy_query(q);
+
+  return -1;
+}
+
+void
+json_destroy_query(json_query_t *query) {
+  for (size_t i = 0, n = query->len; i < n; i++) {
+    json_query_step_t *step = &query->steps[i];
+
+    free(step->key);
+
+    if (step->path) json_destroy_pointer(step->path);
+    if (step->literal) json_deref(step->literal);
+  }
+
+  free(query->steps);
+  free(query);
+}
+
+static inline bool
+json__query_filter_matches(const json_query_step_t *step, const json_t *value) {
+  const json_t *target = json_pointer_peek(step->path, value);
+
+  if (target == NULL) return false;
+
+  switch (step->op) {
+  case json__query_exists:
+  default:
+    return true;
+
+  case json__query_eq:
+    return json_equal(target, step->literal);
+
+  case json__query_ne:
+    return !json_equal(target, step->literal);
+
+  case json__query_lt:
+  case json__query_le:
+  case json__query_gt:
+  case json__query_ge:
+    break;
+  }
+
+  // Only numbers and strings are ordered against each other.
+  json_type_t type = json_typeof(target);
+
+  if (type != json_typeof(step->literal) || (type != json_number && type != json_string)) return false;
+
+  int order = json_compare(target, step->literal);
+
+  switch (step->op) {
+  case json__query_lt:
+  default:
+    return order < 0;
+  case json__query_le:
+    return order <= 0;
+  case json__query_gt:
+    return order > 0;
+  case json__query_ge:
+    return order >= 0;
+  }
+}
+
+// Compute the states of a child from those of its parent. Object properties
+// have an index of SIZE_MAX and the name steps they match passed in, and
+// filter steps only match when the value of the child is known.
+static inline uint64_t
+json__query_advance(const json_query_t *query, uint64_t states, uint64_t names, size_t index, const json_t *value) {
+  uint64_t next = 0;
+
+  for (size_t k = 0, n = query->len; k < n; k++) {
+    uint64_t state = UINT64_C(1) << k;
+
+    if ((states & state) == 0) continue;
+
+    const json_query_step_t *step = &query->steps[k];
+
+    if (step->descendant) next |= state;
+
+    bool match;
+
+    switch (step->kind) {
+    case json__query_name:
+    default:
+      match = names & state;
+      break;
+
+    case json__query_wildcard:
+      match = true;
+      break;
+
+    case json__query_index:
+      match = index == step->start;
+      break;
+
+    case json__query_slice:
+      match = index != SIZE_MAX && index >= step->start && index < step->end && (index - step->start) % step->stride == 0;
+      break;
+
+    case json__query_filter:
+      match = value && json__query_filter_matches(step, value);
+      break;
+    }
+
+    if (match) next |= state << 1;
+  }
+
+  return next;
+}
+
+static inline uint64_t
+json__query_names(const json_query_t *query, uint64_t states, const json_t *key) {
+  json_string_t *str = json_to(string, key);
+
+  uint64_t names = 0;
+
+  if (str->encoding != json_string_utf8) return names;
+
+  for (size_t k = 0, n = query->len; k < n; k++) {
+    const json_query_step_t *step = &query->steps[k];
+
+    if ((states & (UINT64_C(1) << k)) && step->kind == json__query_name && step->len == str->len && memcmp(step->key, str->data, str->len) == 0) {
+      names |= UINT64_C(1) << k;
+    }
+  }
+
+  return names;
+}
+
+static inline int
+json__query_frame_push(json_query_frame_t **frames, size_t *depth, size_t *capacity, json_query_frame_t frame) {
+  if (*depth == *capacity) {
+    size_t n = json__storage_grow(*capacity, *depth + 1);
+
+    json_query_frame_t *next = n > SIZE_MAX / sizeof(json_query_frame_t) ? NULL : realloc(*frames, n * sizeof(json_query_frame_t));
+
+    if (next == NULL) return -1;
+
+    *frames = next;
+    *capacity = n;
+  }
+
+  (*frames)[(*depth)++] = frame;
+
+  return 0;
+}
+
+static inline bool
+json__query_is_container(const json_t *value) {
+  json_type_t type = json_typeof(value);
+
+  return type == json_array || type == json_object;
+}
+
+// Apply the states to the descendants of a container in document order.
+static int
+json__query_evaluate(const json_query_t *query, const json_t *value, uint64_t states, json_query_cb cb, void *data) {
+  int err = 0;
+
+  uint64_t final = UINT64_C(1) << query->len;
+
+  json_query_frame_t *frames = NULL;
+  size_t depth = 0, capacity = 0;
+
+  err = json__query_frame_push(&frames, &depth, &capacity, (json_query_frame_t) {.value = value, .states = states, .index = 0});
+  if (err < 0) goto done;
+
+  while (depth) {
+    json_query_frame_t *frame = &frames[depth - 1];
+
+    size_t i = frame->index++;
+
+    const json_t *child;
+
+    uint64_t next;
+
+    if (json_typeof(frame->value) == json_array) {
+      if (i >= json_to(array, frame->value)->len) {
+        depth--;
+        continue;
+      }
+
+      child = json_array_peek(frame->value, i);
+
+      next = json__query_advance(query, frame->states, 0, i, child);
+    } else {
+      json_object_t *obj = json_to(object, frame->value);
+
+      if (i >= obj->len) {
+        depth--;
+        continue;
+      }
+
+      child = obj->properties[i].value;
+
+      next = json__query_advance(query, frame->states, json__query_names(query, frame->states, obj->properties[i].key), SIZE_MAX, child);
+    }
+
+    if (next & final) {
+      err = cb(child, data);
+      if (err != 0) goto done;
+    }
+
+    next &= ~final;
+
+    if (next && json__query_is_container(child)) {
+      err = json__query_frame_push(&frames, &depth, &capacity, (json_query_frame_t) {.value = child, .states = next, .index = 0});
+      if (err < 0) goto done;
+    }
+  }
+
+done:
+  free(frames);
+
+  return err;
+}
+
+int
+json_query_evaluate(const json_query_t *query, const json_t *value, json_query_cb cb, void *data) {
+  if (query->len == 0) return cb(value, data);
+
+  if (!json__query_is_container(value)) return 0;
+
+  return json__query_evaluate(query, value, 1, cb, data);
+}
+
+// Start a container in the stream if it holds anything, returning 1 if it
+// was empty.
+static inline int
+json__query_stream_open(json_utf8_decoder_t *dec, json_query_frame_t **frames, size_t *depth, size_t *capacity, uint64_t states) {
+  int err;
+
+  json_type_t type = *dec->value++ == '[' ? json_array : json_object;
+
+  json__utf8_decoder_skip_whitespace(dec);
+
+  if (dec->value >= dec->end) return -1;
+
+  if (*dec->value == (type == json_array ? ']' : '}')) {
+    dec->value++;
+
+    return 1;
+  }
+
+  err = json__query_frame_push(frames, depth, capacity, (json_query_frame_t) {.type = type, .states = states, .index = 0});
+  if (err < 0) return err;
+
+  return 0;
+}
+
+int
+json_query_evaluate_utf8(const json_query_t *query, const utf8_t *buffer, size_t len, json_query_cb cb, void *data) {
+  int err;
+
+  if (len == (size_t) -1) len = strlen((char *) buffer);
+
+  json_utf8_decoder_t dec = {
+    .value = buffer,
+    .start = buffer,
+    .end = buffer + len,
+    .slots = NULL,
+    .len = 0,
+    .capacity = 0,
+    .frames = NULL,
+    .depth = 0,
+    .frames_capacity = 0,
+    .max_depth = 0,
+    .projection = NULL,
+    .arena = NULL,
+  };
+
+  uint64_t final = UINT64_C(1) << query->len;
+
+  json_query_frame_t *frames = NULL;
+  size_t depth = 0, capacity = 0;
+
+  json_query_frame_t *frame;
+
+  json_t *value = NULL;
+
+  utf8_t c;
+
+  json__utf8_decoder_skip_whitespace(&dec);
+
+  if (dec.value >= dec.end) goto err;
+
+  if (query->len == 0) {
+    err = json__decode_utf8(&dec);
+    if (err < 0) goto err;
+
+    value = dec.slots[0].value;
+
+    err = cb(value, data);
+    goto done;
+  }
+
+  c = *dec.value;
+
+  if (c != '[' && c != '{') return 0;
+
+  err = json__query_stream_open(&dec, &frames, &depth, &capacity, 1);
+  if (err < 0) goto err;
+  if (err > 0) goto done;
+
+element:
+  frame = &frames[depth - 1];
+
+  size_t index = SIZE_MAX;
+
+  uint64_t names = 0;
+
+  if (frame->type == json_object) {
+    // Keys are matched in place against each name step rather than decoded.
+    json__utf8_decoder_skip_whitespace(&dec);
+
+    const utf8_t *key = dec.value;
+
+    for (size_t k = 0, n = query->len; k < n; k++) {
+      const json_query_step_t *step = &query->steps[k];
+
+      if ((frame->states & (UINT64_C(1) << k)) == 0 || step->kind != json__query_name) continue;
+
+      dec.value = key;
+
+      bool match;
+      err = json__utf8_decoder_match_key(&dec, step->key, step->len, &match);
+      if (err < 0) goto err;
+
+      if (match) names |= UINT64_C(1) << k;
+    }
+
+    dec.value = key;
+
+    err = json__utf8_decoder_skip_key(&dec);
+    if (err < 0) goto err;
+  } else {
+    index = frame->index;
+  }
+
+  uint64_t next = json__query_advance(query, frame->states, names, index, NULL);
+
+  json__utf8_decoder_skip_whitespace(&dec);
+
+  if (dec.value >= dec.end) goto err;
+
+  if ((next & final) || (frame->states & query->filters)) {
+    // The value is needed, either as a match or to apply filters to, so
+    // decode it and continue on the tree.
+    err = json__decode_utf8(&dec);
+    if (err < 0) goto err;
+
+    value = dec.slots[0].value;
+
+    dec.len = 0;
+
+    if (frame->states & query->filters) {
+      next = json__query_advance(query, frame->states, names, index, value);
+    }
+
+    err = 0;
+
+    if (next & final) err = cb(value, data);
+
+    next &= ~final;
+
+    if (err == 0 && next && json__query_is_container(value)) {
+      err = json__query_evaluate(query, value, next, cb, data);
+    }
+
+    json_deref(value);
+
+    value = NULL;
+
+    if (err != 0) goto done;
+  } else if (next && (*dec.value == '[' || *dec.value == '{')) {
+    err = json__query_stream_open(&dec, &frames, &depth, &capacity, next);
+    if (err < 0) goto err;
+    if (err == 0) goto element;
+  } else {
+    err = json__utf8_decoder_skip(&dec);
+    if (err < 0) goto err;
+  }
+
+next:
+  frame = &frames[depth - 1];
+
+  frame->index++;
+
+  json__utf8_decoder_skip_whitespace(&dec);
+
+  if (dec.value >= dec.end) goto err;
+
+  c = *dec.value++;
+
+  if (c == ',') goto element;
+
+  if (c != (frame->type == json_array ? ']' : '}')) goto err;
+
+  if (--depth) goto next;
+
+  err = 0;
+
+done:
+  if (value) json_deref(value);
+
+  free(frames);
+  free(dec.slots);
+  free(dec.frames);
+
+  return err;
+
+err:
+  json__utf8_decoder_destroy(&dec);
+
+  free(frames);
+
+  return -1;
+}
+
+typedef struct {
+  const json_t *a;
+  const json_t *b;
+
+  // The pointer to the values, as an offset into the pointer storage.
+  size_t path;
+  size_t len;
+} json_diff_frame_t;
+
+typedef struct {
+  json_t *ops;
+
+  utf8_t *paths;
+  size_t paths_len;
+  size_t paths_capacity;
+
+  json_diff_frame_t *frames;
+  size_t depth;
+  size_t frames_capacity;
+} json_diff_t;
+
+// Arrays are aligned by their longest common subsequence as long as the table
+// of the alignment stays below this many cells, and element by element
+// otherwise.
+#define json__diff_max_cells (1 << 20)
+
+static inline int
+json__diff_reserve(json_diff_t *diff, size_t len) {
+  if (diff->paths_len + len <= diff->paths_capacity) return 0;
+
+  size_t capacity = json__storage_grow(diff->paths_capacity, diff->paths_len + len);
+
+  utf8_t *paths = realloc(diff->paths, capacity);
+
+  if (paths == NULL) return -1;
+
+  diff->paths = paths;
+  diff->paths_capacity = capacity;
+
+  return 0;
+}
+
+// Append a pointer extending the one at `path` by a single segment, escaped as
+// required by RFC 6901.
+static inline int
+json__diff_path(json_diff_t *diff, const json_diff_frame_t *frame, const utf8_t *segment, size_t segment_len, size_t *path, size_t *len) {
+  int err;
+
+  *len = frame->len;
+
+  err = json__diff_reserve(diff, *len + 1 + 2 * segment_len);
+  if (err < 0) return err;
+
+  utf8_t *data = &diff->paths[diff->paths_len];
+
+  memmove(data, &diff->paths[frame->path], *len);
+
+  json__query_append_pointer_segment(data, len, segment, segment_len);
+
+  *path = diff->paths_len;
+
+  diff->paths_len += *len;
+
+  return 0;
+}
+
+static inline int
+json__diff_path_key(json_diff_t *diff, const json_diff_frame_t *frame, const json_t *key, size_t *path, size_t *len) {
+  json_string_t *str = json_to(string, key);
+
+  if (str->encoding != json_string_utf8) return -1;
+
+  return json__diff_path(diff, frame, json__string_utf8(str), str->len, path, len);
+}
+
+static inline int
+json__diff_path_index(json_diff_t *diff, const json_diff_frame_t *frame, size_t index, size_t *path, size_t *len) {
+  char segment[24];
+
+  int n = snprintf(segment, sizeof(segment), "%zu", index);
+
+  return json__diff_path(diff, frame, (utf8_t *) segment, n, path, len);
+}
+
+static inline int
+json__diff_emit(json_diff_t *diff, const char *op, size_t path, size_t len, const json_t *value) {
+  int err;
+
+  json_t *entry;
+  err = json_create_object(value ? 3 : 2, &entry);
+  if (err < 0) return err;
+
+  json_t *string;
+  err = json_create_string_utf8((const utf8_t *) op, strlen(op), &string);
+  if (err < 0) goto err;
+
+  err = json_object_set_literal_utf8(entry, (const utf8_t *) "op", 2, string);
 
-  return 0;
-}
+  json_deref(string);
 
-bool
-json_boolean_value(const json_t *boolean) {
-  return json_to(boolean, boolean)->value;
-}
+  if (err < 0) goto err;
 
-int
-json_create_number(double value, json_t **result) {
-  json_number_t *num = malloc(sizeof(json_number_t));
+  // The root path is empty and may be emitted before any path was stored.
+  err = json_create_string_utf8(len ? &diff->paths[path] : (const utf8_t *) "", len, &string);
+  if (err < 0) goto err;
 
-  if (num == NULL) return -1;
+  err = json_object_set_literal_utf8(entry, (const utf8_t *) "path", 4, string);
 
-  num->type = json_number;
-  num->refs = 1;
-  num->value = value;
+  json_deref(string);
 
-  *result = (json_t *) num;
+  if (err < 0) goto err;
 
-  return 0;
-}
+  if (value) {
+    err = json_object_set_literal_utf8(entry, (const utf8_t *) "value", 5, (json_t *) value);
+    if (err < 0) goto err;
+  }
 
-double
-json_number_value(const json_t *number) {
-  return json_to(number, number)->value;
-}
+  err = json_array_push(diff->ops, entry);
 
-int
-json_create_string_utf8(const utf8_t *value, size_t len, json_t **result) {
-  if (len == (size_t) -1) len = strlen((char *) value);
+err:
+  json_deref(entry);
 
-  json_string_t *str = malloc(sizeof(json_string_t) + (len + 1) * sizeof(utf8_t));
+  return err;
+}
 
-  if (str == NULL) return -1;
+static inline int
+json__diff_push(json_diff_t *diff, const json_t *a, const json_t *b, size_t path, size_t len) {
+  if (diff->depth == diff->frames_capacity) {
+    size_t capacity = json__storage_grow(diff->frames_capacity, diff->depth + 1);
 
-  void *data = ((char *) str) + sizeof(json_string_t);
+    json_diff_frame_t *frames = capacity > SIZE_MAX / sizeof(json_diff_frame_t) ? NULL : realloc(diff->frames, capacity * sizeof(json_diff_frame_t));
 
-  str->type = json_string;
-  str->refs = 1;
-  str->encoding = json_string_utf8;
-  str->value.utf8 = data;
-  str->value.utf8[len] = '\0';
+    if (frames == NULL) return -1;
 
-  memcpy(str->value.utf8, value, len * sizeof(utf8_t));
+    diff->frames = frames;
+    diff->frames_capacity = capacity;
+  }
 
-  *result = (json_t *) str;
+  diff->frames[diff->depth++] = (json_diff_frame_t) {
+    .a = a,
+    .b = b,
+    .path = path,
+    .len = len,
+  };
 
   return 0;
 }
 
-int
-json_create_string_utf16le(const utf16_t *value, size_t len, json_t **result) {
-  if (len == (size_t) -1) len = wcslen((wchar_t *) value);
+static inline int
+json__diff_object(json_diff_t *diff, const json_diff_frame_t *frame) {
+  int err;
 
-  json_string_t *str = malloc(sizeof(json_string_t) + (len + 1) * sizeof(utf16_t));
+  json_object_t *a = json_to(object, frame->a), *b = json_to(object, frame->b);
 
-  if (str == NULL) return -1;
+  size_t path, len;
 
-  void *data = ((char *) str) + sizeof(json_string_t);
+  for (size_t i = 0, n = a->len; i < n; i++) {
+    json_property_t *property = &a->properties[i];
 
-  str->type = json_string;
-  str->refs = 1;
-  str->encoding = json_string_utf16le;
-  str->value.utf16le = data;
-  str->value.utf16le[len] = L'\0';
+    const json_t *value = json_object_peek(frame->b, property->key);
+
+    err = json__diff_path_key(diff, frame, property->key, &path, &len);
+    if (err < 0) return err;
 
-  memcpy(str->value.utf8, value, len * sizeof(utf16_t));
+    if (value == NULL) err = json__diff_emit(diff, "remove", path, len, NULL);
+    else err = json__diff_push(diff, property->value, value, path, len);
 
-  *result = (json_t *) str;
+    if (err < 0) return err;
+  }
+
+  for (size_t i = 0, n = b->len; i < n; i++) {
+    json_property_t *property = &b->properties[i];
+
+    if (json_object_peek(frame->a, property->key)) continue;
+
+    err = json__diff_path_key(diff, frame, property->key, &path, &len);
+    if (err < 0) return err;
+
+    err = json__diff_emit(diff, "add", path, len, property->value);
+    if (err < 0) return err;
+  }
 
   return 0;
 }
 
-const utf8_t *
-json_string_value_utf8(const json_t *string) {
-  return json_to(string, string)->value.utf8;
+// Elements are compared through their hashes first, which are cached for
+// containers, before falling back to a full comparison.
+static inline bool
+json__diff_equal(const json_t *a, const json_t *b, uint64_t x, uint64_t y) {
+  return x == y && json_equal(a, b);
 }
 
-const utf16_t *
-json_string_value_utf16le(const json_t *string) {
-  return json_to(string, string)->value.utf16le;
-}
+static inline int
+json__diff_array(json_diff_t *diff, const json_diff_frame_t *frame) {
+  int err;
 
-int
-json_create_array(size_t len, json_t **result) {
-  json_array_t *arr = malloc(sizeof(json_array_t) + len * sizeof(json_t *));
+  const json_t *a = frame->a, *b = frame->b;
 
-  if (arr == NULL) return -1;
+  size_t m = json_array_size(a), n = json_array_size(b);
 
-  arr->type = json_array;
-  arr->refs = 1;
-  arr->len = len;
+  // Skip the common prefix and suffix.
+  size_t start = 0;
 
-  for (size_t i = 0, n = arr->len; i < n; i++) {
-    arr->values[i] = (json_t *) &json__null;
+  while (start < m && start < n && json_equal(json_array_peek(a, start), json_array_peek(b, start))) start++;
+
+  while (m > start && n > start && json_equal(json_array_peek(a, m - 1), json_array_peek(b, n - 1))) m--, n--;
+
+  m -= start;
+  n -= start;
+
+  uint64_t *hashes = NULL;
+  uint32_t *table = NULL;
+
+  size_t cells = (m + 1) * (n + 1);
+
+  bool align = m && n && m <= json__diff_max_cells && n <= json__diff_max_cells && cells <= json__diff_max_cells;
+
+  if (align) {
+    hashes = malloc((m + n) * sizeof(uint64_t));
+    table = malloc(cells * sizeof(uint32_t));
+
+    if (hashes == NULL || table == NULL) {
+      err = -1;
+      goto done;
+    }
+
+    for (size_t i = 0; i < m; i++) {
+      err = json_hash(json_array_peek(a, start + i), &hashes[i]);
+      if (err < 0) goto done;
+    }
+
+    for (size_t j = 0; j < n; j++) {
+      err = json_hash(json_array_peek(b, start + j), &hashes[m + j]);
+      if (err < 0) goto done;
+    }
+
+    // The length of the longest common subsequence of the remainders of
+    // both arrays from each pair of positions on.
+    for (size_t i = m + 1; i-- > 0;) {
+      for (size_t j = n + 1; j-- > 0;) {
+        uint32_t *cell = &table[i * (n + 1) + j];
+
+        if (i == m || j == n) *cell = 0;
+        else if (json__diff_equal(json_array_peek(a, start + i), json_array_peek(b, start + j), hashes[i], hashes[m + j])) {
+          *cell = table[(i + 1) * (n + 1) + j + 1] + 1;
+        } else {
+          uint32_t x = table[(i + 1) * (n + 1) + j], y = table[i * (n + 1) + j + 1];
+
+          *cell = x > y ? x : y;
+        }
+      }
+    }
   }
 
-  *result = (json_t *) arr;
+#define json__diff_lcs(i, j) (table[(i) * (n + 1) + (j)])
 
-  return 0;
-}
+  size_t i = 0, j = 0, k = start, path, len;
 
-size_t
-json_array_size(const json_t *array) {
-  return json_to(array, array)->len;
-}
+  while (i < m || j < n) {
+    const json_t *x = i < m ? json_array_peek(a, start + i) : NULL;
+    const json_t *y = j < n ? json_array_peek(b, start + j) : NULL;
 
-json_t *
-json_array_get(const json_t *array, size_t index) {
-  json_array_t *arr = json_to(array, array);
+    int op;
 
-  if (index >= arr->len) return NULL;
+    if (x && y && align) {
+      if (json__diff_lcs(i, j) == json__diff_lcs(i + 1, j + 1) + 1 && json__diff_equal(x, y, hashes[i], hashes[m + j])) {
+        i++, j++, k++;
+        continue;
+      }
 
-  json_t *value = arr->values[index];
+      // Substitutions that don't shorten the common subsequence are diffed in
+      // place.
+      if (json__diff_lcs(i, j) == json__diff_lcs(i + 1, j + 1)) op = 0;
+      else op = json__diff_lcs(i, j + 1) >= json__diff_lcs(i + 1, j) ? 1 : -1;
+    } else {
+      op = x && y ? 0 : y ? 1 : -1;
+    }
 
-  json_ref(value);
+    err = json__diff_path_index(diff, frame, k, &path, &len);
+    if (err < 0) goto done;
 
-  return value;
-}
+    if (op == 0) {
+      err = json__diff_push(diff, x, y, path, len);
 
-int
-json_array_set(json_t *array, size_t index, json_t *value) {
-  json_array_t *arr = json_to(array, array);
+      i++, j++, k++;
+    } else if (op > 0) {
+      err = json__diff_emit(diff, "add", path, len, y);
 
-  if (index >= arr->len) return -1;
+      j++, k++;
+    } else {
+      err = json__diff_emit(diff, "remove", path, len, NULL);
 
-  json_ref(value);
-  json_deref(arr->values[index]);
+      i++;
+    }
+
+    if (err < 0) goto done;
+  }
 
-  arr->values[index] = value;
+#undef json__diff_lcs
 
-  return 0;
+  err = 0;
+
+done:
+  free(hashes);
+  free(table);
+
+  return err;
 }
 
 int
-json_array_delete(json_t *array, size_t index) {
-  json_array_t *arr = json_to(array, array);
+json_diff(const json_t *a, const json_t *b, json_t **result) {
+  int err;
 
-  if (index >= arr->len) return -1;
+  json_diff_t diff = {
+    .ops = NULL,
+    .paths = NULL,
+    .paths_len = 0,
+    .paths_capacity = 0,
+    .frames = NULL,
+    .depth = 0,
+    .frames_capacity = 0,
+  };
 
-  json_deref(arr->values[index]);
+  err = json_create_array(0, &diff.ops);
+  if (err < 0) return err;
 
-  arr->values[index] = (json_t *) &json__null;
+  err = json__diff_push(&diff, a, b, 0, 0);
+  if (err < 0) goto err;
 
-  return 0;
-}
+  while (diff.depth) {
+    json_diff_frame_t frame = diff.frames[--diff.depth];
 
-int
-json_create_object(size_t len, json_t **result) {
-  json_object_t *obj = malloc(sizeof(json_object_t) + len * sizeof(json_property_t));
+    if (frame.a == frame.b) continue;
 
-  if (obj == NULL) return -1;
+    json_type_t type = json_typeof(frame.a);
 
-  obj->type = json_object;
-  obj->refs = 1;
-  obj->len = len;
+    if (type != json_typeof(frame.b) || (type != json_array && type != json_object)) {
+      if (json_equal(frame.a, frame.b)) continue;
 
-  for (size_t i = 0, n = obj->len; i < n; i++) {
-    obj->properties[i] = (json_property_t) {
-      .key = (json_t *) &json__null,
-      .value = (json_t *) &json__null,
-    };
+      err = json__diff_emit(&diff, "replace", frame.path, frame.len, frame.b);
+    } else if (type == json_array) {
+      err = json__diff_array(&diff, &frame);
+    } else {
+      err = json__diff_object(&diff, &frame);
+    }
+
+    if (err < 0) goto err;
   }
 
-  *result = (json_t *) obj;
+  free(diff.paths);
+  free(diff.frames);
+
+  *result = diff.ops;
 
   return 0;
-}
 
-size_t
-json_object_size(const json_t *object) {
-  return json_to(object, object)->len;
+err:
+  json_deref(diff.ops);
+
+  free(diff.paths);
+  free(diff.frames);
+
+  return -1;
 }
 
-json_t *
-json_object_get(const json_t *object, const json_t *key) {
-  json_object_t *obj = json_to(object, object);
+// Shallow copy a container, sharing its children. Children that live in the
+// allocation of a frozen tree or an image are copied out instead, as they
+// don't outlive it.
+static inline json_t *
+json__copy_container(const json_t *value) {
+  int err;
 
-  assert(key->type == json_string);
+  if (json_typeof(value) == json_array) {
+    json_array_t *source = json_to(array, value);
 
-  for (size_t i = 0, n = obj->len; i < n; i++) {
-    json_property_t *property = &obj->properties[i];
+    json_array_t *arr = json__array_alloc(source->kind, source->len);
 
-    if (json__property_matches(property, key)) {
-      json_t *value = property->value;
+    if (arr == NULL) return NULL;
 
-      json_ref(value);
+    if (arr->kind != json_array_values) {
+      if (source->len) memcpy(arr->data.values, source->data.values, source->len * json__array_element_size(source->kind));
 
-      return value;
+      return (json_t *) arr;
     }
-  }
 
-  return NULL;
-}
+    for (size_t i = 0, n = source->len; i < n; i++) {
+      err = json__retain(source->data.values[i], &arr->data.values[i]);
 
-static inline void
-json__property_set(json_property_t *property, json_t *key, json_t *value) {
-  json_ref(key);
-  json_ref(value);
-  json_deref(property->key);
-  json_deref(property->value);
+      if (err < 0) {
+        arr->len = i;
 
-  property->key = key;
-  property->value = value;
-}
+        json_deref((json_t *) arr);
 
-int
-json_object_set(json_t *object, json_t *key, json_t *value) {
-  json_object_t *obj = json_to(object, object);
+        return NULL;
+      }
+    }
+
+    return (json_t *) arr;
+  }
 
-  assert(key->type == json_string);
+  json_object_t *source = json_to(object, value);
 
-  json_property_t *available = NULL;
+  json_object_t *obj = json__object_alloc(source->len);
 
-  for (size_t i = 0, n = obj->len; i < n; i++) {
+  if (obj == NULL) return NULL;
+
+  for (size_t i = 0, n = source->len; i < n; i++) {
     json_property_t *property = &obj->properties[i];
 
-    if (property->key->type == json_null) {
-      if (available == NULL) available = property;
-      continue;
-    }
+    *property = source->properties[i];
 
-    if (json__property_matches(property, key)) {
-      json__property_set(property, key, value);
-      return 0;
+    err = json__retain(source->properties[i].key, &property->key);
+    if (err < 0) goto err;
+
+    err = json__retain(source->properties[i].value, &property->value);
+
+    if (err < 0) {
+      json_deref(property->key);
+
+      goto err;
     }
+
+    obj->len = i + 1;
   }
 
-  if (available == NULL) return -1;
+  return (json_t *) obj;
 
-  json__property_set(available, key, value);
-  return 0;
+err:
+  json_deref((json_t *) obj);
+
+  return NULL;
 }
 
-static inline void
-json__property_delete(json_property_t *property) {
-  json_deref(property->key);
-  json_deref(property->value);
+// Make sure that the container in a slot can be modified without the change
+// being visible elsewhere, copying it if it's shared or immortal.
+static inline int
+json__patch_own(json_t **slot) {
+  json_t *value = *slot;
 
-  property->key = property->value = (json_t *) &json__null;
-}
+  json_type_t type = json_typeof(value);
 
-int
-json_object_delete(json_t *object, const json_t *key) {
-  json_object_t *obj = json_to(object, object);
+  if (type != json_array && type != json_object) return -1;
 
-  assert(key->type == json_string);
+  int *refs = json__refs(value);
 
-  for (size_t i = 0, n = obj->len; i < n; i++) {
-    json_property_t *property = &obj->properties[i];
+  uint8_t *flags = json__flags(value);
 
-    if (json__property_matches(property, key)) {
-      json__property_delete(property);
-      return 0;
-    }
+  if (refs && *refs == 1 && !(*flags & json__flag_frozen)) {
+    *flags &= ~json__flag_hashed;
+
+    return 0;
   }
 
-  return -1;
+  json_t *copy = json__copy_container(value);
+
+  if (copy == NULL) return -1;
+
+  json_deref(value);
+
+  *slot = copy;
+
+  return 0;
 }
 
+static inline size_t
+json__patch_index(const json_t *array, const json_pointer_segment_t *segment) {
+  if (segment->len == 1 && segment->key[0] == '-') return json_array_size(array);
+
+  return segment->index;
+}
+
+// Find the container holding the value a pointer refers to, taking ownership
+// of every container along the way.
 static inline int
-json__utf8_encoder_ensure_capacity(json_utf8_encoder_t *enc, size_t len) {
-  if (enc->len + len <= enc->capacity) return 0;
+json__patch_parent(json_t **root, const json_pointer_t *pointer, json_t **result) {
+  int err;
 
-  while (enc->len + len > enc->capacity) {
-    if (enc->capacity) enc->capacity *= 2;
-    else enc->capacity = 16;
-  }
+  json_t **slot = root;
 
-  utf8_t *value = realloc(enc->value, (enc->capacity + 1) * sizeof(utf8_t));
+  for (size_t i = 0, n = pointer->len - 1; i < n; i++) {
+    err = json__patch_own(slot);
+    if (err < 0) return err;
 
-  if (value == NULL) return -1;
+    const json_pointer_segment_t *segment = &pointer->segments[i];
 
-  enc->value = value;
+    json_t *value = *slot;
+
+    slot = NULL;
+
+    if (json_typeof(value) == json_array) {
+      json_array_t *arr = json_to(array, value);
+
+      // Elements of packed arrays are numbers and so can't be parents.
+      if (arr->kind == json_array_values && segment->index < arr->len) slot = &arr->data.values[segment->index];
+    } else {
+      json_object_t *obj = json_to(object, value);
+
+      for (size_t j = 0, m = obj->len; j < m && slot == NULL; j++) {
+        json_string_t *str = json_to(string, obj->properties[j].key);
+
+        if (str->encoding == json_string_utf8 && str->len == segment->len && memcmp(str->data, segment->key, str->len) == 0) {
+          slot = &obj->properties[j].value;
+        }
+      }
+    }
+
+    if (slot == NULL) return -1;
+  }
+
+  err = json__patch_own(slot);
+  if (err < 0) return err;
+
+  *result = *slot;
 
   return 0;
 }
 
 static inline int
-json__utf8_encoder_append(json_utf8_encoder_t *enc, utf8_t *value, size_t len) {
+json__patch_add(json_t **root, const json_pointer_t *pointer, const json_t *value) {
   int err;
 
-  if (len == (size_t) -1) len = strlen((char *) value);
+  if (pointer->len == 0) {
+    json_t *copy;
+    err = json__retain((json_t *) value, &copy);
+    if (err < 0) return err;
 
-  err = json__utf8_encoder_ensure_capacity(enc, len);
+    json_deref(*root);
+
+    *root = copy;
+
+    return 0;
+  }
+
+  json_t *parent;
+  err = json__patch_parent(root, pointer, &parent);
   if (err < 0) return err;
 
-  memcpy(&enc->value[enc->len], value, len * sizeof(utf8_t));
+  const json_pointer_segment_t *segment = &pointer->segments[pointer->len - 1];
 
-  enc->value[enc->len += len] = '\0';
+  if (json_typeof(parent) == json_array) {
+    size_t index = json__patch_index(parent, segment);
 
-  return 0;
+    if (index == SIZE_MAX) return -1;
+
+    return json_array_insert(parent, index, (json_t *) value);
+  }
+
+  return json_object_set_literal_utf8(parent, segment->key, segment->len, (json_t *) value);
 }
 
 static inline int
-json__utf16_encoder_ensure_capacity(json_utf16_encoder_t *enc, size_t len) {
-  if (enc->len + len <= enc->capacity) return 0;
+json__patch_remove(json_t **root, const json_pointer_t *pointer) {
+  int err;
 
-  while (enc->len + len > enc->capacity) {
-    if (enc->capacity) enc->capacity *= 2;
-    else enc->capacity = 16;
+  if (pointer->len == 0) return -1;
+
+  json_t *parent;
+  err = json__patch_parent(root, pointer, &parent);
+  if (err < 0) return err;
+
+  const json_pointer_segment_t *segment = &pointer->segments[pointer->len - 1];
+
+  if (json_typeof(parent) == json_object) {
+    return json_object_delete_literal_utf8(parent, segment->key, segment->len);
   }
 
-  utf16_t *value = realloc(enc->value, (enc->capacity + 1) * sizeof(utf16_t));
+  json_array_t *arr = json_to(array, parent);
 
-  if (value == NULL) return -1;
+  size_t index = segment->index;
 
-  enc->value = value;
+  if (index >= arr->len) return -1;
+
+  if (arr->kind == json_array_values) json_deref(arr->data.values[index]);
+
+  size_t size = json__array_element_size(arr->kind);
+
+  char *data = (char *) arr->data.values;
+
+  memmove(&data[index * size], &data[(index + 1) * size], (arr->len - index - 1) * size);
+
+  arr->len--;
 
   return 0;
 }
 
 static inline int
-json__utf16_encoder_append(json_utf16_encoder_t *enc, utf16_t *value, size_t len) {
+json__patch_replace(json_t **root, const json_pointer_t *pointer, const json_t *value) {
   int err;
 
-  if (len == (size_t) -1) len = wcslen((wchar_t *) value);
+  if (json_pointer_peek(pointer, *root) == NULL) return -1;
 
-  err = json__utf16_encoder_ensure_capacity(enc, len);
+  if (pointer->len == 0) return json__patch_add(root, pointer, value);
+
+  json_t *parent;
+  err = json__patch_parent(root, pointer, &parent);
   if (err < 0) return err;
 
-  memcpy(&enc->value[enc->len], value, len * sizeof(utf16_t));
+  const json_pointer_segment_t *segment = &pointer->segments[pointer->len - 1];
 
-  enc->value[enc->len += len] = L'\0';
+  if (json_typeof(parent) == json_array) return json_array_set(parent, segment->index, (json_t *) value);
 
-  return 0;
+  return json_object_set_literal_utf8(parent, segment->key, segment->len, (json_t *) value);
 }
 
-static inline int
-json__encode_utf8(const json_t *value, json_utf8_encoder_t *enc);
+static inline bool
+json__pointer_is_prefix(const json_pointer_t *prefix, const json_pointer_t *pointer) {
+  if (prefix->len > pointer->len) return false;
 
-static inline int
-json__encode_utf8_null(json_utf8_encoder_t *enc) {
-  return json__utf8_encoder_append(enc, (utf8_t *) "null", 4);
-}
+  for (size_t i = 0, n = prefix->len; i < n; i++) {
+    const json_pointer_segment_t *a = &prefix->segments[i], *b = &pointer->segments[i];
 
-static inline int
-json__encode_utf8_boolean(const json_boolean_t *boolean, json_utf8_encoder_t *enc) {
-  return json__utf8_encoder_append(enc, boolean->value ? (utf8_t *) "true" : (utf8_t *) "false", boolean->value ? 4 : 5);
-}
+    if (a->len != b->len || memcmp(a->key, b->key, a->len) != 0) return false;
+  }
 
-static inline int
-json__encode_utf8_number(const json_number_t *number, json_utf8_encoder_t *enc) {
-  int err;
+  return true;
+}
 
-  size_t len = snprintf(NULL, 0, "%.17g", number->value);
+static inline bool
+json__patch_op_is(const json_t *op, const char *name) {
+  size_t len = strlen(name);
 
-  err = json__utf8_encoder_ensure_capacity(enc, len);
-  if (err < 0) return err;
+  return json_string_length(op) == len && memcmp(json_string_value_utf8(op), name, len) == 0;
+}
 
-  snprintf((char *) &enc->value[enc->len], len + 1, "%.17g", number->value);
+static inline int
+json__patch_pointer(const json_t *op, const utf8_t *name, size_t len, json_pointer_t **result) {
+  const json_t *path = json_object_peek_utf8(op, name, len);
 
-  enc->value[enc->len += len] = '\0';
+  if (path == NULL || json_typeof(path) != json_string) return -1;
 
-  return 0;
+  return json_create_pointer_utf8(json_string_value_utf8(path), json_string_length(path), result);
 }
 
 static inline int
-json__encode_utf8_string(const json_string_t *string, json_utf8_encoder_t *enc) {
+json__patch_apply(json_t **root, const json_t *op) {
   int err;
 
-  assert(string->encoding == json_string_utf8);
+  if (json_typeof(op) != json_object) return -1;
 
-  err = json__utf8_encoder_append(enc, (utf8_t *) "\"", 1);
-  if (err < 0) return err;
+  const json_t *name = json_object_peek_utf8(op, (const utf8_t *) "op", 2);
 
-  size_t len = strlen((char *) string->value.utf8);
+  if (name == NULL || json_typeof(name) != json_string) return -1;
 
-  err = json__utf8_encoder_ensure_capacity(enc, len);
+  const json_t *value = json_object_peek_utf8(op, (const utf8_t *) "value", 5);
+
+  json_pointer_t *path, *from = NULL;
+  err = json__patch_pointer(op, (const utf8_t *) "path", 4, &path);
   if (err < 0) return err;
 
-  utf8_t escaped[6];
+  err = -1;
 
-  for (size_t i = 0; i < len; i++) {
-    utf8_t c = string->value.utf8[i];
+  if (json__patch_op_is(name, "add")) {
+    if (value) err = json__patch_add(root, path, value);
+  } else if (json__patch_op_is(name, "remove")) {
+    err = json__patch_remove(root, path);
+  } else if (json__patch_op_is(name, "replace")) {
+    if (value) err = json__patch_replace(root, path, value);
+  } else if (json__patch_op_is(name, "test")) {
+    const json_t *target = json_pointer_peek(path, *root);
 
-    if (c >= 32 && c != '\"' && c != '\\') {
-      err = json__utf8_encoder_append(enc, &c, 1);
-      if (err < 0) return err;
-    } else {
-      err = json__utf8_encoder_append(enc, (utf8_t *) "\\", 1);
-      if (err < 0) return err;
+    if (value && target && json_equal(target, value)) err = 0;
+  } else if (json__patch_op_is(name, "move") || json__patch_op_is(name, "copy")) {
+    bool move = json__patch_op_is(name, "move");
 
-      switch (c) {
-      case '\"':
-      case '\\':
-      case '\b':
-      case '\f':
-      case '\n':
-      case '\r':
-      case '\t':
-        err = json__utf8_encoder_append(enc, &c, 1);
-        if (err < 0) return err;
-        break;
+    err = json__patch_pointer(op, (const utf8_t *) "from", 4, &from);
+    if (err < 0) goto done;
 
-      default:
-        err = snprintf((char *) escaped, 6, "u%04x", c);
-        if (err < 0) return err;
+    err = -1;
 
-        err = json__utf8_encoder_append(enc, escaped, 5);
-        if (err < 0) return err;
-      }
-    }
-  }
+    // A value can't be moved into itself.
+    if (move && json__pointer_is_prefix(from, path)) {
+      if (from->len == path->len) err = 0;
 
-  err = json__utf8_encoder_append(enc, (utf8_t *) "\"", 1);
-  if (err < 0) return err;
+      goto done;
+    }
 
-  return 0;
-}
+    const json_t *source = json_pointer_peek(from, *root);
 
-static inline int
-json__encode_utf8_array(const json_array_t *array, json_utf8_encoder_t *enc) {
-  int err;
+    if (source == NULL) goto done;
 
-  err = json__utf8_encoder_append(enc, (utf8_t *) "[", 1);
-  if (err < 0) return err;
+    json_t *copy;
+    err = json__retain((json_t *) source, &copy);
+    if (err < 0) goto done;
 
-  bool first = true;
+    if (move) err = json__patch_remove(root, from);
 
-  for (size_t i = 0, n = array->len; i < n; i++) {
-    if (first) first = false;
-    else {
-      err = json__utf8_encoder_append(enc, (utf8_t *) ",", 1);
-      if (err < 0) return err;
-    }
+    if (err == 0) err = json__patch_add(root, path, copy);
 
-    err = json__encode_utf8(array->values[i], enc);
-    if (err < 0) return err;
+    json_deref(copy);
   }
 
-  err = json__utf8_encoder_append(enc, (utf8_t *) "]", 1);
-  if (err < 0) return err;
+done:
+  json_destroy_pointer(path);
 
-  return 0;
+  if (from) json_destroy_pointer(from);
+
+  return err;
 }
 
-static inline int
-json__encode_utf8_property(const json_property_t *property, json_utf8_encoder_t *enc) {
+int
+json_patch_apply(json_t *value, const json_t *patch, json_t **result) {
   int err;
 
-  err = json__encode_utf8_string(json_to(string, property->key), enc);
-  if (err < 0) return err;
+  if (json_typeof(patch) != json_array) goto err;
 
-  err = json__utf8_encoder_append(enc, (utf8_t *) ":", 1);
-  if (err < 0) return err;
+  for (size_t i = 0, n = json_array_size(patch); i < n; i++) {
+    err = json__patch_apply(&value, json_array_peek(patch, i));
+    if (err < 0) goto err;
+  }
 
-  err = json__encode_utf8(property->value, enc);
-  if (err < 0) return err;
+  *result = value;
 
   return 0;
+
+err:
+  json_deref(value);
+
+  return -1;
 }
 
-static inline int
-json__encode_utf8_object(const json_object_t *object, json_utf8_encoder_t *enc) {
+int
+json_array_with(const json_t *array, size_t index, json_t *value, json_t **result) {
   int err;
 
-  err = json__utf8_encoder_append(enc, (utf8_t *) "{", 1);
-  if (err < 0) return err;
+  json_array_t *arr = json_to(array, array);
 
-  bool first = true;
+  if (arr->flags & json__flag_frozen) return -1;
 
-  for (size_t i = 0, n = object->len; i < n; i++) {
-    const json_property_t *property = &object->properties[i];
+  if (index > arr->len) return -1;
 
-    if (property->key->type == json_null) continue;
+  json_t *copy = json__copy_container(array);
 
-    if (first) first = false;
-    else {
-      err = json__utf8_encoder_append(enc, (utf8_t *) ",", 1);
-      if (err < 0) return err;
-    }
+  if (copy == NULL) return -1;
 
-    err = json__encode_utf8_property(property, enc);
-    if (err < 0) return err;
+  if (index == arr->len) err = json_array_insert(copy, index, value);
+  else err = json_array_set(copy, index, value);
+
+  if (err < 0) {
+    json_deref(copy);
+
+    return err;
   }
 
-  err = json__utf8_encoder_append(enc, (utf8_t *) "}", 1);
-  if (err < 0) return err;
+  *result = copy;
 
   return 0;
 }
 
-static inline int
-json__encode_utf8(const json_t *value, json_utf8_encoder_t *enc) {
-  switch (value->type) {
-  case json_null:
-    return json__encode_utf8_null(enc);
+int
+json_object_with(const json_t *object, json_t *key, json_t *value, json_t **result) {
+  int err;
 
-  case json_boolean:
-    return json__encode_utf8_boolean(json_to(boolean, value), enc);
+  json_object_t *obj = json_to(object, object);
 
-  case json_number:
-    return json__encode_utf8_number(json_to(number, value), enc);
+  if (obj->flags & json__flag_frozen) return -1;
 
-  case json_string:
-    return json__encode_utf8_string(json_to(string, value), enc);
+  json_t *copy = json__copy_container(object);
 
-  case json_array:
-    return json__encode_utf8_array(json_to(array, value), enc);
+  if (copy == NULL) return -1;
 
-  case json_object:
-    return json__encode_utf8_object(json_to(object, value), enc);
+  err = json_object_set(copy, key, value);
+
+  if (err < 0) {
+    json_deref(copy);
+
+    return err;
   }
+
+  *result = copy;
+
+  return 0;
 }
 
 int
-json_encode_utf8(const json_t *value, utf8_t **result) {
+json_pointer_set_persistent(const json_pointer_t *pointer, const json_t *root, json_t *value, json_t **result) {
   int err;
 
-  json_utf8_encoder_t enc = {
-    .value = NULL,
-    .len = 0,
-    .capacity = 0,
-  };
+  if (pointer->len == 0) return json__retain(value, result);
 
-  err = json__encode_utf8(value, &enc);
+  // Holding a reference to the root makes it, and so everything along the
+  // path, shared, which copies the path on write and leaves the rest shared.
+  // Frozen containers along the path are copied regardless.
+  json_t *copy = (json_t *) root;
+
+  json_ref(copy);
+
+  json_t *parent;
+  err = json__patch_parent(&copy, pointer, &parent);
   if (err < 0) goto err;
 
-  *result = realloc(enc.value, (enc.len + 1) * sizeof(utf8_t));
+  const json_pointer_segment_t *segment = &pointer->segments[pointer->len - 1];
 
-  return 0;
+  if (json_typeof(parent) == json_array) {
+    size_t index = json__patch_index(parent, segment);
 
-err:
-  free(enc.value);
+    size_t len = json_array_size(parent);
 
-  return -1;
-}
+    if (index < len) err = json_array_set(parent, index, value);
+    else if (index == len) err = json_array_insert(parent, index, value);
+    else err = -1;
+  } else {
+    err = json_object_set_literal_utf8(parent, segment->key, segment->len, value);
+  }
 
-static inline int
-json__encode_utf16le(const json_t *value, json_utf16_encoder_t *enc);
+  if (err < 0) goto err;
 
-static inline int
-json__encode_utf16le_null(json_utf16_encoder_t *enc) {
-  return json__utf16_encoder_append(enc, (utf16_t *) L"null", 4);
-}
+  *result = copy;
 
-static inline int
-json__encode_utf16le_boolean(const json_boolean_t *boolean, json_utf16_encoder_t *enc) {
-  return json__utf16_encoder_append(enc, boolean->value ? (utf16_t *) L"true" : (utf16_t *) L"false", boolean->value ? 4 : 5);
-}
+  return 0;
+
+err:
+  json_deref(copy);
 
-static inline int
-json__encode_utf16le_number(const json_number_t *number, json_utf16_encoder_t *enc) {
   return -1;
 }
 
-static inline int
-json__encode_utf16le_string(const json_string_t *string, json_utf16_encoder_t *enc) {
-  int err;
+// Images hold a frozen tree laid out exactly as in memory, with pointers linked
+// against a preferred base address. Mapping an image at that address needs no
+// further work, and mapping it anywhere else only relocates its pointers in a
+// single pass over the nodes. The root is followed by the remaining nodes,
+// and identical keys share a single node.
 
-  assert(string->encoding == json_string_utf16le);
+#define json__image_magic   "libjson"
+#define json__image_version 1
 
-  err = json__utf16_encoder_append(enc, (utf16_t *) L"\"", 1);
-  if (err < 0) return err;
+typedef struct {
+  char magic[8];
+  uint32_t version;
+  uint16_t byte_order;
+  uint8_t pointer_size;
 
-  size_t len = wcslen((wchar_t *) string->value.utf16le);
+  // Whether the image was mapped from a file rather than allocated, which is
+  // only set once loaded.
+  uint8_t mapped;
 
-  err = json__utf16_encoder_ensure_capacity(enc, len);
-  if (err < 0) return err;
+  uint64_t base;
+  uint64_t size;
+} json_image_header_t;
 
-  utf16_t escaped[6];
+#define json__image_base ((uintptr_t) 1 << (sizeof(void *) == 8 ? 45 : 30))
 
-  for (size_t i = 0; i < len; i++) {
-    utf16_t c = string->value.utf16le[i];
+typedef struct {
+  const json_t *value;
 
-    if (c >= 32 && c != L'\"' && c != L'\\') {
-      err = json__utf16_encoder_append(enc, &c, 1);
-      if (err < 0) return err;
-    } else {
-      err = json__utf16_encoder_append(enc, (utf16_t *) L"\\", 1);
-      if (err < 0) return err;
+  // The offset of the pointer to the node within the image.
+  size_t slot;
+  bool key;
+} json_image_frame_t;
 
-      switch (c) {
-      case L'\"':
-      case L'\\':
-      case L'\b':
-      case L'\f':
-      case L'\n':
-      case L'\r':
-      case L'\t':
-        err = json__utf16_encoder_append(enc, &c, 1);
-        if (err < 0) return err;
-        break;
+typedef struct {
+  uint8_t *data;
+  size_t len;
+  size_t capacity;
 
-      default:
-        err = swprintf((wchar_t *) escaped, 6, L"u%04x", c);
-        if (err < 0) return err;
+  uintptr_t base;
 
-        err = json__utf16_encoder_append(enc, escaped, 5);
-        if (err < 0) return err;
-      }
-    }
-  }
+  // Offsets of the shared null and boolean nodes, or 0 if not yet written.
+  size_t null;
+  size_t booleans[2];
 
-  err = json__utf16_encoder_append(enc, (utf16_t *) L"\"", 1);
-  if (err < 0) return err;
+  // Open addressing table of the offsets of keys, plus one.
+  size_t *keys;
+  size_t keys_len;
+  size_t keys_mask;
 
-  return 0;
-}
+  json_image_frame_t *frames;
+  size_t depth;
+  size_t frames_capacity;
+} json_image_encoder_t;
 
 static inline int
-json__encode_utf16le_array(const json_array_t *array, json_utf16_encoder_t *enc) {
-  int err;
+json__image_alloc(json_image_encoder_t *enc, size_t size, size_t *result) {
+  size = json__align(size);
 
-  err = json__utf16_encoder_append(enc, (utf16_t *) L"[", 1);
-  if (err < 0) return err;
+  if (enc->len + size > enc->capacity) {
+    size_t capacity = json__storage_grow(enc->capacity, enc->len + size);
 
-  bool first = true;
+    uint8_t *data = realloc(enc->data, capacity);
 
-  for (size_t i = 0, n = array->len; i < n; i++) {
-    if (first) first = false;
-    else {
-      err = json__utf16_encoder_append(enc, (utf16_t *) L",", 1);
-      if (err < 0) return err;
-    }
+    if (data == NULL) return -1;
 
-    err = json__encode_utf16le(array->values[i], enc);
-    if (err < 0) return err;
+    enc->data = data;
+    enc->capacity = capacity;
   }
 
-  err = json__utf16_encoder_append(enc, (utf16_t *) L"]", 1);
-  if (err < 0) return err;
-
-  return 0;
-}
-
-static inline int
-json__encode_utf16le_property(const json_property_t *property, json_utf16_encoder_t *enc) {
-  int err;
-
-  err = json__encode_utf16le_string(json_to(string, property->key), enc);
-  if (err < 0) return err;
+  memset(&enc->data[enc->len], 0, size);
 
-  err = json__utf16_encoder_append(enc, (utf16_t *) L":", 1);
-  if (err < 0) return err;
+  *result = enc->len;
 
-  err = json__encode_utf16le(property->value, enc);
-  if (err < 0) return err;
+  enc->len += size;
 
   return 0;
 }
 
-static inline int
-json__encode_utf16le_object(const json_object_t *object, json_utf16_encoder_t *enc) {
-  int err;
+static inline void
+json__image_link(json_image_encoder_t *enc, size_t slot, uintptr_t pointer) {
+  memcpy(&enc->data[slot], &pointer, sizeof(pointer));
+}
 
-  err = json__utf16_encoder_append(enc, (utf16_t *) L"{", 1);
-  if (err < 0) return err;
+static inline int
+json__image_push(json_image_encoder_t *enc, const json_t *value, size_t slot, bool key) {
+  // Tagged integers don't depend on where the image is mapped.
+  if (json__is_tagged(value)) {
+    json__image_link(enc, slot, (uintptr_t) value);
 
-  bool first = true;
+    return 0;
+  }
 
-  for (size_t i = 0, n = object->len; i < n; i++) {
-    const json_property_t *property = &object->properties[i];
+  if (enc->depth == enc->frames_capacity) {
+    size_t capacity = json__storage_grow(enc->frames_capacity, enc->depth + 1);
 
-    if (property->key->type == json_null) continue;
+    json_image_frame_t *frames = capacity > SIZE_MAX / sizeof(json_image_frame_t) ? NULL : realloc(enc->frames, capacity * sizeof(json_image_frame_t));
 
-    if (first) first = false;
-    else {
-      err = json__utf16_encoder_append(enc, (utf16_t *) L",", 1);
-      if (err < 0) return err;
-    }
+    if (frames == NULL) return -1;
 
-    err = json__encode_utf16le_property(property, enc);
-    if (err < 0) return err;
+    enc->frames = frames;
+    enc->frames_capacity = capacity;
   }
 
-  err = json__utf16_encoder_append(enc, (utf16_t *) L"}", 1);
-  if (err < 0) return err;
+  enc->frames[enc->depth++] = (json_image_frame_t) {
+    .value = value,
+    .slot = slot,
+    .key = key,
+  };
 
   return 0;
 }
 
-static inline int
-json__encode_utf16le(const json_t *value, json_utf16_encoder_t *enc) {
-  switch (value->type) {
-  case json_null:
-    return json__encode_utf16le_null(enc);
-
-  case json_boolean:
-    return json__encode_utf16le_boolean(json_to(boolean, value), enc);
-
-  case json_number:
-    return json__encode_utf16le_number(json_to(number, value), enc);
+static inline size_t *
+json__image_find_key(json_image_encoder_t *enc, const json_string_t *key) {
+  size_t i = json__hash_scalar((const json_t *) key) & enc->keys_mask;
 
-  case json_string:
-    return json__encode_utf16le_string(json_to(string, value), enc);
+  while (enc->keys[i]) {
+    const json_string_t *str = (const json_string_t *) &enc->data[enc->keys[i] - 1];
 
-  case json_array:
-    return json__encode_utf16le_array(json_to(array, value), enc);
+    if (json__equal_string(str, key)) break;
 
-  case json_object:
-    return json__encode_utf16le_object(json_to(object, value), enc);
+    i = (i + 1) & enc->keys_mask;
   }
+
+  return &enc->keys[i];
 }
 
-int
-json_encode_utf16le(const json_t *value, utf16_t **result) {
-  int err;
+static inline int
+json__image_grow_keys(json_image_encoder_t *enc) {
+  if (enc->keys && (enc->keys_len + 1) * 2 <= enc->keys_mask + 1) return 0;
 
-  json_utf16_encoder_t enc = {
-    .value = NULL,
-    .len = 0,
-    .capacity = 0,
-  };
+  size_t *keys = enc->keys;
+  size_t size = keys ? (enc->keys_mask + 1) * 2 : 64;
 
-  err = json__encode_utf16le(value, &enc);
-  if (err < 0) goto err;
+  enc->keys = calloc(size, sizeof(size_t));
 
-  *result = realloc(enc.value, (enc.len + 1) * sizeof(utf16_t));
+  if (enc->keys == NULL) {
+    enc->keys = keys;
 
-  return 0;
+    return -1;
+  }
 
-err:
-  free(enc.value);
+  if (keys) {
+    for (size_t i = 0, n = enc->keys_mask + 1; i < n; i++) {
+      if (keys[i] == 0) continue;
 
-  return -1;
-}
+      enc->keys_mask = size - 1;
 
-static inline void
-json__utf8_decoder_skip_whitespace(json_utf8_decoder_t *dec) {
-  while (dec->value < dec->end && isspace(*dec->value)) {
-    dec->value++;
-  }
-}
+      *json__image_find_key(enc, (const json_string_t *) &enc->data[keys[i] - 1]) = keys[i];
+    }
 
-static inline int
-json__decode_utf8(json_utf8_decoder_t *dec, json_t **result);
+    free(keys);
+  }
 
-static inline int
-json__decode_utf8_number(json_utf8_decoder_t *dec, json_t **result) {
-  const utf8_t *start = dec->value;
+  enc->keys_mask = size - 1;
 
-  if (dec->value < dec->end && *dec->value == '-') dec->value++;
+  return 0;
+}
 
-  if (dec->value < dec->end && *dec->value == '0') {
-    dec->value++;
-  } else {
-    while (dec->value < dec->end && isdigit(*dec->value)) {
-      dec->value++;
-    }
-  }
+static inline int
+json__image_write_string(json_image_encoder_t *enc, const json_string_t *str, bool key, size_t *result) {
+  int err;
 
-  if (dec->value < dec->end && *dec->value == '.') {
-    dec->value++;
+  size_t *entry = NULL;
 
-    while (dec->value < dec->end && isdigit(*dec->value)) {
-      dec->value++;
-    }
-  }
+  if (key) {
+    err = json__image_grow_keys(enc);
+    if (err < 0) return err;
 
-  if (dec->value < dec->end && (*dec->value == 'e' || *dec->value == 'E')) {
-    dec->value++;
+    entry = json__image_find_key(enc, str);
 
-    if (dec->value < dec->end && (*dec->value == '+' || *dec->value == '-')) {
-      dec->value++;
-    }
+    if (*entry) {
+      *result = *entry - 1;
 
-    while (dec->value < dec->end && isdigit(*dec->value)) {
-      dec->value++;
+      return 0;
     }
   }
 
-  size_t len = dec->value - start;
-
-  if (len == 0 || len > 64) return -1;
+  size_t size = json__string_size(str);
 
-  if (result == NULL) return 0;
+  err = json__image_alloc(enc, size, result);
+  if (err < 0) return err;
 
-  char value[65];
-  value[len] = '\0';
-  memcpy(value, start, len);
+  json_string_t *copy = (json_string_t *) &enc->data[*result];
 
-  json_number_t *num = malloc(sizeof(json_number_t));
+  memcpy(copy, str, size);
 
-  if (num == NULL) return -1;
+  copy->flags = json__flag_frozen | json__flag_immortal;
+  copy->refs = 1;
 
-  num->type = json_number;
-  num->refs = 1;
-  num->value = strtod(value, NULL);
+  if (entry) {
+    *entry = *result + 1;
 
-  *result = (json_t *) num;
+    enc->keys_len++;
+  }
 
   return 0;
 }
 
 static inline int
-json__decode_utf8_string(json_utf8_decoder_t *dec, json_t **result) {
-  const utf8_t *start = ++dec->value;
+json__image_write(json_image_encoder_t *enc, const json_image_frame_t *frame, size_t *result) {
+  int err;
 
-  size_t len = 0;
+  const json_t *value = frame->value;
 
-  while (true) {
-    if (dec->value >= dec->end) return -1;
+  const uint8_t flags = json__flag_frozen | json__flag_immortal;
 
-    utf8_t c = *dec->value++;
+  switch (json_typeof(value)) {
+  case json_null:
+  default:
+    if (enc->null == 0) {
+      err = json__image_alloc(enc, sizeof(json_null_t), &enc->null);
+      if (err < 0) return err;
 
-    if (c == '"') break;
+      memcpy(&enc->data[enc->null], &json__null, sizeof(json_null_t));
+    }
 
-    if (c == '\\') {
-      if (dec->value >= dec->end) return -1;
+    *result = enc->null;
 
-      utf8_t e = *dec->value++;
+    return 0;
 
-      if (e == '\"' || e == '\\' || e == '/' || e == 'b' || e == 'f' || e == 'n' || e == 'r' || e == 't') {
-        ;
-      } else if (e == 'u') {
-        if (dec->end - dec->value < 4) return -1;
+  case json_boolean: {
+    bool b = json_to(boolean, value)->value;
 
-        dec->value += 4;
+    if (enc->booleans[b] == 0) {
+      err = json__image_alloc(enc, sizeof(json_boolean_t), &enc->booleans[b]);
+      if (err < 0) return err;
 
-        return -1; // TODO Handle conversion
-      } else {
-        return -1;
-      }
+      memcpy(&enc->data[enc->booleans[b]], b ? &json__true : &json__false, sizeof(json_boolean_t));
     }
 
-    len++;
+    *result = enc->booleans[b];
+
+    return 0;
   }
 
-  if (result == NULL) return 0;
+  case json_number: {
+    err = json__image_alloc(enc, sizeof(json_number_t), result);
+    if (err < 0) return err;
 
-  json_string_t *str = malloc(sizeof(json_string_t) + (len + 1) * sizeof(utf8_t));
+    json_number_t *num = (json_number_t *) &enc->data[*result];
 
-  if (str == NULL) return -1;
+    if (json__is_tagged(value)) {
+      num->type = json_number;
+      num->kind = json_number_int64;
+      num->value.i64 = json__number_i64(value);
+    } else {
+      memcpy(num, value, sizeof(json_number_t));
+    }
 
-  void *data = ((char *) str) + sizeof(json_string_t);
+    num->flags = flags;
+    num->refs = 1;
 
-  str->type = json_string;
-  str->refs = 1;
-  str->encoding = json_string_utf8;
-  str->value.utf8 = data;
-  str->value.utf8[len] = '\0';
+    return 0;
+  }
 
-  dec->value = start;
+  case json_string:
+    return json__image_write_string(enc, json_to(string, value), frame->key, result);
 
-  size_t i = 0;
+  case json_array: {
+    json_array_t *source = json_to(array, value);
 
-  while (true) {
-    utf8_t c = *dec->value++;
+    size_t size = source->len * json__array_element_size(source->kind);
 
-    if (c == '"') break;
+    err = json__image_alloc(enc, json__align(sizeof(json_array_t)) + size, result);
+    if (err < 0) return err;
 
-    if (c == '\\') {
-      utf8_t e = *dec->value++;
-
-      if (e == '\"' || e == '\\' || e == '/') {
-        c = e;
-      } else if (e == 'b') {
-        c = '\b';
-      } else if (e == 'f') {
-        c = '\f';
-      } else if (e == 'n') {
-        c = '\n';
-      } else if (e == 'r') {
-        c = '\r';
-      } else if (e == 't') {
-        c = '\t';
-      } else if (e == 'u') {
-        dec->value += 4;
-
-        // TODO Handle conversion
-      }
+    size_t data = *result + json__align(sizeof(json_array_t));
+
+    json_array_t *arr = (json_array_t *) &enc->data[*result];
+
+    arr->type = json_array;
+    arr->kind = source->kind;
+    arr->flags = flags;
+    arr->refs = 1;
+    arr->len = arr->capacity = source->len;
+
+    json__image_link(enc, *result + offsetof(json_array_t, data), enc->base + data);
+
+    if (source->kind != json_array_values) {
+      if (size) memcpy(&enc->data[data], source->data.values, size);
+
+      return 0;
+    }
+
+    // Children are pushed in reverse so that they are laid out in order.
+    for (size_t i = source->len; i-- > 0;) {
+      err = json__image_push(enc, source->data.values[i], data + i * sizeof(json_t *), false);
+      if (err < 0) return err;
     }
 
-    str->value.utf8[i++] = c;
+    return 0;
   }
 
-  *result = (json_t *) str;
+  case json_object: {
+    json_object_t *source = json_to(object, value);
 
-  return 0;
-}
+    err = json__image_alloc(enc, sizeof(json_object_t) + source->len * sizeof(json_property_t), result);
+    if (err < 0) return err;
 
-static inline int
-json__decode_utf8_array(json_utf8_decoder_t *dec, json_t **result) {
-  int err;
+    size_t properties = *result + sizeof(json_object_t);
 
-  const utf8_t *start = ++dec->value;
+    json_object_t *obj = (json_object_t *) &enc->data[*result];
 
-  size_t len = 0;
+    obj->type = json_object;
+    obj->flags = flags;
+    obj->refs = 1;
+    obj->len = obj->capacity = source->len;
 
-  while (true) {
-    json__utf8_decoder_skip_whitespace(dec);
+    json__image_link(enc, *result + offsetof(json_object_t, properties), enc->base + properties);
 
-    if (dec->value >= dec->end) return -1;
+    for (size_t i = source->len; i-- > 0;) {
+      size_t slot = properties + i * sizeof(json_property_t);
 
-    utf8_t c = *dec->value;
+      err = json__image_push(enc, source->properties[i].value, slot + offsetof(json_property_t, value), false);
+      if (err < 0) return err;
 
-    if (c == ']') {
-      dec->value++;
-      break;
+      err = json__image_push(enc, source->properties[i].key, slot + offsetof(json_property_t, key), true);
+      if (err < 0) return err;
     }
 
-    err = json__decode_utf8(dec, NULL);
-    if (err < 0) return err;
+    return 0;
+  }
+  }
+}
 
-    len++;
+static inline json_t *
+json__image_relocate_pointer(json_t *value, uintptr_t delta) {
+  if (json__is_tagged(value)) return value;
 
-    json__utf8_decoder_skip_whitespace(dec);
+  return (json_t *) ((uintptr_t) value + delta);
+}
 
-    if (dec->value >= dec->end) return -1;
+// Move all pointers of an image by the distance between where it is and where
+// it was linked for, walking the nodes in the order they are laid out. The
+// storage of containers directly follows them and is found from there rather
+// than through the pointers being moved, so images can be moved either way.
+static inline int
+json__image_relocate(uint8_t *image, size_t size, uintptr_t delta) {
+  size_t offset = sizeof(json_image_header_t);
 
-    c = *dec->value++;
+  while (offset < size) {
+    json_t *node = (json_t *) &image[offset];
 
-    if (c == ']') break;
-    else if (c != ',') return -1;
-  }
+    size_t len;
 
-  if (result == NULL) return 0;
+    switch (node->type) {
+    case json_null:
+      len = sizeof(json_null_t);
+      break;
 
-  json_array_t *arr = malloc(sizeof(json_array_t) + len * sizeof(json_t *));
+    case json_boolean:
+      len = sizeof(json_boolean_t);
+      break;
 
-  if (arr == NULL) return -1;
+    case json_number:
+      len = sizeof(json_number_t);
+      break;
 
-  arr->type = json_array;
-  arr->refs = 1;
-  arr->len = len;
+    case json_string:
+      len = json__string_size((json_string_t *) node);
+      break;
 
-  dec->value = start;
+    case json_array: {
+      json_array_t *arr = (json_array_t *) node;
 
-  size_t i = 0;
+      json_t **values = (json_t **) ((char *) arr + json__align(sizeof(json_array_t)));
 
-  while (true) {
-    json__utf8_decoder_skip_whitespace(dec);
+      arr->data.values = (void *) ((uintptr_t) arr->data.values + delta);
 
-    utf8_t c = *dec->value;
+      if (arr->kind == json_array_values) {
+        for (size_t i = 0, n = arr->len; i < n; i++) {
+          values[i] = json__image_relocate_pointer(values[i], delta);
+        }
+      }
 
-    if (c == ']') {
-      dec->value++;
+      len = json__align(sizeof(json_array_t)) + arr->len * json__array_element_size(arr->kind);
       break;
     }
 
-    err = json__decode_utf8(dec, &arr->values[i++]);
-    (void) err;
+    case json_object: {
+      json_object_t *obj = (json_object_t *) node;
 
-    json__utf8_decoder_skip_whitespace(dec);
+      json_property_t *properties = (json_property_t *) &obj[1];
 
-    c = *dec->value++;
+      obj->properties = (json_property_t *) ((uintptr_t) obj->properties + delta);
 
-    if (c == ']') break;
-  }
+      for (size_t i = 0, n = obj->len; i < n; i++) {
+        properties[i].key = json__image_relocate_pointer(properties[i].key, delta);
+        properties[i].value = json__image_relocate_pointer(properties[i].value, delta);
+      }
 
-  *result = (json_t *) arr;
+      len = sizeof(json_object_t) + obj->len * sizeof(json_property_t);
+      break;
+    }
+
+    default:
+      return -1;
+    }
+
+    offset += json__align(len);
+  }
 
   return 0;
 }
 
-static inline int
-json__decode_utf8_object(json_utf8_decoder_t *dec, json_t **result) {
+int
+json_image_encode(const json_t *value, uint8_t **result, size_t *len) {
   int err;
 
-  const utf8_t *start = ++dec->value;
+  json_image_encoder_t enc = {
+    .data = NULL,
+    .len = 0,
+    .capacity = 0,
+    .base = json__image_base,
+    .null = 0,
+    .booleans = {0, 0},
+    .keys = NULL,
+    .keys_len = 0,
+    .keys_mask = 0,
+    .frames = NULL,
+    .depth = 0,
+    .frames_capacity = 0,
+  };
 
-  size_t len = 0;
+  size_t header;
+  err = json__image_alloc(&enc, sizeof(json_image_header_t), &header);
+  if (err < 0) goto err;
 
-  while (true) {
-    json__utf8_decoder_skip_whitespace(dec);
+  json_image_frame_t root = {
+    .value = value,
+    .slot = 0,
+    .key = false,
+  };
 
-    if (dec->value >= dec->end) return -1;
+  size_t offset;
+  err = json__image_write(&enc, &root, &offset);
+  if (err < 0) goto err;
 
-    utf8_t c = *dec->value;
+  while (enc.depth) {
+    json_image_frame_t frame = enc.frames[--enc.depth];
 
-    if (c == '}') {
-      dec->value++;
-      break;
-    }
+    err = json__image_write(&enc, &frame, &offset);
+    if (err < 0) goto err;
 
-    err = json__decode_utf8_string(dec, NULL);
-    if (err < 0) return err;
+    json__image_link(&enc, frame.slot, enc.base + offset);
+  }
 
-    json__utf8_decoder_skip_whitespace(dec);
+  // Hash the copy rather than the source, which may be shared and so mustn't
+  // be written to. The image is linked for its base address, so it's moved to
+  // where it actually lies for the duration.
+  uintptr_t delta = (uintptr_t) enc.data - enc.base;
 
-    if (dec->value >= dec->end) return -1;
+  json__image_relocate(enc.data, enc.len, delta);
 
-    c = *dec->value++;
+  uint64_t hash;
+  err = json__hash((json_t *) &enc.data[sizeof(json_image_header_t)], true, &hash);
 
-    if (c != ':') return -1;
+  json__image_relocate(enc.data, enc.len, -delta);
 
-    json__utf8_decoder_skip_whitespace(dec);
+  if (err < 0) goto err;
 
-    err = json__decode_utf8(dec, NULL);
-    if (err < 0) return err;
+  // Only the root is reference counted, and releasing it releases the image.
+  uint8_t *flags = json__flags((json_t *) &enc.data[sizeof(json_image_header_t)]);
 
-    len++;
+  if (flags) *flags = (*flags & ~json__flag_immortal) | json__flag_image;
 
-    json__utf8_decoder_skip_whitespace(dec);
+  json_image_header_t *h = (json_image_header_t *) enc.data;
 
-    if (dec->value >= dec->end) return -1;
+  memcpy(h->magic, json__image_magic, sizeof(h->magic));
 
-    c = *dec->value++;
+  h->version = json__image_version;
+  h->byte_order = 0x0102;
+  h->pointer_size = sizeof(void *);
+  h->mapped = 0;
+  h->base = enc.base;
+  h->size = enc.len;
 
-    if (c == '}') break;
-    else if (c != ',') return -1;
-  }
+  free(enc.keys);
+  free(enc.frames);
 
-  if (result == NULL) return 0;
+  *result = enc.data;
+  *len = enc.len;
 
-  json_object_t *obj = malloc(sizeof(json_object_t) + len * sizeof(json_property_t));
+  return 0;
 
-  if (obj == NULL) return -1;
+err:
+  free(enc.data);
+  free(enc.keys);
+  free(enc.frames);
 
-  obj->type = json_object;
-  obj->refs = 1;
-  obj->len = len;
+  return -1;
+}
 
-  dec->value = start;
+static inline bool
+json__image_valid(const json_image_header_t *h, size_t len) {
+  return (
+    len >= sizeof(json_image_header_t) &&
+    memcmp(h->magic, json__image_magic, sizeof(h->magic)) == 0 &&
+    h->version == json__image_version &&
+    h->byte_order == 0x0102 &&
+    h->pointer_size == sizeof(void *) &&
+    h->size > sizeof(json_image_header_t) &&
+    h->size <= len
+  );
+}
 
-  size_t i = 0;
+static void
+json__image_release(json_t *root) {
+  json_image_header_t *h = (json_image_header_t *) ((char *) root - sizeof(json_image_header_t));
 
-  while (true) {
-    json__utf8_decoder_skip_whitespace(dec);
+  if (h->mapped) {
+#ifdef _WIN32
+    UnmapViewOfFile(h);
+#else
+    munmap(h, h->size);
+#endif
+  } else {
+    free(h);
+  }
+}
 
-    utf8_t c = *dec->value;
+static inline int
+json__image_open(uint8_t *image, json_t **result) {
+  int err;
 
-    if (c == '}') {
-      dec->value++;
-      break;
-    }
+  json_image_header_t *h = (json_image_header_t *) image;
 
-    json_property_t *property = &obj->properties[i++];
+  uintptr_t delta = (uintptr_t) image - (uintptr_t) h->base;
 
-    err = json__decode_utf8_string(dec, &property->key);
-    (void) err;
+  json_t *root = (json_t *) &image[sizeof(json_image_header_t)];
 
-    json__utf8_decoder_skip_whitespace(dec);
+  if (delta) {
+    err = json__image_relocate(image, h->size, delta);
 
-    (void) *dec->value++;
+    if (err < 0) {
+      json__image_release(root);
 
-    json__utf8_decoder_skip_whitespace(dec);
+      return err;
+    }
+  }
 
-    err = json__decode_utf8(dec, &property->value);
-    (void) err;
+  // Null and booleans aren't reference counted, so the image can go right away.
+  json_type_t type = json_typeof(root);
 
-    json__utf8_decoder_skip_whitespace(dec);
+  if (type == json_null || type == json_boolean) {
+    json_t *value = type == json_null ? (json_t *) &json__null : ((json_boolean_t *) root)->value ? (json_t *) &json__true
+                                                                                                   : (json_t *) &json__false;
 
-    c = *dec->value++;
+    json__image_release(root);
 
-    if (c == '}') break;
+    root = value;
   }
 
-  *result = (json_t *) obj;
+  *result = root;
 
   return 0;
 }
 
-static inline int
-json__decode_utf8(json_utf8_decoder_t *dec, json_t **result) {
-  json__utf8_decoder_skip_whitespace(dec);
+int
+json_image_decode(const uint8_t *buffer, size_t len, json_t **result) {
+  const json_image_header_t *h = (const json_image_header_t *) buffer;
 
-  if (
-    dec->end - dec->value >= 4 &&
-    dec->value[0] == 't' &&
-    dec->value[1] == 'r' &&
-    dec->value[2] == 'u' &&
-    dec->value[3] == 'e'
-  ) {
-    dec->value += 4;
+  if (!json__image_valid(h, len)) return -1;
 
-    if (result) *result = (json_t *) &json__true;
+  uint8_t *image = malloc(h->size);
 
-    return 0;
-  }
+  if (image == NULL) return -1;
 
-  if (
-    dec->end - dec->value >= 5 &&
-    dec->value[0] == 'f' &&
-    dec->value[1] == 'a' &&
-    dec->value[2] == 'l' &&
-    dec->value[3] == 's' &&
-    dec->value[4] == 'e'
-  ) {
-    dec->value += 5;
+  memcpy(image, buffer, h->size);
 
-    if (result) *result = (json_t *) &json__false;
+  ((json_image_header_t *) image)->mapped = 0;
 
-    return 0;
-  }
+  return json__image_open(image, result);
+}
 
-  if (
-    dec->end - dec->value >= 4 &&
-    dec->value[0] == 'n' &&
-    dec->value[1] == 'u' &&
-    dec->value[2] == 'l' &&
-    dec->value[3] == 'l'
-  ) {
-    dec->value += 4;
+int
+json_image_load(const char *path, json_t **result) {
+  json_image_header_t h;
 
-    if (result) *result = (json_t *) &json__null;
+  void *image;
 
-    return 0;
-  }
+#ifdef _WIN32
+  HANDLE file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, NULL);
 
-  utf8_t c = *dec->value;
+  if (file == INVALID_HANDLE_VALUE) return -1;
 
-  if (c == '"') {
-    return json__decode_utf8_string(dec, result);
-  }
+  LARGE_INTEGER size;
 
-  if (c == '[') {
-    return json__decode_utf8_array(dec, result);
-  }
+  DWORD read;
 
-  if (c == '{') {
-    return json__decode_utf8_object(dec, result);
+  if (!GetFileSizeEx(file, &size) || !ReadFile(file, &h, sizeof(h), &read, NULL) || !json__image_valid(&h, read < sizeof(h) ? 0 : (size_t) size.QuadPart)) {
+    CloseHandle(file);
+
+    return -1;
   }
 
-  return json__decode_utf8_number(dec, result);
-}
+  HANDLE mapping = CreateFileMappingA(file, NULL, PAGE_WRITECOPY, 0, 0, NULL);
 
-int
-json_decode_utf8(const utf8_t *buffer, size_t len, json_t **result) {
-  int err;
+  CloseHandle(file);
 
-  if (len == (size_t) -1) len = strlen((char *) buffer);
+  if (mapping == NULL) return -1;
 
-  json_utf8_decoder_t dec = {
-    .value = buffer,
-    .start = buffer,
-    .end = buffer + len,
-  };
+  // Private copies of the pages are made as pointers are relocated or the
+  // reference count of the root changes.
+  image = MapViewOfFileEx(mapping, FILE_MAP_COPY, 0, 0, (SIZE_T) h.size, (void *) (uintptr_t) h.base);
 
-  json_t *value;
-  err = json__decode_utf8(&dec, &value);
-  if (err < 0) return err;
+  if (image == NULL) image = MapViewOfFile(mapping, FILE_MAP_COPY, 0, 0, (SIZE_T) h.size);
 
-  if (dec.value != dec.end) {
-    json_deref(value);
+  CloseHandle(mapping);
+
+  if (image == NULL) return -1;
+#else
+  int fd = open(path, O_RDONLY);
+
+  if (fd < 0) return -1;
+
+  struct stat st;
+
+  if (fstat(fd, &st) < 0 || read(fd, &h, sizeof(h)) != sizeof(h) || !json__image_valid(&h, (size_t) st.st_size)) {
+    close(fd);
 
     return -1;
   }
 
-  *result = value;
+  // Private copies of the pages are made as pointers are relocated or the
+  // reference count of the root changes. The preferred base is only a hint.
+  image = mmap((void *) (uintptr_t) h.base, h.size, PROT_READ | PROT_WRITE, MAP_PRIVATE, fd, 0);
 
-  return err;
-}
+  close(fd);
 
-int
-json_decode_utf16le(const utf16_t *buffer, size_t len, json_t **result) {
-  return -1;
+  if (image == MAP_FAILED) return -1;
+#endif
+
+  ((json_image_header_t *) image)->mapped = 1;
+
+  return json__image_open(image, result);
 }
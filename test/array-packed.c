@@ -0,0 +1,70 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utf.h>
+
+#include "../include/json.h"
+
+int
+main() {
+  int e;
+
+  json_t *ints;
+  e = json_decode_utf8((utf8_t *) "[1, -2, 3]", -1, &ints);
+  assert(e == 0);
+
+  const int64_t *i64 = json_array_int64_values(ints);
+  assert(i64);
+  assert(json_array_double_values(ints) == NULL);
+  assert(i64[0] == 1 && i64[1] == -2 && i64[2] == 3);
+
+  json_t *doubles;
+  e = json_decode_utf8((utf8_t *) "[1, 2.5, -0.25]", -1, &doubles);
+  assert(e == 0);
+
+  const double *f64 = json_array_double_values(doubles);
+  assert(f64);
+  assert(f64[0] == 1 && f64[1] == 2.5 && f64[2] == -0.25);
+
+  json_t *mixed;
+  e = json_decode_utf8((utf8_t *) "[1, \"a\"]", -1, &mixed);
+  assert(e == 0);
+
+  assert(json_array_int64_values(mixed) == NULL);
+  assert(json_array_double_values(mixed) == NULL);
+
+  json_t *v = json_array_get(doubles, 1);
+  assert(json_number_value(v) == 2.5);
+  json_deref(v);
+
+  utf8_t *encoded;
+  e = json_encode_utf8(ints, &encoded);
+  assert(e == 0);
+  assert(strcmp((char *) encoded, "[1,-2,3]") == 0);
+  free(encoded);
+
+  e = json_encode_utf8(doubles, &encoded);
+  assert(e == 0);
+  assert(strcmp((char *) encoded, "[1,2.5,-0.25]") == 0);
+  free(encoded);
+
+  e = json_create_string_utf8((utf8_t *) "b", -1, &v);
+  assert(e == 0);
+
+  e = json_array_set(ints, 1, v);
+  assert(e == 0);
+
+  json_deref(v);
+
+  assert(json_array_int64_values(ints) == NULL);
+
+  e = json_encode_utf8(ints, &encoded);
+  assert(e == 0);
+  assert(strcmp((char *) encoded, "[1,\"b\",3]") == 0);
+  free(encoded);
+
+  json_deref(ints);
+  json_deref(doubles);
+  json_deref(mixed);
+}
@@ -0,0 +1,75 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utf.h>
+
+#include "../include/json.h"
+
+int
+main() {
+  int e;
+
+  json_t *array;
+  e = json_create_array(0, &array);
+  assert(e == 0);
+
+  json_t *v;
+
+  for (int64_t i = 0; i < 1000; i++) {
+    e = json_create_number_int64(i, &v);
+    assert(e == 0);
+
+    e = json_array_push(array, v);
+    assert(e == 0);
+
+    json_deref(v);
+  }
+
+  assert(json_array_size(array) == 1000);
+
+  e = json_create_string_utf8((utf8_t *) "first", -1, &v);
+  assert(e == 0);
+
+  e = json_array_insert(array, 0, v);
+  assert(e == 0);
+
+  json_deref(v);
+
+  assert(json_array_size(array) == 1001);
+
+  v = json_array_get(array, 0);
+  assert(json_is_string(v));
+  json_deref(v);
+
+  v = json_array_get(array, 1000);
+  assert(json_number_int64_value(v) == 999);
+  json_deref(v);
+
+  json_deref(array);
+
+  e = json_decode_utf8((utf8_t *) "[1.5]", -1, &array);
+  assert(e == 0);
+
+  e = json_array_reserve(array, 16);
+  assert(e == 0);
+
+  e = json_create_number(2.5, &v);
+  assert(e == 0);
+
+  e = json_array_push(array, v);
+  assert(e == 0);
+
+  json_deref(v);
+
+  const double *f64 = json_array_double_values(array);
+  assert(f64 && f64[0] == 1.5 && f64[1] == 2.5);
+
+  utf8_t *encoded;
+  e = json_encode_utf8(array, &encoded);
+  assert(e == 0);
+  assert(strcmp((char *) encoded, "[1.5,2.5]") == 0);
+  free(encoded);
+
+  json_deref(array);
+}
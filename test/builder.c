@@ -0,0 +1,84 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utf.h>
+
+#include "../include/json.h"
+
+int
+main() {
+  int e;
+
+  json_builder_t *builder;
+  e = json_create_builder(&builder);
+  assert(e == 0);
+
+  e = json_builder_begin_object(builder);
+  assert(e == 0);
+
+  e = json_builder_key_utf8(builder, (utf8_t *) "a", -1);
+  assert(e == 0);
+
+  e = json_builder_begin_array(builder);
+  assert(e == 0);
+
+  for (int i = 0; i < 100; i++) {
+    e = json_builder_number_int64(builder, i);
+    assert(e == 0);
+  }
+
+  e = json_builder_end_array(builder);
+  assert(e == 0);
+
+  e = json_builder_key_utf8(builder, (utf8_t *) "b", -1);
+  assert(e == 0);
+
+  e = json_builder_begin_object(builder);
+  assert(e == 0);
+
+  e = json_builder_key_utf8(builder, (utf8_t *) "c", -1);
+  assert(e == 0);
+
+  e = json_builder_string_utf8(builder, (utf8_t *) "d", -1);
+  assert(e == 0);
+
+  e = json_builder_end_object(builder);
+  assert(e == 0);
+
+  // A key is expected, not a value
+  e = json_builder_null(builder);
+  assert(e == -1);
+
+  e = json_builder_end_object(builder);
+  assert(e == 0);
+
+  json_t *value;
+  e = json_builder_finish(builder, &value);
+  assert(e == 0);
+
+  assert(json_object_size(value) == 2);
+
+  json_t *a = json_object_get_literal_utf8(value, (utf8_t *) "a", -1);
+  assert(a && json_array_size(a) == 100);
+  json_deref(a);
+
+  utf8_t *encoded;
+  e = json_encode_utf8(value, &encoded);
+  assert(e == 0);
+  assert(strcmp((char *) encoded + strlen((char *) encoded) - 16, "],\"b\":{\"c\":\"d\"}}") == 0);
+  free(encoded);
+
+  json_deref(value);
+
+  // Unbalanced documents are rejected and released with the builder
+  e = json_builder_begin_array(builder);
+  assert(e == 0);
+
+  e = json_builder_boolean(builder, true);
+  assert(e == 0);
+
+  e = json_builder_finish(builder, &value);
+  assert(e == -1);
+
+  json_destroy_builder(builder);
+}
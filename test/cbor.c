@@ -0,0 +1,242 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utf.h>
+
+#include "../include/json.h"
+
+int
+main() {
+  int e;
+
+  const char *input = "{\"a\":[1,-2,300,-70000,4294967296],\"b\":[0.5,1.5e300,0.1],\"c\":\"d\",\"e\":[true,false,null,{\"f\":[]}],\"g\":18446744073709551615,\"h\":-9223372036854775808,\"i\":[1,2.5,\"j\",[3]],\"k\":[0.5,3,{}]}";
+
+  json_t *value;
+  e = json_decode_utf8((utf8_t *) input, -1, &value);
+  assert(e == 0);
+
+  uint8_t *encoded;
+  size_t len;
+  e = json_encode_cbor(value, &encoded, &len);
+  assert(e == 0);
+
+  json_t *decoded;
+  e = json_decode_cbor(encoded, len, &decoded);
+  assert(e == 0);
+  assert(json_equal(value, decoded));
+
+  json_t *g = json_object_get_literal_utf8(decoded, (utf8_t *) "g", -1);
+  assert(json_number_is_uint64(g));
+  json_deref(g);
+
+  json_deref(decoded);
+
+  // Truncated input is rejected
+  for (size_t i = 0; i < len; i++) {
+    e = json_decode_cbor(encoded, i, &decoded);
+    assert(e == -1);
+  }
+
+  free(encoded);
+  json_deref(value);
+
+  // Floats take the narrowest width that holds them exactly
+  {
+    json_t *number;
+    e = json_create_number(1.5, &number);
+    assert(e == 0);
+
+    e = json_encode_cbor(number, &encoded, &len);
+    assert(e == 0);
+    assert(len == 3 && encoded[0] == 0xf9 && encoded[1] == 0x3e && encoded[2] == 0x00);
+    free(encoded);
+    json_deref(number);
+
+    e = json_create_number(100000.0, &number);
+    assert(e == 0);
+
+    e = json_encode_cbor(number, &encoded, &len);
+    assert(e == 0);
+    assert(len == 5 && encoded[0] == 0xfa);
+    free(encoded);
+    json_deref(number);
+
+    e = json_create_number(0.1, &number);
+    assert(e == 0);
+
+    e = json_encode_cbor(number, &encoded, &len);
+    assert(e == 0);
+    assert(len == 9 && encoded[0] == 0xfb);
+
+    json_t *copy;
+    e = json_decode_cbor(encoded, len, &copy);
+    assert(e == 0);
+    assert(json_number_value(copy) == 0.1);
+    assert(!json_number_is_int64(copy));
+    json_deref(copy);
+
+    free(encoded);
+    json_deref(number);
+  }
+
+  // Mixed integers and floats keep their kinds
+  {
+    json_t *array;
+    e = json_create_array(0, &array);
+    assert(e == 0);
+
+    json_t *number;
+    e = json_create_number_int64(3, &number);
+    assert(e == 0);
+    e = json_array_push(array, number);
+    assert(e == 0);
+    json_deref(number);
+
+    e = json_create_number(0.5, &number);
+    assert(e == 0);
+    e = json_array_push(array, number);
+    assert(e == 0);
+    json_deref(number);
+
+    e = json_create_number_int64(INT64_C(9007199254740993), &number);
+    assert(e == 0);
+    e = json_array_push(array, number);
+    assert(e == 0);
+    json_deref(number);
+
+    for (int reversed = 0; reversed < 2; reversed++) {
+      e = json_encode_cbor(array, &encoded, &len);
+      assert(e == 0);
+
+      e = json_decode_cbor(encoded, len, &decoded);
+      assert(e == 0);
+      assert(json_equal(array, decoded));
+
+      assert(json_number_int64_value(json_array_peek(decoded, 2)) == INT64_C(9007199254740993));
+
+      // Integers are encoded as integers again rather than as floats
+      uint8_t *reencoded;
+      size_t reencoded_len;
+      e = json_encode_cbor(decoded, &reencoded, &reencoded_len);
+      assert(e == 0);
+      assert(reencoded_len == len && memcmp(reencoded, encoded, len) == 0);
+      free(reencoded);
+
+      json_deref(decoded);
+      free(encoded);
+
+      // Start with a float the second time around
+      json_t *first = json_array_get(array, 0);
+
+      e = json_array_set(array, 0, (json_t *) json_array_peek(array, 1));
+      assert(e == 0);
+      e = json_array_set(array, 1, first);
+      assert(e == 0);
+      json_deref(first);
+    }
+
+    json_deref(array);
+  }
+
+  // Integers take the shortest head
+  {
+    json_t *number;
+    e = json_create_number_int64(-500, &number);
+    assert(e == 0);
+
+    e = json_encode_cbor(number, &encoded, &len);
+    assert(e == 0);
+    assert(len == 3 && encoded[0] == 0x39 && encoded[1] == 0x01 && encoded[2] == 0xf3);
+    free(encoded);
+    json_deref(number);
+  }
+
+  // Tags are skipped, and subnormal halves and undefined decode
+  {
+    const uint8_t input[] = {0x83, 0xc1, 0x1a, 0x00, 0x01, 0x00, 0x00, 0xf9, 0x00, 0x01, 0xf7};
+
+    e = json_decode_cbor(input, sizeof(input), &decoded);
+    assert(e == 0);
+    assert(json_array_size(decoded) == 3);
+
+    json_t *n = json_array_get(decoded, 1);
+    assert(json_number_value(n) == 1.0 / 16777216.0);
+    json_deref(n);
+
+    json_deref(decoded);
+  }
+
+  // Byte strings, indefinite lengths and non-string keys are rejected
+  {
+    const uint8_t bytes[] = {0x41, 0x00};
+    assert(json_decode_cbor(bytes, sizeof(bytes), &decoded) == -1);
+
+    const uint8_t indefinite[] = {0x9f, 0xff};
+    assert(json_decode_cbor(indefinite, sizeof(indefinite), &decoded) == -1);
+
+    const uint8_t key[] = {0xa1, 0x01, 0x02};
+    assert(json_decode_cbor(key, sizeof(key), &decoded) == -1);
+
+    // A length far beyond the input doesn't allocate
+    const uint8_t huge[] = {0x9b, 0x7f, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff, 0xff};
+    assert(json_decode_cbor(huge, sizeof(huge), &decoded) == -1);
+  }
+
+  // Text strings must be valid UTF-8
+  {
+    const uint8_t truncated[] = {0x62, 0xc3, 0x28};
+    assert(json_decode_cbor(truncated, sizeof(truncated), &decoded) == -1);
+
+    const uint8_t overlong[] = {0x62, 0xc0, 0xaf};
+    assert(json_decode_cbor(overlong, sizeof(overlong), &decoded) == -1);
+
+    const uint8_t surrogate[] = {0x63, 0xed, 0xa0, 0x80};
+    assert(json_decode_cbor(surrogate, sizeof(surrogate), &decoded) == -1);
+
+    const uint8_t valid[] = {0x64, 0xf0, 0x9f, 0x98, 0x80};
+    assert(json_decode_cbor(valid, sizeof(valid), &decoded) == 0);
+    json_deref(decoded);
+  }
+
+  // Containers longer than their initial storage grow as items arrive
+  {
+    const char *input = "[[0,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19,20],[0.5,1,2,3,4,5,6,7,8,9,10,11,12,13,14,15,16,17,18,19],[\"a\",\"b\",\"c\",\"d\",\"e\",\"f\",\"g\",\"h\",\"i\",\"j\",\"k\",\"l\",\"m\",\"n\",\"o\",\"p\",\"q\"],{\"a\":1,\"b\":2,\"c\":3,\"d\":4,\"e\":5,\"f\":6,\"g\":7,\"h\":8,\"i\":9,\"j\":10,\"k\":11,\"l\":12,\"m\":13,\"n\":14,\"o\":15,\"p\":16,\"q\":17}]";
+
+    e = json_decode_utf8((utf8_t *) input, -1, &value);
+    assert(e == 0);
+
+    e = json_encode_cbor(value, &encoded, &len);
+    assert(e == 0);
+
+    e = json_decode_cbor(encoded, len, &decoded);
+    assert(e == 0);
+    assert(json_equal(value, decoded));
+
+    json_deref(decoded);
+    json_deref(value);
+    free(encoded);
+  }
+
+  // Nested containers each claiming the rest of the input don't reserve it
+  {
+    size_t depth = 100000;
+
+    uint8_t *nested = malloc(5 * depth);
+    assert(nested);
+
+    for (size_t i = 0; i < depth; i++) {
+      uint32_t claimed = (uint32_t) (5 * (depth - i - 1));
+
+      nested[5 * i] = 0x9a;
+      nested[5 * i + 1] = (uint8_t) (claimed >> 24);
+      nested[5 * i + 2] = (uint8_t) (claimed >> 16);
+      nested[5 * i + 3] = (uint8_t) (claimed >> 8);
+      nested[5 * i + 4] = (uint8_t) claimed;
+    }
+
+    assert(json_decode_cbor(nested, 5 * depth, &decoded) == -1);
+
+    free(nested);
+  }
+}
@@ -0,0 +1,67 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utf.h>
+
+#include "../include/json.h"
+
+#define DEPTH 100000
+
+int
+main() {
+  int e;
+
+  utf8_t *input = malloc(DEPTH * 2 + 1);
+
+  memset(input, '[', DEPTH);
+  memset(input + DEPTH, ']', DEPTH);
+  input[DEPTH * 2] = '\0';
+
+  json_t *value;
+  e = json_decode_utf8(input, -1, &value);
+  assert(e == 0);
+
+  utf8_t *output;
+  e = json_encode_utf8(value, &output);
+  assert(e == 0);
+
+  assert(strcmp((char *) output, (char *) input) == 0);
+
+  free(output);
+
+  json_deref(value);
+
+  json_decode_options_t options = {
+    .max_depth = DEPTH - 1,
+  };
+
+  e = json_decode_utf8_with_options(input, -1, &options, &value);
+  assert(e == -1);
+
+  options.max_depth = DEPTH;
+
+  e = json_decode_utf8_with_options(input, -1, &options, &value);
+  assert(e == 0);
+
+  json_deref(value);
+
+  // Unbalanced input releases everything decoded so far
+  input[DEPTH * 2 - 1] = '\0';
+
+  e = json_decode_utf8(input, -1, &value);
+  assert(e == -1);
+
+  e = json_decode_utf8((utf8_t *) "[1,2.5,\"a\",[3,{\"b\":[4]}],{}]", -1, &value);
+  assert(e == 0);
+
+  e = json_encode_utf8(value, &output);
+  assert(e == 0);
+
+  assert(strcmp((char *) output, "[1,2.5,\"a\",[3,{\"b\":[4]}],{}]") == 0);
+
+  free(output);
+
+  json_deref(value);
+
+  free(input);
+}
@@ -0,0 +1,52 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utf.h>
+
+#include "../include/json.h"
+
+int
+main() {
+  int e;
+
+  const char *input = "{\"a\":[1,2,3],\"b\":{\"c\":\"d\"}}";
+
+  // Trailing newlines are accepted
+  FILE *file = fopen("decode-utf8-file.json", "wb");
+  assert(file);
+  assert(fwrite(input, 1, strlen(input), file) == strlen(input));
+  assert(fputc('\n', file) == '\n');
+  fclose(file);
+
+  json_t *value;
+  e = json_decode_file_utf8("decode-utf8-file.json", NULL, &value);
+  assert(e == 0);
+
+  utf8_t *encoded;
+  e = json_encode_utf8(value, &encoded);
+  assert(e == 0);
+  assert(strcmp((char *) encoded, input) == 0);
+  free(encoded);
+
+  json_deref(value);
+
+  // Options are passed through
+  json_decode_options_t options = {.max_depth = 1};
+
+  e = json_decode_file_utf8("decode-utf8-file.json", &options, &value);
+  assert(e == -1);
+
+  // Empty files aren't valid documents
+  file = fopen("decode-utf8-file.json", "wb");
+  assert(file);
+  fclose(file);
+
+  e = json_decode_file_utf8("decode-utf8-file.json", NULL, &value);
+  assert(e == -1);
+
+  remove("decode-utf8-file.json");
+
+  e = json_decode_file_utf8("decode-utf8-file.json", NULL, &value);
+  assert(e == -1);
+}
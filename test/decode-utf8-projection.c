@@ -0,0 +1,82 @@
+#include <assert.h>
+#include <stdint.h>
+#include <utf.h>
+
+#include "../include/json.h"
+
+static const char *document =
+  "{\"id\":7,\"user\":{\"name\":\"x\",\"tags\":[\"a\",\"b\"],\"bio\":\"long\"},"
+  "\"items\":[{\"n\":1},{\"n\":2},{\"n\":3}],\"ignored\":[1,{\"deep\":[true]}],\"last\":1.5}";
+
+static void
+check(const char **pointers, size_t len, const char *expected) {
+  int e;
+
+  json_pointer_t *compiled[8];
+
+  for (size_t i = 0; i < len; i++) {
+    e = json_create_pointer_utf8((const utf8_t *) pointers[i], -1, &compiled[i]);
+    assert(e == 0);
+  }
+
+  json_decode_options_t options = {
+    .projection = (const json_pointer_t *const *) compiled,
+    .projection_len = len,
+  };
+
+  json_t *value;
+  e = json_decode_utf8_with_options((const utf8_t *) document, -1, &options, &value);
+  assert(e == 0);
+
+  json_t *want;
+  e = json_decode_utf8((const utf8_t *) expected, -1, &want);
+  assert(e == 0);
+
+  assert(json_equal(value, want));
+
+  json_deref(value);
+  json_deref(want);
+
+  for (size_t i = 0; i < len; i++) json_destroy_pointer(compiled[i]);
+}
+
+int
+main() {
+  int e;
+
+  check((const char *[]) {"/id"}, 1, "{\"id\":7}");
+  check((const char *[]) {"/user/name", "/last"}, 2, "{\"user\":{\"name\":\"x\"},\"last\":1.5}");
+  check((const char *[]) {"/user/tags"}, 1, "{\"user\":{\"tags\":[\"a\",\"b\"]}}");
+  check((const char *[]) {"/items/1/n", "/items/2"}, 2, "{\"items\":[{\"n\":2},{\"n\":3}]}");
+  check((const char *[]) {"/user", "/user/name"}, 2, "{\"user\":{\"name\":\"x\",\"tags\":[\"a\",\"b\"],\"bio\":\"long\"}}");
+  check((const char *[]) {"/id/x", "/missing"}, 2, "{}");
+  check((const char *[]) {""}, 1, document);
+
+  // Skipped parts are still validated
+  json_pointer_t *pointer;
+  e = json_create_pointer_utf8((const utf8_t *) "/a", -1, &pointer);
+  assert(e == 0);
+
+  json_decode_options_t options = {
+    .projection = (const json_pointer_t *const *) &pointer,
+    .projection_len = 1,
+  };
+
+  json_t *value;
+  e = json_decode_utf8_with_options((const utf8_t *) "{\"a\":1,\"b\":[1,}", -1, &options, &value);
+  assert(e == -1);
+
+  e = json_decode_utf8_with_options((const utf8_t *) "{\"b\":{\"c\":[1,2]},\"a\":[3,4.5]}", -1, &options, &value);
+  assert(e == 0);
+
+  json_t *want;
+  e = json_decode_utf8((const utf8_t *) "{\"a\":[3,4.5]}", -1, &want);
+  assert(e == 0);
+
+  assert(json_equal(value, want));
+
+  json_deref(value);
+  json_deref(want);
+
+  json_destroy_pointer(pointer);
+}
@@ -0,0 +1,30 @@
+#include <assert.h>
+#include <utf.h>
+
+#include "../include/json.h"
+
+int
+main() {
+  int e;
+
+  json_t *actual;
+  e = json_decode_utf8((utf8_t *) "\"A\\u00e9\\u6771\\ud83d\\ude00\"", -1, &actual);
+  assert(e == 0);
+
+  json_t *expected;
+  e = json_create_string_utf8((utf8_t *) "A\xc3\xa9\xe6\x9d\xb1\xf0\x9f\x98\x80", -1, &expected);
+  assert(e == 0);
+
+  e = json_compare(actual, expected);
+  assert(e == 0);
+
+  // Unpaired surrogates and malformed escapes are rejected
+  e = json_decode_utf8((utf8_t *) "\"\\ud83d\"", -1, &actual);
+  assert(e == -1);
+
+  e = json_decode_utf8((utf8_t *) "\"\\ude00\"", -1, &actual);
+  assert(e == -1);
+
+  e = json_decode_utf8((utf8_t *) "\"\\u00g0\"", -1, &actual);
+  assert(e == -1);
+}
@@ -0,0 +1,58 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <utf.h>
+
+#include "../include/json.h"
+
+int
+main() {
+  int e;
+
+  json_builder_t *builder;
+  e = json_create_builder(&builder);
+  assert(e == 0);
+
+  const utf16_t key[] = {'k'};
+  const utf16_t string[] = {'a', '"', '\n', 0x1, 0xe9, 0xd83d, 0xde00};
+
+  assert(json_builder_begin_object(builder) == 0);
+  assert(json_builder_key_utf16le(builder, key, 1) == 0);
+  assert(json_builder_begin_array(builder) == 0);
+  assert(json_builder_string_utf16le(builder, string, 7) == 0);
+  assert(json_builder_boolean(builder, true) == 0);
+  assert(json_builder_boolean(builder, false) == 0);
+  assert(json_builder_null(builder) == 0);
+  assert(json_builder_number_int64(builder, -12) == 0);
+  assert(json_builder_end_array(builder) == 0);
+  assert(json_builder_end_object(builder) == 0);
+
+  json_t *value;
+  e = json_builder_finish(builder, &value);
+  assert(e == 0);
+
+  json_destroy_builder(builder);
+
+  utf16_t *encoded;
+  e = json_encode_utf16le(value, &encoded);
+  assert(e == 0);
+
+  // Everything but the non-ASCII characters of the string is ASCII
+  const char *ascii = "{\"k\":[\"a\\\"\\n\\u0001\xff\xff\xff\",true,false,null,-12]}";
+  const utf16_t other[] = {0xe9, 0xd83d, 0xde00};
+
+  size_t i = 0, j = 0;
+
+  for (; ascii[i]; i++) {
+    if ((unsigned char) ascii[i] == 0xff) {
+      assert(encoded[i] == other[j++]);
+    } else {
+      assert(encoded[i] == (utf16_t) ascii[i]);
+    }
+  }
+
+  assert(encoded[i] == 0);
+
+  free(encoded);
+
+  json_deref(value);
+}
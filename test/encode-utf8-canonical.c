@@ -0,0 +1,46 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utf.h>
+
+#include "../include/json.h"
+
+static json_encode_options_t options = {
+  .indent = 2,
+  .canonical = true,
+};
+
+static void
+check(const char *input, const char *expected) {
+  int e;
+
+  json_t *value;
+  e = json_decode_utf8((utf8_t *) input, -1, &value);
+  assert(e == 0);
+
+  utf8_t *output;
+  e = json_encode_utf8_with_options(value, &options, &output);
+  assert(e == 0);
+
+  assert(strcmp((char *) output, expected) == 0);
+
+  free(output);
+
+  json_deref(value);
+}
+
+int
+main() {
+  // Property sorting from RFC 8785, section 3.2.3
+  check(
+    "{\"\xe2\x82\xac\":\"Euro Sign\",\"\\r\":\"Carriage Return\",\"\xef\xac\xb3\":\"Hebrew Letter Dalet With Dagesh\",\"1\":\"One\",\"\xf0\x9f\x98\x80\":\"Emoji: Grinning Face\",\"\xc2\x80\":\"Control\",\"\xc3\xb6\":\"Latin Small Letter O With Diaeresis\"}",
+    "{\"\\r\":\"Carriage Return\",\"1\":\"One\",\"\xc2\x80\":\"Control\",\"\xc3\xb6\":\"Latin Small Letter O With Diaeresis\",\"\xe2\x82\xac\":\"Euro Sign\",\"\xf0\x9f\x98\x80\":\"Emoji: Grinning Face\",\"\xef\xac\xb3\":\"Hebrew Letter Dalet With Dagesh\"}"
+  );
+
+  check("{\"b\":[3,{\"d\":1,\"c\":2}],\"a\":{}}", "{\"a\":{},\"b\":[3,{\"c\":2,\"d\":1}]}");
+
+  // Number serialization from RFC 8785, appendix B
+  check("[0,-0,1e21,1e-7,0.000001,333333333.3333333,1e23,5e-324,-1.5,100]", "[0,0,1e+21,1e-7,0.000001,333333333.3333333,1e+23,5e-324,-1.5,100]");
+  check("[1.0,9007199254740993,18446744073709551615]", "[1,9007199254740992,18446744073709552000]");
+  check("[4.5,0.1]", "[4.5,0.1]");
+}
@@ -0,0 +1,29 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utf.h>
+
+#include "../include/json.h"
+
+int
+main() {
+  int e;
+
+  // Null and booleans are static nodes, which must never be mistaken for
+  // tagged integers.
+  json_t *value;
+  e = json_decode_utf8((utf8_t *) "[true,false,null]", -1, &value);
+  assert(e == 0);
+
+  assert(json_is_boolean(json_array_peek(value, 0)));
+  assert(json_is_boolean(json_array_peek(value, 1)));
+  assert(json_is_null(json_array_peek(value, 2)));
+
+  utf8_t *encoded;
+  e = json_encode_utf8(value, &encoded);
+  assert(e == 0);
+  assert(strcmp((char *) encoded, "[true,false,null]") == 0);
+  free(encoded);
+
+  json_deref(value);
+}
@@ -0,0 +1,83 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utf.h>
+
+#include "../include/json.h"
+
+int
+main() {
+  int e;
+
+  json_t *value;
+  e = json_decode_utf8((utf8_t *) "{\"a\":[1,2],\"b\":{\"c\":[]},\"d\":[\"x\",{}],\"e\":\"caf\xc3\xa9 \xf0\x9f\x98\x80\\n\"}", -1, &value);
+  assert(e == 0);
+
+  utf8_t *output;
+
+  json_encode_options_t options = {
+    .indent = 2,
+    .spacing = true,
+  };
+
+  e = json_encode_utf8_with_options(value, &options, &output);
+  assert(e == 0);
+
+  assert(strcmp(
+           (char *) output,
+           "{\n"
+           "  \"a\": [\n"
+           "    1,\n"
+           "    2\n"
+           "  ],\n"
+           "  \"b\": {\n"
+           "    \"c\": []\n"
+           "  },\n"
+           "  \"d\": [\n"
+           "    \"x\",\n"
+           "    {}\n"
+           "  ],\n"
+           "  \"e\": \"caf\xc3\xa9 \xf0\x9f\x98\x80\\n\"\n"
+           "}"
+         ) == 0);
+
+  free(output);
+
+  options = (json_encode_options_t) {
+    .spacing = true,
+    .ascii_only = true,
+  };
+
+  e = json_encode_utf8_with_options(value, &options, &output);
+  assert(e == 0);
+
+  assert(strcmp((char *) output, "{\"a\": [1, 2], \"b\": {\"c\": []}, \"d\": [\"x\", {}], \"e\": \"caf\\u00e9 \\ud83d\\ude00\\n\"}") == 0);
+
+  free(output);
+
+  options = (json_encode_options_t) {
+    .indent = 1,
+    .newline = json_newline_crlf,
+  };
+
+  json_t *array;
+  e = json_decode_utf8((utf8_t *) "[[true]]", -1, &array);
+  assert(e == 0);
+
+  e = json_encode_utf8_with_options(array, &options, &output);
+  assert(e == 0);
+
+  assert(strcmp((char *) output, "[\r\n [\r\n  true\r\n ]\r\n]") == 0);
+
+  free(output);
+
+  e = json_encode_utf8(value, &output);
+  assert(e == 0);
+
+  assert(strcmp((char *) output, "{\"a\":[1,2],\"b\":{\"c\":[]},\"d\":[\"x\",{}],\"e\":\"caf\xc3\xa9 \xf0\x9f\x98\x80\\n\"}") == 0);
+
+  free(output);
+
+  json_deref(array);
+  json_deref(value);
+}
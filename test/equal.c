@@ -0,0 +1,103 @@
+#include <assert.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <utf.h>
+
+#include "../include/json.h"
+
+static json_t *
+decode(const char *input) {
+  json_t *value;
+
+  int e = json_decode_utf8((const utf8_t *) input, -1, &value);
+  assert(e == 0);
+
+  return value;
+}
+
+static bool
+equal(const char *a, const char *b) {
+  json_t *x = decode(a), *y = decode(b);
+
+  bool result = json_equal(x, y);
+
+  assert(result == (json_compare(x, y) == 0));
+  assert(json_compare(x, y) == -json_compare(y, x));
+
+  json_deref(x);
+  json_deref(y);
+
+  return result;
+}
+
+static int
+compare(const char *a, const char *b) {
+  json_t *x = decode(a), *y = decode(b);
+
+  int result = json_compare(x, y);
+
+  json_deref(x);
+  json_deref(y);
+
+  return result;
+}
+
+int
+main() {
+  assert(equal("[1,2,3]", "[1.0,2,3]"));
+  assert(!equal("[1,2,3]", "[1,2]"));
+  assert(!equal("[1,2,3]", "[1,2,4]"));
+  assert(!equal("[1,2]", "{\"a\":1}"));
+
+  // Property order doesn't matter
+  assert(equal("{\"a\":1,\"b\":[true,null]}", "{\"b\":[true,null],\"a\":1}"));
+  assert(!equal("{\"a\":1,\"b\":2}", "{\"a\":1,\"c\":2}"));
+  assert(!equal("{\"a\":1,\"b\":2}", "{\"b\":1,\"a\":2}"));
+
+  // Large objects with shuffled properties are compared through an index
+  assert(equal(
+    "{\"a\":1,\"b\":2,\"c\":3,\"d\":4,\"e\":5,\"f\":6,\"g\":7,\"h\":8,\"i\":9,\"j\":10}",
+    "{\"j\":10,\"i\":9,\"h\":8,\"g\":7,\"f\":6,\"e\":5,\"d\":4,\"c\":3,\"b\":2,\"a\":1}"
+  ));
+  assert(!equal(
+    "{\"a\":1,\"b\":2,\"c\":3,\"d\":4,\"e\":5,\"f\":6,\"g\":7,\"h\":8,\"i\":9,\"j\":10}",
+    "{\"j\":10,\"i\":9,\"h\":8,\"g\":7,\"f\":6,\"e\":5,\"d\":4,\"c\":3,\"b\":2,\"k\":1}"
+  ));
+
+  // Ordering
+  assert(compare("null", "false") < 0);
+  assert(compare("false", "true") < 0);
+  assert(compare("1", "2.5") < 0);
+  assert(compare("\"ab\"", "\"b\"") < 0);
+  assert(compare("\"a\"", "\"ab\"") < 0);
+  assert(compare("[1,2]", "[1,2,0]") < 0);
+  assert(compare("[1,3]", "[1,2,0]") > 0);
+  assert(compare("{\"b\":1,\"a\":2}", "{\"a\":2,\"b\":2}") < 0);
+  assert(compare("{\"a\":1}", "{\"b\":0}") < 0);
+
+  // Deep nesting doesn't recurse
+  char deep[2 * 100000 + 1];
+
+  for (int i = 0; i < 100000; i++) {
+    deep[i] = '[';
+    deep[2 * 100000 - 1 - i] = ']';
+  }
+
+  deep[2 * 100000] = '\0';
+
+  json_decode_options_t options = {.max_depth = 0};
+
+  json_t *x, *y;
+
+  int e = json_decode_utf8_with_options((const utf8_t *) deep, -1, &options, &x);
+  assert(e == 0);
+
+  e = json_decode_utf8_with_options((const utf8_t *) deep, -1, &options, &y);
+  assert(e == 0);
+
+  assert(json_equal(x, y));
+  assert(json_compare(x, y) == 0);
+
+  json_deref(x);
+  json_deref(y);
+}
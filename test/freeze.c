@@ -0,0 +1,110 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utf.h>
+
+#include "../include/json.h"
+
+int
+main() {
+  int e;
+
+  const char *input = "{\"a\":[\"b\",1.5,{\"c\":null}],\"d\":[1,2,3],\"e\":\"f\",\"g\":12345678901234567890}";
+
+  json_t *value;
+  e = json_decode_utf8((utf8_t *) input, -1, &value);
+  assert(e == 0);
+
+  json_t *frozen;
+  e = json_freeze(value, &frozen);
+  assert(e == 0);
+
+  json_deref(value);
+
+  assert(json_is_frozen(frozen));
+
+  utf8_t *encoded;
+  e = json_encode_utf8(frozen, &encoded);
+  assert(e == 0);
+  assert(strcmp((char *) encoded, input) == 0);
+  free(encoded);
+
+  json_t *a = json_object_get_literal_utf8(frozen, (utf8_t *) "a", -1);
+  assert(a);
+  assert(json_is_frozen(a));
+
+  // Interior references are not counted
+  assert(json_ref(a) == 1);
+  assert(json_deref(a) == 1);
+  json_deref(a);
+
+  json_t *v;
+  e = json_create_boolean(true, &v);
+  assert(e == 0);
+
+  e = json_array_set(a, 0, v);
+  assert(e == -1);
+
+  e = json_array_push(a, v);
+  assert(e == -1);
+
+  e = json_object_set_literal_utf8(frozen, (utf8_t *) "h", -1, v);
+  assert(e == -1);
+
+  e = json_object_delete_literal_utf8(frozen, (utf8_t *) "a", -1);
+  assert(e == -1);
+
+  assert(json_ref(frozen) == 2);
+  assert(json_deref(frozen) == 1);
+
+  // Subtrees stored elsewhere outlive the frozen tree
+  {
+    json_t *holder;
+    e = json_create_object(0, &holder);
+    assert(e == 0);
+
+    e = json_object_set_literal_utf8(holder, (utf8_t *) "a", -1, a);
+    assert(e == 0);
+
+    json_deref(frozen);
+
+    e = json_encode_utf8(holder, &encoded);
+    assert(e == 0);
+    assert(strcmp((char *) encoded, "{\"a\":[\"b\",1.5,{\"c\":null}]}") == 0);
+    free(encoded);
+
+    json_deref(holder);
+  }
+
+  // Deep trees don't exhaust the call stack
+  {
+    size_t depth = 100000;
+
+    char *deep = malloc(2 * depth + 1);
+    assert(deep);
+
+    for (size_t i = 0; i < depth; i++) {
+      deep[i] = '[';
+      deep[2 * depth - 1 - i] = ']';
+    }
+
+    deep[2 * depth] = '\0';
+
+    json_decode_options_t options = {.max_depth = 0};
+
+    json_t *deep_value;
+    e = json_decode_utf8_with_options((utf8_t *) deep, -1, &options, &deep_value);
+    assert(e == 0);
+
+    free(deep);
+
+    json_t *deep_frozen;
+    e = json_freeze(deep_value, &deep_frozen);
+    assert(e == 0);
+
+    assert(json_equal(deep_value, deep_frozen));
+
+    json_deref(deep_value);
+    json_deref(deep_frozen);
+  }
+}
@@ -0,0 +1,137 @@
+#include <assert.h>
+#include <stdint.h>
+#include <utf.h>
+
+#include "../include/json.h"
+
+static uint64_t
+hash(const json_t *value) {
+  uint64_t result;
+
+  int e = json_hash(value, &result);
+  assert(e == 0);
+
+  return result;
+}
+
+static json_t *
+decode(const char *input) {
+  json_t *value;
+
+  int e = json_decode_utf8((const utf8_t *) input, -1, &value);
+  assert(e == 0);
+
+  return value;
+}
+
+int
+main() {
+  int e;
+
+  json_t *a = decode("{\"a\":[1,2,{\"b\":\"c\"}],\"d\":null,\"e\":[1.5,2]}");
+  json_t *b = decode("{\"e\":[1.5,2.0],\"d\":null,\"a\":[1.0,2,{\"b\":\"c\"}]}");
+
+  assert(hash(a) == hash(b));
+
+  // Cached hashes are invalidated by mutation
+  uint64_t before = hash(a);
+
+  json_t *inner = json_object_get_literal_utf8(a, (utf8_t *) "a", -1);
+  assert(inner);
+
+  json_t *number;
+  e = json_create_number(3, &number);
+  assert(e == 0);
+
+  e = json_array_push(inner, number);
+  assert(e == 0);
+
+  assert(hash(a) != before);
+
+  // Containers also held elsewhere are never trusted by their parents
+  uint64_t after = hash(a);
+
+  e = json_array_push(inner, number);
+  assert(e == 0);
+
+  assert(hash(a) != after);
+
+  e = json_array_delete(inner, 4);
+  assert(e == 0);
+
+  json_deref(inner);
+  json_deref(number);
+
+  assert(hash(a) != before);
+  assert(hash(a) != hash(b));
+
+  // Mutations deep below a container are observed by it, even when done
+  // through references that were taken and partly released since hashing
+  json_t *c = decode("{\"b\":{\"c\":[1]}}");
+
+  before = hash(c);
+
+  json_t *middle = json_object_get_literal_utf8(c, (utf8_t *) "b", -1);
+  assert(middle);
+
+  json_t *leaf = json_object_get_literal_utf8(middle, (utf8_t *) "c", -1);
+  assert(leaf);
+
+  json_deref(middle);
+
+  assert(hash(c) == before);
+
+  e = json_create_number(2, &number);
+  assert(e == 0);
+
+  e = json_array_push(leaf, number);
+  assert(e == 0);
+
+  json_deref(number);
+  json_deref(leaf);
+
+  assert(hash(c) != before);
+
+  json_deref(c);
+
+  // Packed and boxed arrays hash equally
+  json_t *packed = decode("[1,2,3]");
+
+  json_t *boxed;
+  e = json_create_array(3, &boxed);
+  assert(e == 0);
+
+  for (int i = 0; i < 3; i++) {
+    e = json_create_number(i + 1, &number);
+    assert(e == 0);
+
+    e = json_array_set(boxed, i, number);
+    assert(e == 0);
+
+    json_deref(number);
+  }
+
+  assert(hash(packed) == hash(boxed));
+
+  // Frozen trees are hashed when frozen
+  json_t *frozen;
+  e = json_freeze(b, &frozen);
+  assert(e == 0);
+
+  assert(hash(frozen) == hash(b));
+
+  json_t *x = decode("[1,[]]"), *y = decode("[1,{}]"), *z = decode("[{},1]");
+
+  assert(hash(x) != hash(y));
+  assert(hash(y) != hash(z));
+
+  json_deref(x);
+  json_deref(y);
+  json_deref(z);
+
+  json_deref(frozen);
+  json_deref(boxed);
+  json_deref(packed);
+  json_deref(b);
+  json_deref(a);
+}
@@ -0,0 +1,97 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utf.h>
+
+#include "../include/json.h"
+
+int
+main() {
+  int e;
+
+  const char *input = "[{\"a\":1,\"b\":\"c\"},{\"a\":2,\"b\":null},[1.5,true,false],12345678901234567890,[]]";
+
+  json_t *value;
+  e = json_decode_utf8((utf8_t *) input, -1, &value);
+  assert(e == 0);
+
+  uint8_t *image;
+  size_t len;
+  e = json_image_encode(value, &image, &len);
+  assert(e == 0);
+
+  json_t *decoded;
+  e = json_image_decode(image, len, &decoded);
+  assert(e == 0);
+  assert(json_is_frozen(decoded));
+  assert(json_equal(value, decoded));
+
+  // Hashes are computed on the image and match those of the source
+  uint64_t expected, actual;
+  e = json_hash(value, &expected);
+  assert(e == 0);
+  e = json_hash(decoded, &actual);
+  assert(e == 0);
+  assert(expected == actual);
+
+  utf8_t *encoded;
+  e = json_encode_utf8(decoded, &encoded);
+  assert(e == 0);
+  assert(strcmp((char *) encoded, input) == 0);
+  free(encoded);
+
+  json_deref(decoded);
+
+  // Truncated images are rejected
+  e = json_image_decode(image, 8, &decoded);
+  assert(e == -1);
+
+  FILE *file = fopen("image.bin", "wb");
+  assert(file);
+  assert(fwrite(image, 1, len, file) == len);
+  fclose(file);
+
+  free(image);
+
+  // The second image can't be mapped at the same address, so it is relocated
+  json_t *first;
+  e = json_image_load("image.bin", &first);
+  assert(e == 0);
+
+  json_t *second;
+  e = json_image_load("image.bin", &second);
+  assert(e == 0);
+
+  assert(json_equal(value, first));
+  assert(json_equal(value, second));
+
+  json_t *object = json_array_get(second, 1);
+  assert(object);
+
+  json_t *a = json_object_get_literal_utf8(object, (utf8_t *) "a", -1);
+  assert(a);
+  assert(json_is_number(a));
+
+  json_deref(first);
+  json_deref(second);
+
+  remove("image.bin");
+
+  // Scalar roots
+  json_t *scalar;
+  e = json_decode_utf8((utf8_t *) "true", -1, &scalar);
+  assert(e == 0);
+
+  e = json_image_encode(scalar, &image, &len);
+  assert(e == 0);
+
+  json_deref(scalar);
+
+  e = json_image_decode(image, len, &scalar);
+  assert(e == 0);
+  assert(json_is_boolean(scalar));
+  free(image);
+
+  json_deref(value);
+}
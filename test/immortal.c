@@ -0,0 +1,57 @@
+#include <assert.h>
+#include <stdlib.h>
+#include <utf.h>
+
+#include "../include/json.h"
+
+int
+main() {
+  int e;
+
+  json_t *value;
+  e = json_decode_utf8((utf8_t *) "{ \"a\": [\"b\", 1.5], \"c\": \"d\" }", -1, &value);
+  assert(e == 0);
+
+  assert(json_ref(value) == 2);
+  assert(json_deref(value) == 1);
+
+  e = json_set_immortal(value);
+  assert(e == 0);
+
+  assert(json_ref(value) == 1);
+  assert(json_deref(value) == 1);
+  assert(json_deref(value) == 1);
+
+  json_t *a = json_object_get_literal_utf8(value, (utf8_t *) "a", -1);
+  assert(a);
+
+  assert(json_ref(a) == 1);
+  assert(json_deref(a) == 1);
+
+  // Deep trees don't exhaust the call stack
+  {
+    size_t depth = 100000;
+
+    char *deep = malloc(2 * depth + 1);
+    assert(deep);
+
+    for (size_t i = 0; i < depth; i++) {
+      deep[i] = '[';
+      deep[2 * depth - 1 - i] = ']';
+    }
+
+    deep[2 * depth] = '\0';
+
+    json_decode_options_t options = {.max_depth = 0};
+
+    e = json_decode_utf8_with_options((utf8_t *) deep, -1, &options, &value);
+    assert(e == 0);
+
+    free(deep);
+
+    e = json_set_immortal(value);
+    assert(e == 0);
+
+    assert(json_deref(value) == 1);
+  }
+}
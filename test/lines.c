@@ -0,0 +1,163 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utf.h>
+
+#include "../include/json.h"
+
+typedef struct {
+  size_t count;
+  size_t stop;
+  json_t *kept;
+  json_t *stored;
+} state_t;
+
+static int
+on_record(const json_t *value, size_t index, void *data) {
+  state_t *state = data;
+
+  assert(index == state->count);
+
+  // Records are numbered in order, regardless of which thread decoded them
+  json_t *id = json_object_get_literal_utf8(value, (utf8_t *) "id", -1);
+  assert(id);
+  assert(json_number_int64_value(id) == (int64_t) index);
+  json_deref(id);
+
+  // Arena nodes aren't reference counted
+  assert(json_is_frozen(value));
+
+  if (index == 1 && state->kept == NULL) {
+    int e = json_freeze(value, &state->kept);
+    assert(e == 0);
+  }
+
+  if (state->stored) {
+    int e = json_array_push(state->stored, (json_t *) value);
+    assert(e == 0);
+  }
+
+  state->count++;
+
+  return state->count == state->stop ? 42 : 0;
+}
+
+int
+main() {
+  int e;
+
+  json_lines_decoder_t *decoder;
+
+  {
+    e = json_create_lines_decoder(1, &decoder);
+    assert(e == 0);
+
+    const char *input = "{\"id\":0,\"a\":[1,2]}\n\n  {\"id\":1,\"b\":\"c\"} \r\n{\"id\":2}";
+
+    state_t state = {0, 0, NULL, NULL};
+
+    e = json_lines_decoder_decode_utf8(decoder, (utf8_t *) input, -1, on_record, &state);
+    assert(e == 0);
+    assert(state.count == 3);
+
+    // Records can be copied out of the arena
+    e = json_lines_decoder_decode_utf8(decoder, (utf8_t *) "{\"id\":0}", -1, on_record, &(state_t) {0, 0, NULL, NULL});
+    assert(e == 0);
+
+    utf8_t *encoded;
+    e = json_encode_utf8(state.kept, &encoded);
+    assert(e == 0);
+    assert(strcmp((char *) encoded, "{\"id\":1,\"b\":\"c\"}") == 0);
+    free(encoded);
+
+    json_deref(state.kept);
+
+    // Records before a malformed line are handed over
+    state = (state_t) {0, 0, NULL, NULL};
+
+    e = json_lines_decoder_decode_utf8(decoder, (utf8_t *) "{\"id\":0}\n{\"id\":1,}\n{\"id\":2}", -1, on_record, &state);
+    assert(e == -1);
+    assert(state.count == 1);
+
+    if (state.kept) json_deref(state.kept);
+
+    // Returning non-zero stops the batch
+    state = (state_t) {0, 2, NULL, NULL};
+
+    e = json_lines_decoder_decode_utf8(decoder, (utf8_t *) input, -1, on_record, &state);
+    assert(e == 42);
+    assert(state.count == 2);
+
+    if (state.kept) json_deref(state.kept);
+
+    json_destroy_lines_decoder(decoder);
+  }
+
+  // Storing records in another tree copies them out of the arena
+  {
+    e = json_create_lines_decoder(1, &decoder);
+    assert(e == 0);
+
+    state_t state = {0, 0, NULL, NULL};
+
+    e = json_create_array(0, &state.stored);
+    assert(e == 0);
+
+    e = json_lines_decoder_decode_utf8(decoder, (utf8_t *) "{\"id\":0,\"a\":[1,\"b\"]}\n{\"id\":1}", -1, on_record, &state);
+    assert(e == 0);
+
+    json_deref(state.kept);
+
+    json_destroy_lines_decoder(decoder);
+
+    utf8_t *encoded;
+    e = json_encode_utf8(state.stored, &encoded);
+    assert(e == 0);
+    assert(strcmp((char *) encoded, "[{\"id\":0,\"a\":[1,\"b\"]},{\"id\":1}]") == 0);
+    free(encoded);
+
+    json_deref(state.stored);
+  }
+
+  {
+    e = json_create_lines_decoder(4, &decoder);
+    assert(e == 0);
+
+    size_t n = 20000;
+
+    char *input = malloc(n * 64);
+    assert(input);
+
+    size_t len = 0;
+
+    for (size_t i = 0; i < n; i++) {
+      len += sprintf(&input[len], "{\"id\":%zu,\"name\":\"record\",\"values\":[%zu,1.5]}\n", i, i * 3);
+    }
+
+    for (int batch = 0; batch < 3; batch++) {
+      state_t state = {0, 0, NULL, NULL};
+
+      e = json_lines_decoder_decode_utf8(decoder, (utf8_t *) input, len, on_record, &state);
+      assert(e == 0);
+      assert(state.count == n);
+
+      if (state.kept) json_deref(state.kept);
+    }
+
+    // A malformed line stops the batch after the records before it
+    memcpy(&input[len / 2 - (len / 2) % 64], "!", 1);
+
+    state_t state = {0, 0, NULL, NULL};
+
+    e = json_lines_decoder_decode_utf8(decoder, (utf8_t *) input, len, on_record, &state);
+    assert(e == -1);
+    assert(state.count > 0 && state.count < n);
+
+    if (state.kept) json_deref(state.kept);
+
+    free(input);
+
+    json_destroy_lines_decoder(decoder);
+  }
+}
@@ -0,0 +1,67 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utf.h>
+
+#include "../include/json.h"
+
+int
+main() {
+  int e;
+
+  json_t *actual;
+  e = json_decode_utf8((utf8_t *) "[9007199254740993, -9223372036854775808, 18446744073709551615, 1.5, 42]", -1, &actual);
+  assert(e == 0);
+
+  json_t *v;
+
+  v = json_array_get(actual, 0);
+  assert(json_number_is_int64(v));
+  assert(json_number_int64_value(v) == INT64_C(9007199254740993));
+  json_deref(v);
+
+  v = json_array_get(actual, 1);
+  assert(json_number_int64_value(v) == INT64_MIN);
+  json_deref(v);
+
+  v = json_array_get(actual, 2);
+  assert(!json_number_is_int64(v));
+  assert(json_number_is_uint64(v));
+  assert(json_number_uint64_value(v) == UINT64_MAX);
+  assert(json_number_int64_value(v) == INT64_MAX);
+  json_deref(v);
+
+  v = json_array_get(actual, 3);
+  assert(!json_number_is_int64(v));
+  assert(json_number_value(v) == 1.5);
+  json_deref(v);
+
+  v = json_array_get(actual, 4);
+  assert(json_is_number(v));
+  assert(json_number_int64_value(v) == 42);
+  assert(json_number_value(v) == 42);
+  json_deref(v);
+
+  utf8_t *encoded;
+  e = json_encode_utf8(actual, &encoded);
+  assert(e == 0);
+
+  assert(strcmp((char *) encoded, "[9007199254740993,-9223372036854775808,18446744073709551615,1.5,42]") == 0);
+
+  free(encoded);
+
+  json_t *expected;
+  e = json_create_number(42, &expected);
+  assert(e == 0);
+
+  json_t *small;
+  e = json_create_number_int64(42, &small);
+  assert(e == 0);
+
+  assert(json_compare(small, expected) == 0);
+
+  json_deref(small);
+  json_deref(expected);
+  json_deref(actual);
+}
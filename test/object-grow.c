@@ -0,0 +1,61 @@
+#include <assert.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utf.h>
+
+#include "../include/json.h"
+
+int
+main() {
+  int e;
+
+  json_t *object;
+  e = json_decode_utf8((utf8_t *) "{ \"a\": 1 }", -1, &object);
+  assert(e == 0);
+
+  json_t *v;
+
+  for (int i = 0; i < 100; i++) {
+    char key[16];
+    snprintf(key, sizeof(key), "k%d", i);
+
+    e = json_create_number_int64(i, &v);
+    assert(e == 0);
+
+    e = json_object_set_literal_utf8(object, (utf8_t *) key, -1, v);
+    assert(e == 0);
+
+    json_deref(v);
+  }
+
+  assert(json_object_size(object) == 101);
+
+  for (int i = 0; i < 100; i += 2) {
+    char key[16];
+    snprintf(key, sizeof(key), "k%d", i);
+
+    e = json_object_delete_literal_utf8(object, (utf8_t *) key, -1);
+    assert(e == 0);
+  }
+
+  assert(json_object_size(object) == 51);
+
+  v = json_object_get_literal_utf8(object, (utf8_t *) "k99", -1);
+  assert(v && json_number_int64_value(v) == 99);
+  json_deref(v);
+
+  v = json_object_get_literal_utf8(object, (utf8_t *) "k98", -1);
+  assert(v == NULL);
+
+  e = json_object_delete_literal_utf8(object, (utf8_t *) "a", -1);
+  assert(e == 0);
+
+  utf8_t *encoded;
+  e = json_encode_utf8(object, &encoded);
+  assert(e == 0);
+  assert(strncmp((char *) encoded, "{\"k1\":1,\"k3\":3,", 15) == 0);
+  free(encoded);
+
+  json_deref(object);
+}
@@ -0,0 +1,171 @@
+#include <assert.h>
+#include <stdint.h>
+#include <utf.h>
+
+#include "../include/json.h"
+
+static json_t *
+decode(const char *input) {
+  json_t *value;
+
+  int e = json_decode_utf8((const utf8_t *) input, -1, &value);
+  assert(e == 0);
+
+  return value;
+}
+
+// Diff two documents and check that the patch turns the first into the second
+// without touching the original.
+static void
+round_trip(const char *from, const char *to) {
+  int e;
+
+  json_t *a = decode(from), *b = decode(to);
+
+  json_t *patch;
+  e = json_diff(a, b, &patch);
+  assert(e == 0);
+
+  json_ref(a);
+
+  json_t *result;
+  e = json_patch_apply(a, patch, &result);
+  assert(e == 0);
+
+  assert(json_equal(result, b));
+
+  json_t *original = decode(from);
+
+  assert(json_equal(a, original));
+
+  json_deref(original);
+  json_deref(result);
+  json_deref(patch);
+  json_deref(a);
+  json_deref(b);
+}
+
+static void
+apply(const char *document, const char *patch, const char *expected) {
+  int e;
+
+  json_t *p = decode(patch);
+
+  json_t *result;
+  e = json_patch_apply(decode(document), p, &result);
+
+  if (expected == NULL) {
+    assert(e == -1);
+  } else {
+    assert(e == 0);
+
+    json_t *want = decode(expected);
+
+    assert(json_equal(result, want));
+
+    json_deref(want);
+    json_deref(result);
+  }
+
+  json_deref(p);
+}
+
+int
+main() {
+  int e;
+
+  round_trip("{\"a\":1,\"b\":[1,2,3]}", "{\"a\":1,\"b\":[1,2,3]}");
+  round_trip("{\"a\":1,\"b\":{\"c\":true}}", "{\"b\":{\"c\":false,\"d\":null},\"e\":\"x\"}");
+  round_trip("[1,2,3,4,5]", "[0,1,3,4,6,5,7]");
+  round_trip("[{\"id\":1,\"v\":1},{\"id\":2,\"v\":2},{\"id\":3}]", "[{\"id\":2,\"v\":3},{\"id\":3},{\"id\":4}]");
+  round_trip("[[1,2],[3,4]]", "[[1,2,5],[4]]");
+  round_trip("{\"a/b\":1,\"c~d\":[]}", "{\"a/b\":2,\"c~d\":[\"x\"]}");
+  round_trip("[1,\"a\",null]", "{\"a\":[1]}");
+  round_trip("[]", "[1,2,3]");
+  round_trip("[1,2,3]", "[]");
+  round_trip("1", "\"x\"");
+  round_trip("{}", "null");
+
+  // Unchanged documents produce empty patches
+  json_t *a = decode("{\"a\":[1,2,{\"b\":3}]}"), *b = decode("{\"a\":[1,2,{\"b\":3}]}");
+
+  json_t *patch;
+  e = json_diff(a, b, &patch);
+  assert(e == 0);
+
+  assert(json_array_size(patch) == 0);
+
+  json_deref(patch);
+  json_deref(a);
+  json_deref(b);
+
+  // Examples from RFC 6902
+  apply("{\"foo\":\"bar\"}", "[{\"op\":\"add\",\"path\":\"/baz\",\"value\":\"qux\"}]", "{\"foo\":\"bar\",\"baz\":\"qux\"}");
+  apply("{\"foo\":[\"bar\",\"baz\"]}", "[{\"op\":\"add\",\"path\":\"/foo/1\",\"value\":\"qux\"}]", "{\"foo\":[\"bar\",\"qux\",\"baz\"]}");
+  apply("{\"foo\":[\"bar\",\"qux\",\"baz\"]}", "[{\"op\":\"remove\",\"path\":\"/foo/1\"}]", "{\"foo\":[\"bar\",\"baz\"]}");
+  apply("{\"baz\":\"qux\",\"foo\":\"bar\"}", "[{\"op\":\"replace\",\"path\":\"/baz\",\"value\":\"boo\"}]", "{\"baz\":\"boo\",\"foo\":\"bar\"}");
+  apply("{\"foo\":{\"bar\":\"baz\",\"waldo\":\"fred\"},\"qux\":{\"corge\":\"grault\"}}", "[{\"op\":\"move\",\"from\":\"/foo/waldo\",\"path\":\"/qux/thud\"}]", "{\"foo\":{\"bar\":\"baz\"},\"qux\":{\"corge\":\"grault\",\"thud\":\"fred\"}}");
+  apply("{\"foo\":[\"all\",\"grass\",\"cows\",\"eat\"]}", "[{\"op\":\"move\",\"from\":\"/foo/1\",\"path\":\"/foo/3\"}]", "{\"foo\":[\"all\",\"cows\",\"eat\",\"grass\"]}");
+  apply("{\"foo\":[1,2]}", "[{\"op\":\"add\",\"path\":\"/foo/-\",\"value\":3}]", "{\"foo\":[1,2,3]}");
+  apply("{\"foo\":[1,2]}", "[{\"op\":\"copy\",\"from\":\"/foo\",\"path\":\"/foo/-\"}]", "{\"foo\":[1,2,[1,2]]}");
+  apply("{\"foo\":1}", "[{\"op\":\"add\",\"path\":\"\",\"value\":[]}]", "[]");
+  apply("{\"baz\":\"qux\"}", "[{\"op\":\"test\",\"path\":\"/baz\",\"value\":\"qux\"}]", "{\"baz\":\"qux\"}");
+
+  // Failing operations
+  apply("{\"baz\":\"qux\"}", "[{\"op\":\"test\",\"path\":\"/baz\",\"value\":\"bar\"}]", NULL);
+  apply("{\"foo\":\"bar\"}", "[{\"op\":\"add\",\"path\":\"/baz/bat\",\"value\":\"qux\"}]", NULL);
+  apply("{\"foo\":[1]}", "[{\"op\":\"add\",\"path\":\"/foo/2\",\"value\":1}]", NULL);
+  apply("{\"foo\":{}}", "[{\"op\":\"move\",\"from\":\"/foo\",\"path\":\"/foo/bar\"}]", NULL);
+  apply("{\"foo\":1}", "[{\"op\":\"replace\",\"path\":\"/bar\",\"value\":1}]", NULL);
+  apply("{\"foo\":1}", "[{\"op\":\"remove\",\"path\":\"/bar\"}]", NULL);
+  apply("{\"foo\":1}", "[{\"op\":\"frobnicate\",\"path\":\"/foo\"}]", NULL);
+
+  // Patches don't refer into frozen documents they were computed from
+  a = decode("{\"a\":1,\"b\":[1]}");
+  b = decode("{\"a\":{\"c\":[2,3]},\"b\":[1,{\"d\":\"x\"}]}");
+
+  json_t *frozen;
+  e = json_freeze(b, &frozen);
+  assert(e == 0);
+
+  e = json_diff(a, frozen, &patch);
+  assert(e == 0);
+
+  json_deref(frozen);
+
+  json_t *result;
+  e = json_patch_apply(a, patch, &result);
+  assert(e == 0);
+
+  assert(json_equal(result, b));
+
+  json_deref(result);
+  json_deref(patch);
+  json_deref(b);
+
+  // Frozen documents are copied along the patched paths
+  json_t *p = decode("[{\"op\":\"remove\",\"path\":\"/a/b/0\"},{\"op\":\"copy\",\"from\":\"/d\",\"path\":\"/a/e\"}]");
+
+  b = decode("{\"a\":{\"b\":[2,3],\"c\":{\"x\":[1]}},\"d\":{\"y\":\"z\"}}");
+
+  e = json_freeze(b, &frozen);
+  assert(e == 0);
+
+  json_ref(frozen);
+
+  e = json_patch_apply(frozen, p, &result);
+  assert(e == 0);
+
+  assert(json_equal(frozen, b));
+
+  json_deref(frozen);
+
+  json_t *want = decode("{\"a\":{\"b\":[3],\"c\":{\"x\":[1]},\"e\":{\"y\":\"z\"}},\"d\":{\"y\":\"z\"}}");
+
+  assert(json_equal(result, want));
+
+  json_deref(want);
+  json_deref(result);
+  json_deref(p);
+  json_deref(b);
+}
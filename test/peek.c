@@ -0,0 +1,69 @@
+#include <assert.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <utf.h>
+
+#include "../include/json.h"
+
+int
+main() {
+  int e;
+
+  json_t *value;
+  e = json_decode_utf8((utf8_t *) "{\"a\":[1.5,2.5],\"b\":[1,9223372036854775807],\"c\":\"d\"}", -1, &value);
+  assert(e == 0);
+
+  size_t i, j;
+  const json_t *key, *property;
+
+  size_t count = 0;
+
+  json_object_foreach(value, i, key, property) {
+    assert(json_is_string(key));
+
+    count++;
+  }
+
+  assert(count == 3);
+
+  const json_t *a = json_object_peek_utf8(value, (utf8_t *) "a", -1);
+  assert(a && json_is_array(a));
+
+  const json_t *element;
+  double sum = 0;
+
+  json_array_foreach(a, j, element) {
+    assert(json_is_number(element));
+
+    sum += json_number_value(element);
+  }
+
+  assert(sum == 4);
+
+  const json_t *b = json_object_peek_utf8(value, (utf8_t *) "b", -1);
+  assert(b);
+
+  assert(json_number_int64_value(json_array_peek(b, 0)) == 1);
+  assert(json_number_int64_value(json_array_peek(b, 1)) == INT64_MAX);
+  assert(json_array_peek(b, 2) == NULL);
+
+  // Borrowed elements are copied when stored elsewhere
+  json_t *copy;
+  e = json_create_array(1, &copy);
+  assert(e == 0);
+
+  e = json_array_set(copy, 0, (json_t *) json_array_peek(a, 0));
+  assert(e == 0);
+
+  e = json_array_set(copy, 0, (json_t *) json_array_peek(b, 1));
+  assert(e == 0);
+
+  json_deref(value);
+
+  json_t *v = json_array_get(copy, 0);
+  assert(json_number_int64_value(v) == INT64_MAX);
+  json_deref(v);
+
+  json_deref(copy);
+}
@@ -0,0 +1,141 @@
+#include <assert.h>
+#include <stdint.h>
+#include <utf.h>
+
+#include "../include/json.h"
+
+static json_t *
+decode(const char *input) {
+  json_t *value;
+
+  int e = json_decode_utf8((const utf8_t *) input, -1, &value);
+  assert(e == 0);
+
+  return value;
+}
+
+static void
+assert_equal(const json_t *value, const char *expected) {
+  json_t *want = decode(expected);
+
+  assert(json_equal(value, want));
+
+  json_deref(want);
+}
+
+int
+main() {
+  int e;
+
+  const char *document = "{\"a\":{\"b\":[1,{\"c\":true}],\"d\":\"x\"},\"e\":[1,2,3],\"f\":{\"g\":null}}";
+
+  json_t *root = decode(document);
+
+  json_t *value;
+  e = json_create_number(42, &value);
+  assert(e == 0);
+
+  // Setting through a pointer copies only the path
+  json_pointer_t *pointer;
+  e = json_create_pointer_utf8((const utf8_t *) "/a/b/1/c", -1, &pointer);
+  assert(e == 0);
+
+  json_t *updated;
+  e = json_pointer_set_persistent(pointer, root, value, &updated);
+  assert(e == 0);
+
+  assert_equal(root, document);
+  assert_equal(updated, "{\"a\":{\"b\":[1,{\"c\":42}],\"d\":\"x\"},\"e\":[1,2,3],\"f\":{\"g\":null}}");
+
+  assert(updated != root);
+  assert(json_object_peek_utf8(updated, (const utf8_t *) "a", 1) != json_object_peek_utf8(root, (const utf8_t *) "a", 1));
+  assert(json_object_peek_utf8(updated, (const utf8_t *) "e", 1) == json_object_peek_utf8(root, (const utf8_t *) "e", 1));
+  assert(json_object_peek_utf8(updated, (const utf8_t *) "f", 1) == json_object_peek_utf8(root, (const utf8_t *) "f", 1));
+
+  json_destroy_pointer(pointer);
+
+  // Missing properties and elements past the end are added
+  e = json_create_pointer_utf8((const utf8_t *) "/e/-", -1, &pointer);
+  assert(e == 0);
+
+  json_t *appended;
+  e = json_pointer_set_persistent(pointer, updated, value, &appended);
+  assert(e == 0);
+
+  assert_equal(appended, "{\"a\":{\"b\":[1,{\"c\":42}],\"d\":\"x\"},\"e\":[1,2,3,42],\"f\":{\"g\":null}}");
+  assert_equal(root, document);
+
+  json_deref(appended);
+  json_destroy_pointer(pointer);
+
+  e = json_create_pointer_utf8((const utf8_t *) "/x/y", -1, &pointer);
+  assert(e == 0);
+
+  e = json_pointer_set_persistent(pointer, root, value, &appended);
+  assert(e == -1);
+
+  json_destroy_pointer(pointer);
+
+  // Single level updates
+  const json_t *e_array = json_object_peek_utf8(root, (const utf8_t *) "e", 1);
+
+  json_t *array;
+  e = json_array_with(e_array, 0, value, &array);
+  assert(e == 0);
+
+  assert_equal(array, "[42,2,3]");
+  assert_equal(e_array, "[1,2,3]");
+
+  json_deref(array);
+
+  e = json_array_with(e_array, 3, value, &array);
+  assert(e == 0);
+
+  assert_equal(array, "[1,2,3,42]");
+
+  json_deref(array);
+
+  e = json_array_with(e_array, 4, value, &array);
+  assert(e == -1);
+
+  json_t *key;
+  e = json_create_string_utf8((const utf8_t *) "h", 1, &key);
+  assert(e == 0);
+
+  json_t *object;
+  e = json_object_with(root, key, value, &object);
+  assert(e == 0);
+
+  assert_equal(object, "{\"a\":{\"b\":[1,{\"c\":true}],\"d\":\"x\"},\"e\":[1,2,3],\"f\":{\"g\":null},\"h\":42}");
+  assert_equal(root, document);
+
+  assert(json_object_peek_utf8(object, (const utf8_t *) "a", 1) == json_object_peek_utf8(root, (const utf8_t *) "a", 1));
+
+  json_deref(object);
+  json_deref(key);
+
+  // Frozen trees are copied along the path and outlived by the result
+  json_t *frozen;
+  e = json_freeze(root, &frozen);
+  assert(e == 0);
+
+  e = json_create_pointer_utf8((const utf8_t *) "/a/b/0", -1, &pointer);
+  assert(e == 0);
+
+  json_t *frozen_updated;
+  e = json_pointer_set_persistent(pointer, frozen, value, &frozen_updated);
+  assert(e == 0);
+
+  assert_equal(frozen, document);
+
+  json_deref(frozen);
+
+  assert_equal(frozen_updated, "{\"a\":{\"b\":[42,{\"c\":true}],\"d\":\"x\"},\"e\":[1,2,3],\"f\":{\"g\":null}}");
+
+  json_deref(frozen_updated);
+  json_destroy_pointer(pointer);
+
+  json_deref(value);
+  json_deref(updated);
+  json_deref(root);
+}
@@ -0,0 +1,107 @@
+#include <assert.h>
+#include <stdint.h>
+#include <string.h>
+#include <utf.h>
+
+#include "../include/json.h"
+
+static const char *document = "{\"a\":{\"b\":[true,{\"c\":\"hello\"},3,4.5]},\"m~n\":1,\"x/y\":[1,2,3],\"\":null,\"s\":\"\\\"}\",\"\\u00e9t\\u00e9\":2}";
+
+static json_pointer_t *
+compile(const char *input) {
+  json_pointer_t *pointer;
+
+  int e = json_create_pointer_utf8((const utf8_t *) input, -1, &pointer);
+  assert(e == 0);
+
+  return pointer;
+}
+
+static json_t *
+decode(const char *input) {
+  json_t *value;
+
+  int e = json_decode_utf8((const utf8_t *) input, -1, &value);
+  assert(e == 0);
+
+  return value;
+}
+
+// Resolve a pointer both on the decoded tree and on the raw document, and
+// check that the two agree with the expected value.
+static void
+check(const json_t *tree, const char *input, const char *expected) {
+  int e;
+
+  json_pointer_t *pointer = compile(input);
+
+  const json_t *peeked = json_pointer_peek(pointer, tree);
+
+  json_t *got = json_pointer_get(pointer, tree);
+
+  json_t *raw;
+  e = json_pointer_decode_utf8(pointer, (const utf8_t *) document, -1, &raw);
+  assert(e == 0);
+
+  if (expected == NULL) {
+    assert(peeked == NULL);
+    assert(got == NULL);
+    assert(raw == NULL);
+  } else {
+    json_t *value = decode(expected);
+
+    assert(json_equal(peeked, value));
+    assert(json_equal(got, value));
+    assert(json_equal(raw, value));
+
+    json_deref(value);
+    json_deref(got);
+    json_deref(raw);
+  }
+
+  json_destroy_pointer(pointer);
+}
+
+int
+main() {
+  int e;
+
+  json_t *tree = decode(document);
+
+  check(tree, "", document);
+  check(tree, "/a/b/1/c", "\"hello\"");
+  check(tree, "/a/b/2", "3");
+  check(tree, "/a/b/3", "4.5");
+  check(tree, "/a/b/0", "true");
+  check(tree, "/m~0n", "1");
+  check(tree, "/x~1y/2", "3");
+  check(tree, "/", "null");
+  check(tree, "/s", "\"\\\"}\"");
+  check(tree, "/\xc3\xa9t\xc3\xa9", "2");
+
+  check(tree, "/a/b/4", NULL);
+  check(tree, "/a/b/-", NULL);
+  check(tree, "/a/b/01", NULL);
+  check(tree, "/a/c", NULL);
+  check(tree, "/a/b/0/c", NULL);
+  check(tree, "/z", NULL);
+
+  json_pointer_t *pointer;
+
+  e = json_create_pointer_utf8((const utf8_t *) "a", -1, &pointer);
+  assert(e == -1);
+
+  e = json_create_pointer_utf8((const utf8_t *) "/a~2", -1, &pointer);
+  assert(e == -1);
+
+  // Malformed input before the value is rejected
+  pointer = compile("/b");
+
+  json_t *raw;
+  e = json_pointer_decode_utf8(pointer, (const utf8_t *) "{\"a\":[1,}],\"b\":2}", -1, &raw);
+  assert(e == -1);
+
+  json_destroy_pointer(pointer);
+
+  json_deref(tree);
+}
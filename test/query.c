@@ -0,0 +1,130 @@
+#include <assert.h>
+#include <stdint.h>
+#include <utf.h>
+
+#include "../include/json.h"
+
+static const char *document =
+  "{\"store\":{"
+  "\"books\":["
+  "{\"title\":\"A\",\"price\":8,\"isbn\":\"1\"},"
+  "{\"title\":\"B\",\"price\":12.5},"
+  "{\"title\":\"C\",\"price\":9,\"isbn\":\"2\"},"
+  "{\"title\":\"D\",\"price\":22}"
+  "],"
+  "\"bicycle\":{\"color\":\"red\",\"price\":19}"
+  "},\"numbers\":[0,1,2,3,4,5,6]}";
+
+static json_t *
+decode(const char *input) {
+  json_t *value;
+
+  int e = json_decode_utf8((const utf8_t *) input, -1, &value);
+  assert(e == 0);
+
+  return value;
+}
+
+static int
+on_match(const json_t *value, void *data) {
+  return json_array_push(data, (json_t *) value);
+}
+
+// Evaluate a query both on the decoded tree and directly on the document, and
+// check that both yield the expected matches in order.
+static void
+check(const json_t *tree, const char *input, const char *expected) {
+  int e;
+
+  json_query_t *query;
+  e = json_create_query_utf8((const utf8_t *) input, -1, &query);
+  assert(e == 0);
+
+  json_t *want = decode(expected);
+
+  json_t *results;
+
+  e = json_create_array(0, &results);
+  assert(e == 0);
+
+  e = json_query_evaluate(query, tree, on_match, results);
+  assert(e == 0);
+
+  assert(json_equal(results, want));
+
+  json_deref(results);
+
+  e = json_create_array(0, &results);
+  assert(e == 0);
+
+  e = json_query_evaluate_utf8(query, (const utf8_t *) document, -1, on_match, results);
+  assert(e == 0);
+
+  assert(json_equal(results, want));
+
+  json_deref(results);
+  json_deref(want);
+
+  json_destroy_query(query);
+}
+
+static int
+stop(const json_t *value, void *data) {
+  (void) value;
+
+  int *count = data;
+
+  return ++*count == 2 ? 42 : 0;
+}
+
+int
+main() {
+  int e;
+
+  json_t *tree = decode(document);
+
+  check(tree, "$.store.bicycle.color", "[\"red\"]");
+  check(tree, "$['store']['bicycle'][\"price\"]", "[19]");
+  check(tree, "$.store.books[*].title", "[\"A\",\"B\",\"C\",\"D\"]");
+  check(tree, "$..price", "[8,12.5,9,22,19]");
+  check(tree, "$.store.books[1].title", "[\"B\"]");
+  check(tree, "$.numbers[1:5:2]", "[1,3]");
+  check(tree, "$.numbers[4:]", "[4,5,6]");
+  check(tree, "$.numbers[:2]", "[0,1]");
+  check(tree, "$.store.books[?(@.isbn)].title", "[\"A\",\"C\"]");
+  check(tree, "$.store.books[?(@.price < 10)].title", "[\"A\",\"C\"]");
+  check(tree, "$..books[?(@.title == 'D')].price", "[22]");
+  check(tree, "$.numbers[?(@ >= 5)]", "[5,6]");
+  check(tree, "$.store.*.color", "[\"red\"]");
+  check(tree, "$.missing", "[]");
+  check(tree, "$.numbers[7]", "[]");
+  check(tree, "$..isbn", "[\"1\",\"2\"]");
+  check(tree, "$..[0].title", "[\"A\"]");
+
+  // Evaluation stops when the callback returns non-zero
+  json_query_t *query;
+  e = json_create_query_utf8((const utf8_t *) "$..price", -1, &query);
+  assert(e == 0);
+
+  int count = 0;
+
+  e = json_query_evaluate(query, tree, stop, &count);
+  assert(e == 42);
+
+  count = 0;
+
+  e = json_query_evaluate_utf8(query, (const utf8_t *) document, -1, stop, &count);
+  assert(e == 42);
+
+  json_destroy_query(query);
+
+  // Malformed queries
+  const char *invalid[] = {"", "store", "$.", "$[", "$[-1]", "$[1:2:0]", "$[?(@.a == )]", "$.a[?(x)]", "$[?(@['a' == 1)]"};
+
+  for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+    e = json_create_query_utf8((const utf8_t *) invalid[i], -1, &query);
+    assert(e == -1);
+  }
+
+  json_deref(tree);
+}
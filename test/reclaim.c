@@ -0,0 +1,49 @@
+#include <assert.h>
+#include <utf.h>
+
+#include "../include/json.h"
+
+int
+main() {
+  int e;
+
+  e = json_reclaim_start();
+  assert(e == 0);
+
+  for (int i = 0; i < 100; i++) {
+    json_t *value;
+    e = json_decode_utf8((utf8_t *) "{\"a\":[1,\"b\",{\"c\":[2.5,null]}],\"d\":[[],{}]}", -1, &value);
+    assert(e == 0);
+
+    e = json_deref(value);
+    assert(e == 0);
+  }
+
+  json_reclaim_stop();
+
+  // Containers are freed inline again once stopped
+  json_t *value;
+  e = json_create_array(0, &value);
+  assert(e == 0);
+
+  e = json_deref(value);
+  assert(e == 0);
+
+  assert(json_reclaim_poll() == 0);
+
+  // Polling frees deferred trees on the calling thread
+  json_reclaim_enable();
+
+  for (int i = 0; i < 10; i++) {
+    e = json_decode_utf8((utf8_t *) "[[1],{\"a\":\"b\"}]", -1, &value);
+    assert(e == 0);
+
+    e = json_deref(value);
+    assert(e == 0);
+  }
+
+  assert(json_reclaim_poll() == 10);
+  assert(json_reclaim_poll() == 0);
+
+  json_reclaim_stop();
+}
@@ -0,0 +1,38 @@
+#include <assert.h>
+#include <string.h>
+#include <utf.h>
+
+#include "../include/json.h"
+
+int
+main() {
+  int e;
+
+  json_t *a;
+  e = json_create_string_utf8((utf8_t *) "a\0b", 3, &a);
+  assert(e == 0);
+
+  assert(json_string_length(a) == 3);
+  assert(memcmp(json_string_value_utf8(a), "a\0b", 4) == 0);
+
+  json_t *b;
+  e = json_create_string_utf8((utf8_t *) "a", -1, &b);
+  assert(e == 0);
+
+  assert(json_string_length(b) == 1);
+
+  assert(!json_equal(a, b));
+  assert(json_compare(a, b) > 0);
+
+  json_t *c;
+  e = json_create_string_utf16le((utf16_t[]) {'a', 'b', 0}, -1, &c);
+  assert(e == 0);
+
+  assert(json_string_length(c) == 2);
+  assert(json_string_value_utf16le(c)[1] == 'b');
+  assert(json_string_value_utf16le(c)[2] == 0);
+
+  json_deref(a);
+  json_deref(b);
+  json_deref(c);
+}